@@ -57,6 +57,7 @@ static int send_password_packet(POOL_CONNECTION *backend, int protoMajor, char *
 static int send_auth_ok(POOL_CONNECTION *frontend, int protoMajor);
 
 static long PostmasterRandom(void);
+static void set_frontend_cancel_key(POOL_CONNECTION_POOL *cp, int *pid, int *key);
 
 /*
  * After sending the start up packet to the backend, do the
@@ -420,6 +421,10 @@ int pool_do_auth(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *cp)
                 (errmsg("authentication failed"),
                  errdetail("pool_do_auth: all backends are down")));
 	}
+
+	if (pool_config->pooling_mode == POOLING_TRANSACTION)
+		set_frontend_cancel_key(cp, &pid, &key);
+
 	if(pool_send_backend_key_data(frontend, pid, key, protoMajor))
 		ereport(ERROR,
 			(errmsg("authentication failed"),
@@ -434,6 +439,7 @@ int pool_do_reauth(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *cp)
 {
 	int protoMajor;
     int msglen;
+	int pid, key;
 
 	protoMajor = MAJOR(cp);
 
@@ -475,10 +481,38 @@ int pool_do_reauth(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *cp)
 
     msglen = htonl(0);
     pool_write_and_flush(frontend, &msglen, sizeof(msglen));
-	pool_send_backend_key_data(frontend, MASTER_CONNECTION(cp)->pid, MASTER_CONNECTION(cp)->key, protoMajor);
+
+	pid = MASTER_CONNECTION(cp)->pid;
+	key = MASTER_CONNECTION(cp)->key;
+	if (pool_config->pooling_mode == POOLING_TRANSACTION)
+		set_frontend_cancel_key(cp, &pid, &key);
+
+	pool_send_backend_key_data(frontend, pid, key, protoMajor);
     return 0;
 }
 
+/*
+ * In transaction pooling mode a session moves among backend
+ * connections, so the frontend cannot be given the cancel key of a
+ * backend.  Generate a new cancel key and remember it in the connection
+ * info, which cancel_request() looks for.  The pid is kept as it is.
+ */
+static void set_frontend_cancel_key(POOL_CONNECTION_POOL *cp, int *pid, int *key)
+{
+	int i;
+
+	*key = (int) PostmasterRandom();
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		cp->info[i].frontend_pid = *pid;
+		cp->info[i].frontend_key = *key;
+	}
+}
+
 /*
 * send authentication failure message text to frontend
 */
@@ -198,6 +198,25 @@ static const struct config_enum_entry memqcache_method_options[] = {
 	{NULL, 0, false}
 };
 
+static const struct config_enum_entry process_management_mode_options[] = {
+	{"static", PM_STATIC, false},
+	{"dynamic", PM_DYNAMIC, false},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry pooling_mode_options[] = {
+	{"session", POOLING_SESSION, false},
+	{"transaction", POOLING_TRANSACTION, false},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry load_balance_algorithm_options[] = {
+	{"random", LB_RANDOM, false},
+	{"least_outstanding", LB_LEAST_OUTSTANDING, false},
+	{"latency", LB_LATENCY, false},
+	{NULL, 0, false}
+};
+
 static const struct config_enum_entry wd_lifecheck_method_options[] = {
 	{"query", LIFECHECK_BY_QUERY, false},
 	{"heartbeat", LIFECHECK_BY_HB, false},
@@ -308,6 +327,46 @@ static struct config_bool ConfigureNamesBool[] =
 		NULL, NULL,NULL
 	},
 
+	{
+		{"statement_level_load_balance", CFGCXT_RELOAD, LOAD_BALANCE_CONFIG,
+			"Chooses the load balance node for each statement outside of a transaction.",
+			CONFIG_VAR_TYPE_BOOL,false, 0
+		},
+		&g_pool_config.statement_level_load_balance,
+		false,
+		NULL, NULL,NULL
+	},
+
+	{
+		{"cache_affinity_routing", CFGCXT_RELOAD, LOAD_BALANCE_CONFIG,
+			"Sends SELECTs on the same table to the same node, chosen by consistent hashing.",
+			CONFIG_VAR_TYPE_BOOL,false, 0
+		},
+		&g_pool_config.cache_affinity_routing,
+		false,
+		NULL, NULL,NULL
+	},
+
+	{
+		{"lag_aware_routing", CFGCXT_RELOAD, STREAMING_REPLICATION_CONFIG,
+			"Send SELECTs to a standby within delay_threshold when the load balance node lags behind.",
+			CONFIG_VAR_TYPE_BOOL,false, 0
+		},
+		&g_pool_config.lag_aware_routing,
+		false,
+		NULL, NULL,NULL
+	},
+
+	{
+		{"read_your_writes", CFGCXT_RELOAD, STREAMING_REPLICATION_CONFIG,
+			"After a session writes, load balance its SELECTs only to standbys which have replayed the write.",
+			CONFIG_VAR_TYPE_BOOL,false, 0
+		},
+		&g_pool_config.read_your_writes,
+		false,
+		NULL, NULL,NULL
+	},
+
 	{
 		{"replication_stop_on_mismatch", CFGCXT_RELOAD, REPLICATION_CONFIG,
 			"Starts degeneration and stops replication, If there's a data mismatch between master and secondary.",
@@ -358,6 +417,16 @@ static struct config_bool ConfigureNamesBool[] =
 		NULL, NULL,NULL
 	},
 
+	{
+		{"global_connection_pool", CFGCXT_INIT, CONNECTION_POOL_CONFIG,
+			"Shares idle backend connections among child processes.",
+			CONFIG_VAR_TYPE_BOOL,false, 0
+		},
+		&g_pool_config.global_connection_pool,
+		false,
+		NULL, NULL,NULL
+	},
+
 	{
 		{"fail_over_on_backend_error", CFGCXT_RELOAD, FAILOVER_CONFIG,
 			"Triggers fail over when reading/writing to backend socket fails.",
@@ -478,6 +547,16 @@ static struct config_bool ConfigureNamesBool[] =
 		NULL, NULL,NULL
 	},
 
+	{
+		{"memqcache_key_verification", CFGCXT_INIT, CACHE_CONFIG,
+			"Verifies the whole cache key to rule out hash collisions on cache hit.",
+			CONFIG_VAR_TYPE_BOOL,false, 0
+		},
+		&g_pool_config.memqcache_key_verification,
+		false,
+		NULL, NULL,NULL
+	},
+
 	{
 		{"allow_sql_comments", CFGCXT_SESSION, LOAD_BALANCE_CONFIG,
 			"Ignore SQL comments, while judging if load balance or query cache is possible.",
@@ -943,6 +1022,16 @@ static struct config_string ConfigureNamesString[] =
 		NULL, NULL, NULL, NULL
 	},
 
+	{
+		{"memqcache_snapshot_file", CFGCXT_INIT, CACHE_CONFIG,
+			"File to save query cache at shutdown and load at start up.",
+			CONFIG_VAR_TYPE_STRING,false, 0
+		},
+		&g_pool_config.memqcache_snapshot_file,
+		"",
+		NULL, NULL, NULL, NULL
+	},
+
 	{
 		{"memqcache_memcached_host", CFGCXT_INIT, CACHE_CONFIG,
 			"Hostname or IP address of memcached.",
@@ -1533,6 +1622,50 @@ static struct config_int ConfigureNamesInt[] =
 		0,INT_MAX,
 		NULL, NULL, NULL
 	},
+
+	{
+		{"max_sessions_per_child", CFGCXT_INIT, CONNECTION_POOL_CONFIG,
+			"Maximum number of client sessions multiplexed by a child process.",
+			CONFIG_VAR_TYPE_INT,false, 0
+		},
+		&g_pool_config.max_sessions_per_child,
+		1,
+		1,INT_MAX,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"min_spare_children", CFGCXT_RELOAD, CONNECTION_POOL_CONFIG,
+			"Minimum number of idle child processes in dynamic process management mode.",
+			CONFIG_VAR_TYPE_INT,false, 0
+		},
+		&g_pool_config.min_spare_children,
+		5,
+		1,INT_MAX,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"max_spare_children", CFGCXT_RELOAD, CONNECTION_POOL_CONFIG,
+			"Maximum number of idle child processes in dynamic process management mode.",
+			CONFIG_VAR_TYPE_INT,false, 0
+		},
+		&g_pool_config.max_spare_children,
+		10,
+		1,INT_MAX,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"global_pool_size", CFGCXT_INIT, CONNECTION_POOL_CONFIG,
+			"Maximum number of idle backend connection sets kept by the global connection pool.",
+			CONFIG_VAR_TYPE_INT,false, 0
+		},
+		&g_pool_config.global_pool_size,
+		100,
+		1,INT_MAX,
+		NULL, NULL, NULL
+	},
 	
 	{
 		{"sr_check_period", CFGCXT_RELOAD, STREAMING_REPLICATION_CONFIG,
@@ -1545,6 +1678,17 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"sr_check_lag_interval", CFGCXT_RELOAD, STREAMING_REPLICATION_CONFIG,
+			"Time interval in milliseconds between the streaming replication delay checks. Overrides sr_check_period if > 0.",
+			CONFIG_VAR_TYPE_INT,false, 0
+		},
+		&g_pool_config.sr_check_lag_interval,
+		0,
+		0,INT_MAX,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"recovery_timeout", CFGCXT_RELOAD, RECOVERY_CONFIG,
 			"Maximum time in seconds to wait for the recovering PostgreSQL node.",
@@ -1699,6 +1843,39 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 	
+	{
+		{"memqcache_stale_grace", CFGCXT_INIT, CACHE_CONFIG,
+			"Seconds to keep on returning expired cache entry while it is refreshed.",
+			CONFIG_VAR_TYPE_INT,false, 0
+		},
+		&g_pool_config.memqcache_stale_grace,
+		0,
+		0,INT_MAX,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"memqcache_coalesce_timeout", CFGCXT_RELOAD, CACHE_CONFIG,
+			"Maximum time in milliseconds to wait for other child executing the same query to cache the result.",
+			CONFIG_VAR_TYPE_INT,false, 0
+		},
+		&g_pool_config.memqcache_coalesce_timeout,
+		0,
+		0,INT_MAX,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"memqcache_compress_threshold", CFGCXT_RELOAD, CACHE_CONFIG,
+			"Compress query cache entries of at least this size in bytes.",
+			CONFIG_VAR_TYPE_INT,false, 0
+		},
+		&g_pool_config.memqcache_compress_threshold,
+		0,
+		0,INT_MAX,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"memqcache_maxcache", CFGCXT_INIT, CACHE_CONFIG,
 			"Maximum SELECT result size in bytes.",
@@ -1784,6 +1961,39 @@ static struct config_enum ConfigureNamesEnum[] =
 		NULL, NULL, NULL, NULL
 	},
 
+	{
+		{"process_management_mode", CFGCXT_INIT, CONNECTION_POOL_CONFIG,
+			"Whether the number of child processes is fixed or adjusted to the load.",
+			CONFIG_VAR_TYPE_ENUM,false, 0
+		},
+		(int*)&g_pool_config.process_management_mode,
+		PM_STATIC,
+		process_management_mode_options,
+		NULL, NULL, NULL, NULL
+	},
+
+	{
+		{"pooling_mode", CFGCXT_INIT, CONNECTION_POOL_CONFIG,
+			"Whether a backend connection is bound to a client session or to a transaction.",
+			CONFIG_VAR_TYPE_ENUM,false, 0
+		},
+		(int*)&g_pool_config.pooling_mode,
+		POOLING_SESSION,
+		pooling_mode_options,
+		NULL, NULL, NULL, NULL
+	},
+
+	{
+		{"load_balance_algorithm", CFGCXT_INIT, LOAD_BALANCE_CONFIG,
+			"Algorithm to choose the load balance node.",
+			CONFIG_VAR_TYPE_ENUM,false, 0
+		},
+		(int*)&g_pool_config.load_balance_algorithm,
+		LB_RANDOM,
+		load_balance_algorithm_options,
+		NULL, NULL, NULL, NULL
+	},
+
 	{
 		{"log_standby_delay", CFGCXT_RELOAD, MASTER_SLAVE_CONFIG,
 			"When to log standby delay.",
@@ -3992,6 +4202,37 @@ static bool config_post_processor(ConfigContext context, int elevel)
 	}
 
 
+	if (pool_config->process_management_mode == PM_DYNAMIC &&
+		pool_config->min_spare_children >= pool_config->max_spare_children)
+	{
+		ereport(elevel,
+				(errmsg("invalid configuration, max_spare_children:%d must be greater than min_spare_children:%d",
+						pool_config->max_spare_children, pool_config->min_spare_children)));
+		return false;
+	}
+
+	if (pool_config->pooling_mode == POOLING_TRANSACTION &&
+		pool_config->max_sessions_per_child <= 1)
+	{
+		ereport(WARNING,
+				(errmsg("pooling_mode = transaction has no effect"),
+				 errdetail("transaction pooling needs max_sessions_per_child greater than 1")));
+	}
+
+	/*
+	 * read_your_writes relies on the standbys' replayed WAL locations
+	 * collected by the streaming replication check.  Without the check
+	 * every read after a write would go to the primary.
+	 */
+	if (pool_config->read_your_writes &&
+		pool_config->sr_check_period <= 0 &&
+		pool_config->sr_check_lag_interval <= 0)
+	{
+		ereport(elevel,
+				(errmsg("invalid configuration, read_your_writes requires sr_check_period or sr_check_lag_interval to be greater than 0")));
+		return false;
+	}
+
 	if (strcmp(pool_config->recovery_1st_stage_command, "") ||
 		strcmp(pool_config->recovery_2nd_stage_command, ""))
 	{
@@ -298,6 +298,8 @@ void pool_coninfo_unset_frontend_connected(int proc_id, int pool_index)
 			return;
 		}
 		con->connected = false;
+		con->frontend_pid = 0;
+		con->frontend_key = 0;
 	}
 }
 
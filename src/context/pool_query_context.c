@@ -56,6 +56,13 @@ typedef enum {
 static POOL_DEST send_to_where(Node *node, char *query);
 static void where_to_send_deallocate(POOL_QUERY_CONTEXT *query_context, Node *node);
 static char* remove_read_write(int len, const char *contents, int *rewritten_len);
+static bool standby_is_behind(int node_id);
+static int select_standby_by_delay(int node_id);
+static void fetch_write_lsn(POOL_CONNECTION_POOL *backend);
+static int select_node_by_table_affinity(Node *node, int node_id);
+static void build_affinity_ring(void);
+static uint32 affinity_hash(uint32 a, uint32 b);
+static bool session_state_to_all_nodes(void);
 
 /*
  * Create and initialize per query session context
@@ -195,6 +202,19 @@ void pool_clear_node_to_be_sent(POOL_QUERY_CONTEXT *query_context)
 	return;
 }
 
+/*
+ * Return true if statements which change the session state (SET etc.)
+ * have to be sent to all standbys, not only to the load balance node,
+ * because the following reads may be routed to a standby other than the
+ * load balance node.
+ */
+static bool session_state_to_all_nodes(void)
+{
+	return pool_config->statement_level_load_balance ||
+		pool_config->cache_affinity_routing ||
+		pool_config->lag_aware_routing || pool_config->read_your_writes;
+}
+
 /*
  * Set all DB node map entry
  */
@@ -217,7 +237,7 @@ void pool_setall_node_to_be_sent(POOL_QUERY_CONTEXT *query_context)
 			 * primary node nor load balance node, there's no point to
 			 * send query.
 			 */
-			if (SL_MODE &&
+			if (SL_MODE && !session_state_to_all_nodes() &&
 				i != PRIMARY_NODE_ID && i != sc->load_balance_node_id)
 			{
 				continue;
@@ -446,6 +466,22 @@ void pool_where_to_send(POOL_QUERY_CONTEXT *query_context, char *query, Node *no
 	{
 		POOL_DEST dest;
 
+		/*
+		 * With statement_level_load_balance, choose the load balance
+		 * node again for each statement issued outside of a transaction,
+		 * so that a long lived connection spreads its reads over the
+		 * standbys.  Inside a transaction the node stays the same.  The
+		 * backend connections to all nodes are already open.  Don't do
+		 * it in the middle of a pipelined extended query sequence.
+		 */
+		if (pool_config->load_balance_mode &&
+			pool_config->statement_level_load_balance &&
+			TSTATE(backend, PRIMARY_NODE_ID) == 'I' &&
+			session_context->pending_messages == NIL)
+		{
+			pool_set_load_balance_node(select_load_balancing_node());
+		}
+
 		dest = send_to_where(node, query);
 
 		ereport(DEBUG1,
@@ -492,18 +528,53 @@ void pool_where_to_send(POOL_QUERY_CONTEXT *query_context, char *query, Node *no
 					 !pool_is_failed_transaction() &&
 					 pool_get_transaction_isolation() != POOL_SERIALIZABLE))
 				{
-					BackendInfo *bkinfo = pool_get_node_info(session_context->load_balance_node_id);
+					int lb_node_id = session_context->load_balance_node_id;
 
 					/*
 					 * Load balance if possible
 					 */
 
+					/*
+					 * With cache_affinity_routing, send SELECTs on the same
+					 * table to the same node so that each node keeps a
+					 * different part of the data in its buffer cache.
+					 * Only outside of an explicit transaction, so that the
+					 * transaction's reads share one snapshot.
+					 */
+					if (pool_config->cache_affinity_routing &&
+						TSTATE(backend, PRIMARY_NODE_ID) == 'I')
+						lb_node_id = select_node_by_table_affinity(node, lb_node_id);
+
+					/*
+					 * If the session has written something, learn the
+					 * primary's WAL location the standby needs to have
+					 * replayed.  Only when the write has committed and no
+					 * extended query messages are waiting for Sync: the
+					 * write may still be uncommitted otherwise.  Until the
+					 * location is fetched, standby_is_behind() sends the
+					 * reads to the primary.
+					 */
+					if (STREAM && pool_config->read_your_writes &&
+						session_context->write_lsn_pending &&
+						TSTATE(backend, PRIMARY_NODE_ID) == 'I' &&
+						session_context->pending_messages == NIL)
+						fetch_write_lsn(backend);
+
+					/*
+					 * If the load balance node lags too much, look for
+					 * another standby which is close enough to the primary.
+					 * Inside a transaction stay on the node which has the
+					 * transaction's snapshot and fall back to the primary.
+					 */
+					if ((pool_config->lag_aware_routing || pool_config->read_your_writes) &&
+						TSTATE(backend, PRIMARY_NODE_ID) == 'I' &&
+						standby_is_behind(lb_node_id))
+						lb_node_id = select_standby_by_delay(lb_node_id);
+
 					/*
 					 * If replication delay is too much, we prefer to send to the primary.
 					 */
-					if (STREAM &&
-						pool_config->delay_threshold &&
-						bkinfo->standby_delay > pool_config->delay_threshold)
+					if (standby_is_behind(lb_node_id))
 					{
 						ereport(DEBUG1,
 								(errmsg("could not load balance because of too much replication delay"),
@@ -574,8 +645,7 @@ void pool_where_to_send(POOL_QUERY_CONTEXT *query_context, char *query, Node *no
 
 					else
 					{
-						pool_set_node_to_be_sent(query_context,
-												 session_context->load_balance_node_id);
+						pool_set_node_to_be_sent(query_context, lb_node_id);
 					}
 				}
 				else
@@ -782,6 +852,10 @@ POOL_STATUS pool_send_and_wait(POOL_QUERY_CONTEXT *query_context,
 
 		per_node_statement_log(backend, i, string);
 		stat_count_up(i, query_context->parse_tree);
+		pool_set_query_in_flight(i);
+		if (query_context->parse_tree && IsA(query_context->parse_tree, SelectStmt) &&
+			!pool_multi_node_to_be_sent(query_context))
+			pool_start_latency_sample(i);
 		send_simplequery_message(CONNECTION(backend, i), len, string, MAJOR(backend));
 	}
 
@@ -964,6 +1038,7 @@ POOL_STATUS pool_extended_send_and_wait(POOL_QUERY_CONTEXT *query_context,
 		if (*kind == 'E')
 		{
 			stat_count_up(i, query_context->parse_tree);
+			pool_set_query_in_flight(i);
 		}
 
 		send_extended_protocol_message(backend, i, kind, str_len, str);
@@ -1046,6 +1121,281 @@ POOL_STATUS pool_extended_send_and_wait(POOL_QUERY_CONTEXT *query_context,
 	return POOL_CONTINUE;
 }
 
+/*
+ * Return true if node_id is a standby which should not get load
+ * balanced reads because:
+ *
+ * - it lags behind the primary more than delay_threshold.  With
+ *   lag_aware_routing, a standby whose delay has not been measured for
+ *   three check intervals is regarded as lagging as well.
+ *
+ * - with read_your_writes, it has not replayed the session's last write
+ *   yet, or the primary's WAL location after the write is not known yet.
+ */
+static bool standby_is_behind(int node_id)
+{
+	BackendInfo *bkinfo;
+	POOL_SESSION_CONTEXT *session_context;
+	struct timeval now;
+	uint64 now_msec;
+	uint64 max_age;
+
+	if (!STREAM || node_id == PRIMARY_NODE_ID)
+		return false;
+
+	bkinfo = pool_get_node_info(node_id);
+
+	if (pool_config->read_your_writes)
+	{
+		session_context = pool_get_session_context(false);
+		if (session_context->write_lsn_pending ||
+			session_context->write_lsn > bkinfo->standby_lsn)
+			return true;
+	}
+
+	if (!pool_config->delay_threshold)
+		return false;
+
+	if (bkinfo->standby_delay > pool_config->delay_threshold)
+		return true;
+
+	if (!pool_config->lag_aware_routing)
+		return false;
+
+	if (pool_config->sr_check_lag_interval > 0)
+		max_age = (uint64) pool_config->sr_check_lag_interval * 3;
+	else if (pool_config->sr_check_period > 0)
+		max_age = (uint64) pool_config->sr_check_period * 1000 * 3;
+	else
+		return false;
+
+	gettimeofday(&now, NULL);
+	now_msec = (uint64) now.tv_sec * 1000 + now.tv_usec / 1000;
+
+	return bkinfo->standby_delay_time == 0 ||
+		now_msec - bkinfo->standby_delay_time > max_age;
+}
+
+/*
+ * Fetch the primary's current WAL location for read_your_writes.  This
+ * is called after the session's write has committed, so any standby
+ * which has replayed up to the location sees the write.
+ */
+static void fetch_write_lsn(POOL_CONNECTION_POOL *backend)
+{
+	POOL_SESSION_CONTEXT *session_context = pool_get_session_context(false);
+	POOL_SELECT_RESULT *res;
+	char *version;
+	char *query;
+	int pos;
+
+	version = pool_find_name(&CONNECTION(backend, PRIMARY_NODE_ID)->params, "server_version", &pos);
+	if (version && atoi(version) >= 10)
+		query = "SELECT pg_current_wal_lsn()";
+	else
+		query = "SELECT pg_current_xlog_location()";
+
+	per_node_statement_log(backend, PRIMARY_NODE_ID, query);
+	do_query(CONNECTION(backend, PRIMARY_NODE_ID), query, &res, MAJOR(backend));
+
+	if (res->numrows > 0 && res->data[0])
+		session_context->write_lsn = text_to_lsn(res->data[0]);
+	free_select_result(res);
+
+	session_context->write_lsn_pending = false;
+
+	ereport(DEBUG1,
+			(errmsg("read_your_writes: primary WAL location after write: %llu",
+					(unsigned long long int) session_context->write_lsn)));
+}
+
+/*
+ * Consistent hash ring for cache_affinity_routing.  Each node with
+ * weight > 0 gets a number of points on the ring proportional to its
+ * weight.  A table is mapped to the first point at or after the hash of
+ * its oid.  The ring includes down nodes: their tables move to the next
+ * node on the ring, while the tables of other nodes stay put.  The
+ * primary is left out, so that the reads are spread over the standbys
+ * only.
+ */
+#define AFFINITY_POINTS_PER_NODE	64
+
+typedef struct {
+	uint32 hash;
+	int node_id;
+} AffinityPoint;
+
+static AffinityPoint *affinity_ring;
+static int affinity_ring_size;
+static double affinity_ring_weight[MAX_NUM_BACKENDS];	/* weights the ring was built for */
+static int affinity_ring_backends;
+static int affinity_ring_primary;	/* primary node id the ring was built for */
+
+static uint32 affinity_hash(uint32 a, uint32 b)
+{
+	uint32 h = 2166136261U;
+	uint32 v[2];
+	unsigned char *p = (unsigned char *)v;
+	int i;
+
+	v[0] = a;
+	v[1] = b;
+	for (i=0;i<sizeof(v);i++)
+	{
+		h ^= p[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static int affinity_point_cmp(const void *a, const void *b)
+{
+	uint32 h1 = ((AffinityPoint *)a)->hash;
+	uint32 h2 = ((AffinityPoint *)b)->hash;
+
+	return (h1 > h2) - (h1 < h2);
+}
+
+/*
+ * (Re)build the ring if backends or weights changed since last time.
+ */
+static void build_affinity_ring(void)
+{
+	MemoryContext oldcxt;
+	int i, j, n;
+	bool changed = (affinity_ring == NULL || affinity_ring_backends != NUM_BACKENDS ||
+					affinity_ring_primary != PRIMARY_NODE_ID);
+
+	for (i=0;i<NUM_BACKENDS && !changed;i++)
+	{
+		if (affinity_ring_weight[i] != BACKEND_INFO(i).backend_weight)
+			changed = true;
+	}
+
+	if (!changed)
+		return;
+
+	if (affinity_ring)
+		pfree(affinity_ring);
+
+	n = 0;
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		affinity_ring_weight[i] = BACKEND_INFO(i).backend_weight;
+		if (affinity_ring_weight[i] > 0.0 && i != PRIMARY_NODE_ID)
+			n += Max(1, (int)(affinity_ring_weight[i] * NUM_BACKENDS * AFFINITY_POINTS_PER_NODE));
+	}
+	affinity_ring_backends = NUM_BACKENDS;
+	affinity_ring_primary = PRIMARY_NODE_ID;
+
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+	affinity_ring = palloc(sizeof(AffinityPoint) * Max(n, 1));
+	MemoryContextSwitchTo(oldcxt);
+
+	affinity_ring_size = 0;
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (affinity_ring_weight[i] <= 0.0 || i == PRIMARY_NODE_ID)
+			continue;
+
+		n = Max(1, (int)(affinity_ring_weight[i] * NUM_BACKENDS * AFFINITY_POINTS_PER_NODE));
+		for (j=0;j<n;j++)
+		{
+			affinity_ring[affinity_ring_size].hash = affinity_hash(i, j);
+			affinity_ring[affinity_ring_size].node_id = i;
+			affinity_ring_size++;
+		}
+	}
+
+	qsort(affinity_ring, affinity_ring_size, sizeof(AffinityPoint), affinity_point_cmp);
+}
+
+/*
+ * Return the node the first table of the SELECT is mapped to by the
+ * consistent hash ring, skipping nodes which are down or lagging.  If
+ * the SELECT has no table or no node is usable, node_id is returned.
+ * The node map of the query is being decided here, so node status is
+ * checked by VALID_BACKEND_RAW rather than VALID_BACKEND.
+ */
+static int select_node_by_table_affinity(Node *node, int node_id)
+{
+	SelectContext ctx;
+	uint32 h;
+	int lo, hi, mid;
+	int i;
+
+	if (pool_extract_table_oids_from_select_stmt(node, &ctx) <= 0)
+		return node_id;
+
+	build_affinity_ring();
+	if (affinity_ring_size == 0)
+		return node_id;
+
+	/* Find the first point at or after the hash of the table oid */
+	h = affinity_hash(ctx.table_oids[0], 0);
+	lo = 0;
+	hi = affinity_ring_size;
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (affinity_ring[mid].hash < h)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* Walk the ring until a usable node is found */
+	for (i=0;i<affinity_ring_size;i++)
+	{
+		int id = affinity_ring[(lo + i) % affinity_ring_size].node_id;
+
+		if (VALID_BACKEND_RAW(id) && !standby_is_behind(id))
+		{
+			ereport(DEBUG1,
+					(errmsg("cache affinity: table \"%s\" is mapped to node %d",
+							ctx.table_names[0], id)));
+			return id;
+		}
+	}
+
+	return node_id;
+}
+
+/*
+ * Return the standby with the least replication delay among those not
+ * behind as defined by standby_is_behind().  Ties are broken by the
+ * higher weight.  If there's no such standby, node_id is returned.
+ * As in select_node_by_table_affinity(), node status is checked by
+ * VALID_BACKEND_RAW.
+ */
+static int select_standby_by_delay(int node_id)
+{
+	int i;
+	int selected = -1;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (i == PRIMARY_NODE_ID || !VALID_BACKEND_RAW(i) ||
+			BACKEND_INFO(i).backend_weight <= 0.0 ||
+			standby_is_behind(i))
+			continue;
+
+		if (selected < 0 ||
+			BACKEND_INFO(i).standby_delay < BACKEND_INFO(selected).standby_delay ||
+			(BACKEND_INFO(i).standby_delay == BACKEND_INFO(selected).standby_delay &&
+			 BACKEND_INFO(i).backend_weight > BACKEND_INFO(selected).backend_weight))
+			selected = i;
+	}
+
+	if (selected < 0)
+		return node_id;
+
+	ereport(DEBUG1,
+			(errmsg("load balance node %d lags too much, using node %d", node_id, selected)));
+
+	return selected;
+}
+
 /*
  * From syntactically analysis decide the statement to be sent to the
  * primary, the standby or either or both in master/slave+HR/SR mode.
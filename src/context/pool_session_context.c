@@ -28,6 +28,7 @@
 #include "utils/palloc.h"
 #include "utils/memutils.h"
 #include "utils/elog.h"
+#include "utils/pool_stream.h"
 #include "pool_config.h"
 #include "context/pool_session_context.h"
 #include "protocol/pool_proto_modules.h"
@@ -53,7 +54,6 @@ void pool_init_session_context(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *
 	session_context = &session_context_d;
 	ProcessInfo *process_info;
 	int node_id;
-	int i;
 
 	/* Clear session context memory */
 	memset(&session_context_d, 0, sizeof(session_context_d));
@@ -101,13 +101,8 @@ void pool_init_session_context(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *
 		node_id = SL_MODE? PRIMARY_NODE_ID: MASTER_NODE_ID;
 	}
 
-	session_context->load_balance_node_id = node_id;
-
-	for (i=0;i<NUM_BACKENDS;i++)
-	{
-		pool_coninfo(session_context->process_context->proc_id,
-					 pool_pool_index(), i)->load_balancing_node = node_id;
-	}
+	session_context->load_counted_node_id = -1;
+	pool_set_load_balance_node(node_id);
 
 	ereport(DEBUG1,
 			(errmsg("initializing session context"),
@@ -175,10 +170,16 @@ void pool_session_context_destroy(void)
 		{
 			pool_discard_query_cache_array(session_context->query_cache_array);
 			session_context->num_selects = 0;
+			/* Do not let other children wait for our query any more */
+			pool_release_inflight_query();
 		}
 
 		if (session_context->query_context)
 			pool_query_context_destroy(session_context->query_context);
+
+		pool_unset_queries_in_flight();
+		pool_set_load_counted_node(-1);
+
 		MemoryContextDelete(session_context->memory_context);
 	}
 	/* XXX For now, just zap memory */
@@ -200,6 +201,230 @@ POOL_SESSION_CONTEXT *pool_get_session_context(bool noerror)
 	return session_context;
 }
 
+/*
+ * Save the current session context to "save" and detach it from this
+ * process, so that other session can run.  Used by a child process
+ * multiplexing client sessions.
+ */
+void pool_session_context_save(POOL_SESSION_CONTEXT *save)
+{
+	memcpy(save, &session_context_d, sizeof(session_context_d));
+	memset(&session_context_d, 0, sizeof(session_context_d));
+	session_context = NULL;
+}
+
+/*
+ * Make the session context previously saved by
+ * pool_session_context_save() current again.
+ */
+void pool_session_context_restore(POOL_SESSION_CONTEXT *save)
+{
+	memcpy(&session_context_d, save, sizeof(session_context_d));
+	session_context = &session_context_d;
+}
+
+/*
+ * Return true if the session is waiting for the next request from
+ * frontend and its context can be saved away.
+ */
+bool pool_can_park_session(void)
+{
+	if (!session_context)
+		return false;
+
+	return !session_context->in_progress &&
+		!session_context->ignore_till_sync &&
+		!session_context->skip_reading_from_backends &&
+		list_length(session_context->pending_messages) == 0;
+}
+
+/*
+ * Return true if the backend connection of the session can be given
+ * to other sessions in transaction pooling mode, i.e. the session is
+ * parkable, no transaction is open and nothing ties the session to the
+ * backend connection.
+ */
+bool pool_can_release_backend(void)
+{
+	POOL_CONNECTION_POOL *backend;
+	int i;
+
+	if (!pool_can_park_session())
+		return false;
+
+	if (session_context->backend_pinned ||
+		session_context->doing_extended_query_message ||
+		session_context->uncompleted_message)
+		return false;
+
+	backend = session_context->backend;
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		if (TSTATE(backend, i) != 'I' ||
+			!pool_read_buffer_is_empty(CONNECTION(backend, i)))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Switch the backend connection of the session.  Used in transaction
+ * pooling mode.
+ */
+void pool_session_context_set_backend(POOL_CONNECTION_POOL *backend)
+{
+	pool_get_session_context(false)->backend = backend;
+}
+
+/*
+ * Remember that the session cannot give its backend connection to
+ * others any more.
+ */
+void pool_set_backend_pinned(void)
+{
+	ereport(DEBUG1,
+		(errmsg("session context: pinning backend connection. DONE")));
+
+	pool_get_session_context(false)->backend_pinned = true;
+}
+
+/*
+ * Make node_id the load balance node of the session.
+ */
+void pool_set_load_balance_node(int node_id)
+{
+	POOL_SESSION_CONTEXT *s = pool_get_session_context(false);
+	int i;
+
+	s->load_balance_node_id = node_id;
+	pool_set_load_counted_node(node_id);
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		pool_coninfo(s->process_context->proc_id,
+					 pool_pool_index(), i)->load_balancing_node = node_id;
+	}
+}
+
+/*
+ * Remember that the session has written something, so that the
+ * primary's WAL location is fetched before the next load balanced read.
+ */
+void pool_set_write_lsn_pending(void)
+{
+	ereport(DEBUG1,
+		(errmsg("session context: setting write lsn pending. DONE")));
+
+	pool_get_session_context(false)->write_lsn_pending = true;
+}
+
+/*
+ * Count this session against node_id in the shared load counters,
+ * moving it off the node it was counted against before.  Pass -1 to
+ * stop counting the session.  This is a no-op unless
+ * load_balance_algorithm is least_outstanding.
+ */
+void pool_set_load_counted_node(int node_id)
+{
+	POOL_SESSION_CONTEXT *s = pool_get_session_context(false);
+
+	if (pool_config->load_balance_algorithm != LB_LEAST_OUTSTANDING)
+		return;
+
+	if (s->load_counted_node_id == node_id)
+		return;
+
+	if (s->load_counted_node_id >= 0)
+		stat_session_end(s->load_counted_node_id);
+	if (node_id >= 0)
+		stat_session_start(node_id);
+
+	s->load_counted_node_id = node_id;
+}
+
+/*
+ * Remember that a query has been sent to node_id and is outstanding
+ * until ReadyForQuery.
+ */
+void pool_set_query_in_flight(int node_id)
+{
+	POOL_SESSION_CONTEXT *s = pool_get_session_context(false);
+
+	if (pool_config->load_balance_algorithm != LB_LEAST_OUTSTANDING)
+		return;
+
+	if (!s->query_in_flight[node_id])
+	{
+		s->query_in_flight[node_id] = true;
+		stat_query_start(node_id);
+	}
+}
+
+/*
+ * Forget all outstanding queries of this session.  Called at
+ * ReadyForQuery and when the session ends.
+ */
+void pool_unset_queries_in_flight(void)
+{
+	POOL_SESSION_CONTEXT *s = pool_get_session_context(false);
+	int i;
+
+	if (pool_config->load_balance_algorithm != LB_LEAST_OUTSTANDING)
+		return;
+
+	for (i=0;i<MAX_NUM_BACKENDS;i++)
+	{
+		if (s->query_in_flight[i])
+		{
+			s->query_in_flight[i] = false;
+			stat_query_end(i);
+		}
+	}
+}
+
+/*
+ * Remember the time a load balanced SELECT is sent to node_id, to
+ * measure the node's response time.
+ */
+void pool_start_latency_sample(int node_id)
+{
+	POOL_SESSION_CONTEXT *s = pool_get_session_context(false);
+
+	if (pool_config->load_balance_algorithm != LB_LATENCY)
+		return;
+
+	gettimeofday(&s->latency_start[node_id], NULL);
+}
+
+/*
+ * Called when a response arrives from node_id.  If we are measuring a
+ * query sent to the node, feed the elapsed time into the node's
+ * response time average.
+ */
+void pool_end_latency_sample(int node_id)
+{
+	POOL_SESSION_CONTEXT *s = pool_get_session_context(true);
+	struct timeval now;
+	double usec;
+
+	if (!s || pool_config->load_balance_algorithm != LB_LATENCY)
+		return;
+
+	if (s->latency_start[node_id].tv_sec == 0)
+		return;
+
+	gettimeofday(&now, NULL);
+	usec = (now.tv_sec - s->latency_start[node_id].tv_sec) * 1000000.0 +
+		(now.tv_usec - s->latency_start[node_id].tv_usec);
+	s->latency_start[node_id].tv_sec = 0;
+
+	if (usec >= 0.0)
+		stat_update_latency(node_id, usec);
+}
+
 /*
  * Return local session id
  */
@@ -199,6 +199,25 @@ typedef struct {
 
 	int load_balance_node_id;	/* selected load balance node id */
 
+	/*
+	 * Node this session is counted against in the shared load counters
+	 * used by load_balance_algorithm = least_outstanding.  -1 if none.
+	 */
+	int load_counted_node_id;
+
+	/*
+	 * True for nodes we have sent a query to which has not reached
+	 * ReadyForQuery yet.  Only maintained for least_outstanding.
+	 */
+	bool query_in_flight[MAX_NUM_BACKENDS];
+
+	/*
+	 * Time a load balanced SELECT was sent to each node, zero if we are
+	 * not waiting for its first response.  Only maintained for
+	 * load_balance_algorithm = latency.
+	 */
+	struct timeval latency_start[MAX_NUM_BACKENDS];
+
 	/*
 	 * If true, UPDATE/DELETE caused difference in number of affected
 	 * tuples in backends.
@@ -233,6 +252,23 @@ typedef struct {
 	 */
 	POOL_PENDING_MESSAGE *previous_message;
 
+	/*
+	 * If true, the session has left state in the backend which survives
+	 * the transaction, e.g. session level SET or temporary tables.  In
+	 * transaction pooling mode, the backend connection is kept until the
+	 * session ends.
+	 */
+	bool backend_pinned;
+
+	/*
+	 * For read_your_writes.  write_lsn_pending is set when the session
+	 * has written something, and write_lsn is the primary's WAL location
+	 * fetched after the write has committed.  Load balanced SELECTs only
+	 * go to standbys which have replayed write_lsn.
+	 */
+	bool write_lsn_pending;
+	uint64 write_lsn;
+
 	/* Protocol major version number */
 	int major;
 	/* Protocol minor version number */
@@ -246,6 +282,19 @@ typedef struct {
 extern void pool_init_session_context(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 extern void pool_session_context_destroy(void);
 extern POOL_SESSION_CONTEXT *pool_get_session_context(bool noerror);
+extern void pool_session_context_save(POOL_SESSION_CONTEXT *save);
+extern void pool_session_context_restore(POOL_SESSION_CONTEXT *save);
+extern bool pool_can_park_session(void);
+extern bool pool_can_release_backend(void);
+extern void pool_session_context_set_backend(POOL_CONNECTION_POOL *backend);
+extern void pool_set_backend_pinned(void);
+extern void pool_set_write_lsn_pending(void);
+extern void pool_set_load_balance_node(int node_id);
+extern void pool_set_load_counted_node(int node_id);
+extern void pool_set_query_in_flight(int node_id);
+extern void pool_unset_queries_in_flight(void);
+extern void pool_start_latency_sample(int node_id);
+extern void pool_end_latency_sample(int node_id);
 extern int pool_get_local_session_id(void);
 extern bool pool_is_query_in_progress(void);
 extern void pool_set_query_in_progress(void);
@@ -84,6 +84,10 @@ typedef struct {
 	unsigned short flag;		/* various flags */
 	bool quarantine;			/* true if node is CON_DOWN because of quarantine */
 	uint64 standby_delay;		/* The replication delay against the primary */
+	uint64 standby_delay_time;	/* when standby_delay was measured, in
+								 * milliseconds since the epoch. 0 if never */
+	uint64 standby_lsn;			/* WAL location replayed (standby) or
+								 * written (primary) at standby_delay_time */
 	SERVER_ROLE role;	/* Role of server. Only used by pcp_node_info */
 } BackendInfo;
 
@@ -127,6 +131,8 @@ typedef struct {
 							 * This flag is used to handle
 							 * pg_terminate_backend()
 							 */
+	int			frontend_pid;	/* pid and cancel key sent to the frontend */
+	int			frontend_key;	/* in transaction pooling mode */
 } ConnectionInfo;
 
 /*
@@ -143,6 +149,15 @@ typedef struct {
 								 * failback a node in streaming
 								 * replication mode.
 								 */
+	volatile char wait_for_connect;	/* non 0 if the child process has no
+									 * client and is waiting for a
+									 * connection request.
+									 */
+	volatile char exit_if_idle;	/* If non 0, exit this child process if
+								 * it has no client.  Set by pgpool main
+								 * to reduce idle children in dynamic
+								 * process management mode.
+								 */
 } ProcessInfo;
 
 /*
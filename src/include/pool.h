@@ -35,6 +35,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <limits.h>
 
 #ifdef USE_SSL
@@ -97,11 +98,11 @@
 
 typedef enum {
 	POOL_CONTINUE = 0,
-	POOL_IDLE,
 	POOL_END,
 	POOL_ERROR,
 	POOL_FATAL,
-	POOL_DEADLOCK
+	POOL_DEADLOCK,
+	POOL_IDLE
 } POOL_STATUS;
 
 typedef enum {
@@ -180,15 +181,19 @@ typedef struct {
 	int wbufsz;	/* write buffer size */
 	int wbufpo;	/* buffer offset */
 
+	struct iovec *wiov;	/* output queue: fragments in wbuf or caller's buffer */
+	int wiovcnt;	/* number of fragments in the output queue */
+	int wqlen;	/* total length of the output queue in bytes */
+
 #ifdef USE_SSL
 	SSL_CTX *ssl_ctx; /* SSL connection context */
 	SSL *ssl;	/* SSL connection */
 #endif
 	int ssl_active; /* SSL is failed if < 0, off if 0, on if > 0 */
 
-	char *hp;	/* pending data buffer head address */
+	char *hp;	/* receive (pending data) buffer head address */
 	int po;		/* pending data offset */
-	int bufsz;	/* pending data buffer size */
+	int bufsz;	/* receive buffer size */
 	int len;	/* pending data length */
 
 	char *sbuf;	/* buffer for pool_read_string */
@@ -375,13 +380,16 @@ extern int my_master_node_id;
 #define NO_LOAD_BALANCE "/*NO LOAD BALANCE*/"
 #define NO_LOAD_BALANCE_COMMENT_SZ (sizeof(NO_LOAD_BALANCE)-1)
 
-#define MAX_NUM_SEMAPHORES		6
+#define MAX_NUM_SEMAPHORES		8
 #define CONN_COUNTER_SEM		0
 #define REQUEST_INFO_SEM		1
-#define SHM_CACHE_SEM			2
+#define SHM_CACHE_SEM			2	/* shared/exclusive lock */
 #define QUERY_CACHE_STATS_SEM	3
 #define PCP_REQUEST_SEM			4
 #define ACCEPT_FD_SEM			5
+#define SHM_CACHE_WRITER_SEM	6	/* # of SHM_CACHE_SEM exclusive lockers */
+#define INFLIGHT_QUERY_SEM		7	/* in-flight query registry of shmem cache */
+#define POOL_SEM_SHARED_MAX		32767	/* initial count of a shared/exclusive lock */
 #define MAX_REQUEST_QUEUE_SIZE	10
 
 #define MAX_SEC_WAIT_FOR_CLUSTER_TRANSATION 10 /* time in seconds to keep retrying for a
@@ -486,7 +494,8 @@ typedef enum
 	PT_WATCHDOG_UTILITY,
 	PT_PCP,
 	PT_PCP_WORKER,
-	PT_HEALTH_CHECK
+	PT_HEALTH_CHECK,
+	PT_GLOBAL_POOL
 } ProcessType;
 
 extern ProcessType processType;
@@ -582,6 +591,8 @@ extern signed char pool_read_kind(POOL_CONNECTION_POOL *cp);
 extern int pool_read_int(POOL_CONNECTION_POOL *cp);
 
 extern POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
+extern bool pool_can_pass_through_rows(POOL_CONNECTION_POOL *backend);
+extern POOL_STATUS PassThroughToFrontend(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 extern POOL_STATUS SimpleForwardToBackend(char kind, POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend, int len, char *contents);
 extern POOL_STATUS ParameterStatus(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 
@@ -628,6 +639,11 @@ extern void pool_shmem_exit(int code);
 extern void pool_semaphore_create(int numSems);
 extern void pool_semaphore_lock(int semNum);
 extern void pool_semaphore_unlock(int semNum);
+extern void pool_semaphore_setval(int semNum, int val);
+extern void pool_semaphore_lock_shared(int semNum, int writerSemNum);
+extern void pool_semaphore_unlock_shared(int semNum);
+extern void pool_semaphore_lock_exclusive(int semNum, int writerSemNum);
+extern void pool_semaphore_unlock_exclusive(int semNum, int writerSemNum);
 
 extern BackendInfo *pool_get_node_info(int node_number);
 extern int pool_get_node_count(void);
@@ -701,15 +717,20 @@ extern void pool_sleep(unsigned int second);
 
 /* pool_worker_child.c */
 extern void do_worker_child(void);
+extern unsigned long long int text_to_lsn(char *text);
 
 /* md5.c */
 extern bool pg_md5_encrypt(const char *passwd, const char *salt, size_t salt_len, char *buf);
 
 /* pool_connection_pool.c */
 extern int pool_init_cp(void);
-extern POOL_CONNECTION_POOL *pool_create_cp(void);
+extern POOL_CONNECTION_POOL *pool_create_cp(StartupPacket *sp);
 extern POOL_CONNECTION_POOL *pool_get_cp(char *user, char *database, int protoMajor, int check_socket);
 extern void pool_discard_cp(char *user, char *database, int protoMajor);
+extern POOL_CONNECTION_POOL *pool_create_cp_from_global_pool(StartupPacket *sp);
+extern void pool_release_cp(POOL_CONNECTION_POOL *p);
+extern POOL_CONNECTION_POOL *pool_get_idle_cp(StartupPacket *sp);
+extern bool pool_cp_exists(StartupPacket *sp);
 extern void pool_backend_timer(void);
 extern void pool_connection_pool_timer(POOL_CONNECTION_POOL *backend);
 extern RETSIGTYPE pool_backend_timer_handler(int sig);
@@ -718,6 +739,14 @@ extern int connect_unix_domain_socket(int slot, bool retry);
 extern int connect_inet_domain_socket_by_port(char *host, int port, bool retry);
 extern int connect_unix_domain_socket_by_port(int port, char *socket_dir, bool retry);
 extern int pool_pool_index(void);
+extern void pool_set_pool_index(int index);
+extern void pool_discard_current_cp(void);
+
+/* pool_global_pool.c */
+extern void pool_global_pool_socket_path(char *path, int len);
+extern bool pool_global_pool_get(POOL_CONNECTION_POOL *p, StartupPacket *sp);
+extern bool pool_global_pool_put(POOL_CONNECTION_POOL *p);
+extern void do_global_pool_manager(int *listen_fd);
 
 /* utils/statistics.c */
 size_t stat_shared_memory_size(void);
@@ -725,6 +754,14 @@ void stat_set_stat_area(void *address);
 void stat_init_stat_area(void);
 void stat_count_up(int backend_node_id, Node *parsetree);
 uint64 stat_get_select_count(int backend_node_id);
+void stat_clear_child_load(int child_id);
+void stat_session_start(int backend_node_id);
+void stat_session_end(int backend_node_id);
+void stat_query_start(int backend_node_id);
+void stat_query_end(int backend_node_id);
+int stat_get_node_load(int backend_node_id);
+void stat_update_latency(int backend_node_id, double usec);
+double stat_get_latency(int backend_node_id);
 
 extern int PgpoolMain(bool discard_status, bool clear_memcache_oidmaps);
 
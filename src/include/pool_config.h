@@ -74,6 +74,25 @@ typedef enum MemCacheMethod
 	MEMCACHED_CACHE
 }MemCacheMethod;
 
+typedef enum ProcessManagementModes
+{
+	PM_STATIC = 1,
+	PM_DYNAMIC
+}ProcessManagementModes;
+
+typedef enum PoolingModes
+{
+	POOLING_SESSION = 1,
+	POOLING_TRANSACTION
+}PoolingModes;
+
+typedef enum LoadBalanceAlgorithms
+{
+	LB_RANDOM = 1,
+	LB_LEAST_OUTSTANDING,
+	LB_LATENCY
+}LoadBalanceAlgorithms;
+
 typedef enum WdLifeCheckMethod
 {
 	LIFECHECK_BY_QUERY = 1,
@@ -148,6 +167,11 @@ typedef struct {
 									 *disconnected after n seconds idle */
 	int authentication_timeout;		/* maximum time in seconds to complete client authentication */
     int	max_pool;					/* max # of connection pool per child */
+	int max_sessions_per_child;		/* max # of client sessions multiplexed per child */
+	PoolingModes pooling_mode;		/* backend connection is bound to session or transaction */
+	ProcessManagementModes process_management_mode;	/* static or dynamic number of children */
+	int min_spare_children;			/* min # of idle children in dynamic mode */
+	int max_spare_children;			/* max # of idle children in dynamic mode */
     char *logdir;					/* logging directory */
     char *log_destination_str;		/* log destination: stderr and/or syslog */
     int log_destination;			/* log destination */
@@ -160,6 +184,9 @@ typedef struct {
 	bool enable_pool_hba;			/* enables pool_hba.conf file authentication */
 	char *pool_passwd;				/* pool_passwd file name. "" disables pool_passwd */
 	bool load_balance_mode;			/* load balance mode */
+	LoadBalanceAlgorithms load_balance_algorithm;	/* how to choose load balance node */
+	bool statement_level_load_balance;	/* choose load balance node per statement */
+	bool cache_affinity_routing;	/* send SELECTs on a table to the node it hashes to */
 
 	bool replication_stop_on_mismatch;	/* if there's a data mismatch between master and secondary
 										 * start degeneration to stop replication mode
@@ -186,7 +213,16 @@ typedef struct {
 									 * to enable the functionality.
 									 */
 	LogStandbyDelayModes log_standby_delay;	/* how to log standby lag */
+	bool lag_aware_routing;			/* if the load balance node lags more than
+									 * delay_threshold, send SELECTs to a
+									 * standby within the threshold before
+									 * falling back to the primary */
+	bool read_your_writes;			/* after a session writes, send its SELECTs
+									 * only to standbys which have replayed
+									 * the write */
 	bool connection_cache;					/* cache connection pool? */
+	bool global_connection_pool;			/* share idle connections among children? */
+	int global_pool_size;					/* max # of connections in the global pool */
 	int health_check_timeout;				/* health check timeout */
 	int health_check_period;				/* health check period */
 	char *health_check_user;				/* PostgreSQL user name for health check */
@@ -197,6 +233,7 @@ typedef struct {
 	int connect_timeout;					/* timeout value before giving up connecting to backend */
 	HealthCheckParams *health_check_params;	/* per node health check parameters */
 	int sr_check_period;					/* streaming replication check period */
+	int sr_check_lag_interval;				/* if > 0, replication delay check interval in msec */
 	char *sr_check_user;					/* PostgreSQL user name for streaming replication check */
 	char *sr_check_password;				/* password for sr_check_user */
 	char *sr_check_database;				/* PostgreSQL database name for streaming replication check */
@@ -268,9 +305,16 @@ typedef struct {
 	bool memqcache_auto_cache_invalidation; /* If true, invalidation of query cache is triggered by corresponding */
 											/* DDL/DML/DCL(and memqcache_expire).  If false, it is only triggered */
 											/* by memqcache_expire.  True by default. */
+	bool memqcache_key_verification;		/* If true, compare the whole cache key on cache hit. */
+	int memqcache_stale_grace;				/* Seconds to keep on returning expired cache entry while */
+											/* it is refreshed. 0 disables. */
+	int memqcache_coalesce_timeout;			/* Max milliseconds to wait for other child executing the same */
+											/* query to register the result to the cache. 0 disables. */
 	int memqcache_maxcache;					/* Maximum SELECT result size in bytes. */
+	int memqcache_compress_threshold;		/* Compress cache entries of at least this size in bytes. 0 disables. */
 	int memqcache_cache_block_size;			/* Cache block size in bytes. 8192 by default */
 	char *memqcache_oiddir;					/* Temporary work directory to record table oids */
+	char *memqcache_snapshot_file;			/* File to save shmem query cache at shutdown */
 	char **white_memqcache_table_list;		/* list of tables to memqcache */
 	char **black_memqcache_table_list;		/* list of tables not to memqcache */
 
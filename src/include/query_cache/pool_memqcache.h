@@ -62,6 +62,7 @@ typedef struct {
 	unsigned char flags;		/* flags. see above */
 	unsigned int num_items;		/* number of items */
 	unsigned int free_bytes;		/* total free space in bytes */	
+	unsigned int deleted_bytes;		/* space of deleted items reclaimable by compaction */
 } POOL_CACHE_BLOCK_HEADER;
 
 typedef struct {
@@ -72,11 +73,15 @@ typedef struct {
 #define POOL_ITEM_HAS_NEXT	0x0002		/* is this item has "next" item? */
 #define POOL_ITEM_DELETED	0x0004		/* is this item deleted? */
 
+#define POOL_ITEM_MAX_USAGE	3		/* upper limit of usage count */
+
 typedef struct {
 	POOL_QUERY_HASH query_hash;	/* md5 hashed query signature */
 	POOL_CACHEID next;			/* next cache item if any */
 	unsigned int offset;		/* item offset in this block */
 	unsigned char flags;		/* flags. see above */
+	unsigned char usage;		/* usage count. incremented on cache hit and
+								 * decremented by the eviction clock sweep */
 } POOL_CACHE_ITEM_POINTER;
 
 /*
@@ -98,6 +103,8 @@ typedef struct {
 typedef struct {
 	unsigned int total_length;	/* total length in bytes including myself */
 	time_t timestamp;	/* cache creation time */
+	unsigned int key_length;	/* length of cache key following the data, 0 if not stored */
+	unsigned int raw_length;	/* length of the data before compression, 0 if not compressed */
 } POOL_CACHE_ITEM_HEADER;
 
 typedef struct {
@@ -170,6 +177,7 @@ typedef struct
 	time_t		start_time;		/* start time when the statistics begins */
 	long long int num_selects;	/* number of successful SELECTs */
 	long long int num_cache_hits;		/* number of SELECTs extracted from cache */
+	long long int num_evictions;	/* number of cache entries evicted to make room */
 } POOL_QUERY_CACHE_STATS;
 
 /*
@@ -216,14 +224,74 @@ typedef struct
 	POOL_HEADER_ELEMENT elements[1];	/* actual hash elements follows */
 } POOL_HASH_HEADER;
 
+/*--------------------------------------------------------------------------------
+ * On shared memory table oid map implementation
+ *--------------------------------------------------------------------------------
+ */
+
+/* Number of oid map elements per cache entry */
+#define POOL_OIDMAP_ELEMENTS_PER_CACHE	2
+
+/* Oid map element. Represents a cache entry using a table */
+typedef struct
+{
+	int next;				/* index of next element, -1 if none */
+	int dboid;				/* database oid */
+	int tableoid;			/* table oid */
+	uint32 query_key;		/* part of md5 hash key of the cache entry */
+	POOL_CACHEID cacheid;	/* logical location of the cache entry */
+} POOL_OIDMAP_ELEMENT;
+
+/* Oid map header */
+typedef struct
+{
+	int nbuckets;			/* number of buckets (power of 2) */
+	uint32 mask;			/* mask for hash function */
+	int nelements;			/* number of elements */
+	int free;				/* head of free element list, -1 if none */
+	int buckets[1];			/* head element index of each bucket follows */
+} POOL_OIDMAP_HEADER;
+
+/* Interval in milliseconds to check the cache while waiting for other child */
+#define POOL_INFLIGHT_POLL_INTERVAL 10
+
+/* Query being executed by a child to fill the cache */
+typedef struct
+{
+	pid_t pid;					/* pid of the child. 0 if not in use */
+	POOL_QUERY_HASH query_hash;	/* cache key of the query */
+} POOL_INFLIGHT_QUERY;
+
+/* Query cache snapshot file header */
+#define POOL_CACHE_SNAPSHOT_MAGIC	"PGPOOLQC"
+#define POOL_CACHE_SNAPSHOT_VERSION	2
+
+typedef struct
+{
+	char magic[8];				/* POOL_CACHE_SNAPSHOT_MAGIC */
+	int version;				/* POOL_CACHE_SNAPSHOT_VERSION */
+	uint64 identity;			/* hash of cache layout and backends */
+	int num_blocks;				/* number of cache blocks */
+	int block_size;				/* cache block size */
+	int oidmap_nbuckets;		/* number of oid map buckets */
+	int oidmap_nelements;		/* number of oid map elements */
+	time_t created;				/* time when the snapshot was made */
+} POOL_CACHE_SNAPSHOT_HEADER;
+
 extern int pool_hash_init(int nelements);
 extern POOL_CACHEID *pool_hash_search(POOL_QUERY_HASH *key);
 extern int pool_hash_delete(POOL_QUERY_HASH *key);
+extern int pool_oidmap_init(int nelements);
+extern int pool_inflight_query_init(int nslots);
 extern uint32 hash_any(unsigned char *k, int keylen);
 
 extern POOL_STATUS pool_fetch_from_memory_cache(POOL_CONNECTION *frontend,
 												POOL_CONNECTION_POOL *backend,
 												char *contents, bool *foundp);
+extern POOL_STATUS pool_coalesce_cache_miss(POOL_CONNECTION *frontend,
+											POOL_CONNECTION_POOL *backend,
+											char *contents, bool *foundp);
+extern void pool_release_inflight_query(void);
 
 extern bool pool_is_likely_select(char *query);
 extern bool pool_is_table_in_black_list(const char *table_name);
@@ -238,6 +306,8 @@ extern bool pool_is_shmem_cache(void);
 extern size_t pool_shared_memory_cache_size(void);
 extern int pool_init_memory_cache(size_t size);
 extern void pool_clear_memory_cache(void);
+extern void pool_save_memory_cache(void);
+extern void pool_load_memory_cache(void);
 extern size_t pool_shared_memory_fsmm_size(void);
 extern int pool_init_fsmm(size_t size);
 extern void pool_allocate_fsmm_clock_hand(void);
@@ -253,6 +323,7 @@ extern POOL_QUERY_CACHE_STATS *pool_get_memqcache_stats(void);
 extern void pool_reset_memqcache_stats(void);
 extern long long int pool_stats_count_up_num_selects(long long int num);
 extern long long int pool_stats_count_up_num_cache_hits(void);
+extern long long int pool_stats_count_up_num_evictions(long long int num);
 extern long long int pool_tmp_stats_count_up_num_selects(void);
 extern long long int pool_tmp_stats_get_num_selects(void);
 extern void pool_tmp_stats_reset_num_selects(void);
@@ -263,6 +334,7 @@ extern POOL_TEMP_QUERY_CACHE *pool_get_current_cache(void);
 extern void pool_discard_temp_query_cache(POOL_TEMP_QUERY_CACHE *temp_cache);
 
 extern void pool_shmem_lock(void);
+extern void pool_shmem_lock_shared(void);
 extern void pool_shmem_unlock(void);
 
 #endif /* POOL_MEMQCACHE_H */
@@ -0,0 +1,32 @@
+/* -*-pgsql-c-*- */
+/*
+ *
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2017	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_lz.h.: interface to pool_lz.c
+ *
+ */
+
+#ifndef POOL_LZ_H
+#define POOL_LZ_H
+
+extern int pool_lz_compress(const char *source, int slen, char *dest, int dcap);
+extern int pool_lz_decompress(const char *source, int slen, char *dest, int dcap);
+
+#endif /* POOL_LZ_H */
@@ -43,6 +43,7 @@ typedef struct {
 	int     pg_terminate_backend_pid; /* pid argument of pg_terminate_backedn_call(if used) */
 	bool    has_non_immutable_function_call;    /* True if non immutable functions are used */
 	bool    has_insertinto_or_locking_clause;   /* True if it has SELECT INTO or FOR SHARE/UPDATE */
+	bool    has_session_function_call;	/* True if functions leaving session state are used */
 	int     num_oids;   /* number of oids */
 	int     table_oids[POOL_MAX_SELECT_OIDS];   /* table oids */
 	char    table_names[POOL_MAX_SELECT_OIDS][POOL_NAMEDATALEN];  /* table names */
@@ -57,6 +58,7 @@ extern void discard_temp_table_relcache(void);
 extern bool pool_has_unlogged_table(Node *node);
 extern bool pool_has_view(Node *node);
 extern bool pool_has_insertinto_or_locking_clause(Node *node);
+extern bool pool_has_session_state(Node *node);
 extern bool pool_has_pgpool_regclass(void);
 extern bool pool_has_to_regclass(void);
 extern bool raw_expression_tree_walker(Node *node, bool (*walker) (), void *context);
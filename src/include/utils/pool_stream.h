@@ -29,11 +29,33 @@
 #define READBUFSZ 1024
 #define WRITEBUFSZ 8192
 
+/*
+ * Initial and maximum size of the per connection receive buffer.  The
+ * buffer starts with RECVBUFSZ and grows up to RECVBUFMAXSZ while the
+ * socket keeps delivering more data than the buffer can hold.  A single
+ * message larger than RECVBUFMAXSZ enlarges the buffer as needed.
+ */
+#define RECVBUFSZ 8192
+#define RECVBUFMAXSZ (128 * 1024)
+
+/*
+ * Maximum number of fragments in the output queue of a connection, and
+ * the size below which pool_write_ref() copies data into the write buffer
+ * rather than referencing it.
+ */
+#define WRITEV_MAX_FRAGMENTS 64
+#define WRITEV_COPY_THRESHOLD 512
+
 /*
  * Return true if read buffer is empty. Argument is POOL_CONNECTION.
  */
 #define pool_read_buffer_is_empty(connection) ((connection)->len <= 0)
 
+/*
+ * Return number of bytes in read buffer. Argument is POOL_CONNECTION.
+ */
+#define pool_read_buffer_length(connection) ((connection)->len)
+
 /*
  * Discard read buffer contents
  */
@@ -49,8 +71,11 @@ extern void pool_read_with_error(POOL_CONNECTION *cp, void *buf, int len,
                                  const char* err_context );
 
 extern char *pool_read2(POOL_CONNECTION *cp, int len);
+extern char *pool_read_direct(POOL_CONNECTION *cp, int len);
+extern char *pool_peek(POOL_CONNECTION *cp, int len);
 extern int pool_write(POOL_CONNECTION *cp, void *buf, int len);
 extern int pool_write_noerror(POOL_CONNECTION *cp, void *buf, int len);
+extern int pool_write_ref(POOL_CONNECTION *cp, void *buf, int len);
 extern int pool_flush(POOL_CONNECTION *cp);
 extern int pool_flush_noerror(POOL_CONNECTION *cp);
 extern int pool_flush_it(POOL_CONNECTION *cp);
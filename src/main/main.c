@@ -314,6 +314,8 @@ int main(int argc, char **argv)
 	}
 
 	pool_semaphore_create(MAX_NUM_SEMAPHORES);
+	pool_semaphore_setval(SHM_CACHE_SEM, POOL_SEM_SHARED_MAX);
+	pool_semaphore_setval(SHM_CACHE_WRITER_SEM, 0);
 
 	PgpoolMain(discard_status, clear_memcache_oidmaps); /* this is an infinate loop */
 
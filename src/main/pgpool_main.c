@@ -115,8 +115,9 @@ static void signal_user1_to_parent_with_reason(User1SignalReason reason);
 static void FileUnlink(int code, Datum path);
 static pid_t pcp_fork_a_child(int unix_fd, int inet_fd, char *pcp_conf_file);
 static pid_t fork_a_child(int *fds, int id);
+static void manage_spare_children(void);
 static pid_t worker_fork_a_child(ProcessType type, void (*func) (), void *params);
-static int create_unix_domain_socket(struct sockaddr_un un_addr_tmp);
+static int create_unix_domain_socket(struct sockaddr_un un_addr_tmp, mode_t mode);
 static int create_inet_domain_socket(const char *hostname, const int port);
 static int *create_inet_domain_sockets(const char *hostname, const int port);
 static void failover(void);
@@ -151,6 +152,7 @@ static void degenerate_all_quarantine_nodes(void);
 
 static struct sockaddr_un un_addr;		/* unix domain socket path */
 static struct sockaddr_un pcp_un_addr;  /* unix domain socket path for PCP */
+static struct sockaddr_un global_pool_un_addr;  /* unix domain socket path for global connection pool */
 ProcessInfo *process_info = NULL;		/* Per child info table on shmem */
 volatile User1SignalSlot	*user1SignalSlot = NULL;/* User 1 signal slot on shmem */
 struct timeval random_start_time;
@@ -201,6 +203,8 @@ static pid_t follow_pid = 0; /* pid for child process handling follow command */
 static pid_t pcp_pid = 0; /* pid for child process handling PCP */
 static pid_t watchdog_pid = 0; /* pid for watchdog child process */
 static pid_t wd_lifecheck_pid = 0; /* pid for child process handling watchdog lifecheck */
+static pid_t global_pool_pid = 0; /* pid for global connection pool manager */
+static int global_pool_fd = -1; /* unix domain socket fd for global connection pool */
 
 BACKEND_STATUS* my_backend_status[MAX_NUM_BACKENDS];		/* Backend status buffer */
 int my_master_node_id;		/* Master node id buffer */
@@ -323,7 +327,7 @@ int PgpoolMain(bool discard_status, bool clear_memcache_oidmaps)
 		}
 	}
 
-	fds[0] = create_unix_domain_socket(un_addr);
+	fds[0] = create_unix_domain_socket(un_addr, 0777);
 	fds[1] = -1;
 	on_proc_exit(FileUnlink, (Datum) un_addr.sun_path);
 
@@ -361,9 +365,32 @@ int PgpoolMain(bool discard_status, bool clear_memcache_oidmaps)
 	 * of process.  So this is harmless.
 	 */
 	POOL_SETMASK(&BlockSig);
+
+	/*
+	 * fork the global connection pool manager before the children since
+	 * they connect to it.
+	 */
+	if (pool_config->global_connection_pool)
+	{
+		pool_global_pool_socket_path(global_pool_un_addr.sun_path, sizeof(global_pool_un_addr.sun_path));
+		/* the socket passes authenticated connections. Only we can use it */
+		global_pool_fd = create_unix_domain_socket(global_pool_un_addr, 0700);
+		on_proc_exit(FileUnlink, (Datum) global_pool_un_addr.sun_path);
+
+		global_pool_pid = worker_fork_a_child(PT_GLOBAL_POOL, do_global_pool_manager, &global_pool_fd);
+	}
+
 	/* fork the children */
 	for (i=0;i<pool_config->num_init_children;i++)
 	{
+		/*
+		 * In dynamic process management mode, num_init_children is the
+		 * maximum number of children.  Start with max_spare_children.
+		 */
+		if (pool_config->process_management_mode == PM_DYNAMIC &&
+			i >= pool_config->max_spare_children)
+			break;
+
 		process_info[i].pid = fork_a_child(fds, i);
 		process_info[i].start_time = time(NULL);
 	}
@@ -397,7 +424,7 @@ int PgpoolMain(bool discard_status, bool clear_memcache_oidmaps)
 	}
 
 	/* fork a child for PCP handling */
-	pcp_unix_fd = create_unix_domain_socket(pcp_un_addr);
+	pcp_unix_fd = create_unix_domain_socket(pcp_un_addr, 0777);
 	/* Add onproc exit to clean up the unix domain socket at exit */
 	on_proc_exit(FileUnlink, (Datum)pcp_un_addr.sun_path);
 
@@ -448,17 +475,24 @@ int PgpoolMain(bool discard_status, bool clear_memcache_oidmaps)
 					(errmsg("%s successfully started. version %s (%s)", PACKAGE, VERSION, PGPOOLVERSION)));
 		first = false;
 
+		if (pool_config->process_management_mode == PM_DYNAMIC)
+			manage_spare_children();
+
 		processState = SLEEPING;
 		for (;;)
 		{
 			int r;
-			struct timeval t = {3, 0};
+			/* check idle children more often in dynamic mode */
+			struct timeval t = {pool_config->process_management_mode == PM_DYNAMIC ? 1 : 3, 0};
 
 			POOL_SETMASK(&UnBlockSig);
 			r = pool_pause(&t);
 			POOL_SETMASK(&BlockSig);
 			if (r > 0)
 				break;
+			/* wake up to adjust the number of spare children */
+			if (pool_config->process_management_mode == PM_DYNAMIC)
+				break;
 		}
 	}
 }
@@ -580,6 +614,13 @@ static pid_t fork_a_child(int *fds, int id)
 {
 	pid_t pid;
 
+	/* The new child is idle until it accepts a connection */
+	process_info[id].wait_for_connect = 1;
+	process_info[id].exit_if_idle = 0;
+
+	/* Forget load counters left by the previous child of this slot */
+	stat_clear_child_load(id);
+
 	pid = fork();
 
 	if (pid == 0)
@@ -620,6 +661,74 @@ static pid_t fork_a_child(int *fds, int id)
 	return pid;
 }
 
+/*
+ * Adjust the number of child processes in dynamic process management
+ * mode.  If there are less than min_spare_children idle children, fork
+ * new ones as long as the total does not exceed num_init_children.  If
+ * there are more than max_spare_children idle children, ask the surplus
+ * to exit.  They exit with POOL_EXIT_NO_RESTART and the reaper leaves
+ * their slots empty.
+ */
+static void manage_spare_children(void)
+{
+	int i;
+	int idle = 0;
+	int nchildren = 0;
+
+	if (exiting || switching)
+		return;
+
+	for (i = 0; i < pool_config->num_init_children; i++)
+	{
+		if (process_info[i].pid == 0)
+			continue;
+
+		nchildren++;
+		if (process_info[i].wait_for_connect && !process_info[i].exit_if_idle)
+			idle++;
+	}
+
+	if (idle < pool_config->min_spare_children)
+	{
+		int nfork = pool_config->min_spare_children - idle;
+
+		for (i = 0; i < pool_config->num_init_children && nfork > 0; i++)
+		{
+			if (process_info[i].pid != 0)
+				continue;
+
+			process_info[i].pid = fork_a_child(fds, i);
+			process_info[i].start_time = time(NULL);
+			nchildren++;
+			nfork--;
+		}
+
+		ereport(DEBUG1,
+				(errmsg("managing spare children"),
+				 errdetail("%d idle children, %d children in total", pool_config->min_spare_children - nfork, nchildren)));
+	}
+	else if (idle > pool_config->max_spare_children)
+	{
+		int nexit = idle - pool_config->max_spare_children;
+
+		for (i = pool_config->num_init_children - 1; i >= 0 && nexit > 0; i--)
+		{
+			if (process_info[i].pid == 0 ||
+				!process_info[i].wait_for_connect ||
+				process_info[i].exit_if_idle)
+				continue;
+
+			process_info[i].exit_if_idle = 1;
+			kill(process_info[i].pid, SIGUSR2);
+			nexit--;
+		}
+
+		ereport(DEBUG1,
+				(errmsg("managing spare children"),
+				 errdetail("asked %d idle children to exit", idle - pool_config->max_spare_children - nexit)));
+	}
+}
+
 /*
 * fork worker child process
 */
@@ -880,14 +989,15 @@ static int create_inet_domain_socket(const char *hostname, const int port)
 }
 
 /*
-* create UNIX domain socket
+* create UNIX domain socket with the permission "mode"
 */
-static int create_unix_domain_socket(struct sockaddr_un un_addr_tmp)
+static int create_unix_domain_socket(struct sockaddr_un un_addr_tmp, mode_t mode)
 {
 	struct sockaddr_un addr;
 	int fd;
 	int status;
 	int len;
+	mode_t oldmask;
 
 	fd = socket(AF_UNIX, SOCK_STREAM, 0);
 	if (fd == -1)
@@ -900,7 +1010,11 @@ static int create_unix_domain_socket(struct sockaddr_un un_addr_tmp)
 	addr.sun_family = AF_UNIX;
 	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", un_addr_tmp.sun_path);
 	len = sizeof(struct sockaddr_un);
+
+	/* never let the socket file have more permission than mode */
+	oldmask = umask(0777 & ~mode);
 	status = bind(fd, (struct sockaddr *)&addr, len);
+	umask(oldmask);
 	if (status == -1)
 	{
         ereport(FATAL,
@@ -908,7 +1022,7 @@ static int create_unix_domain_socket(struct sockaddr_un un_addr_tmp)
                  errdetail("bind socket failed with error: \"%s\"", strerror(errno))));
 	}
 
-	if (chmod(un_addr_tmp.sun_path, 0777) == -1)
+	if (chmod(un_addr_tmp.sun_path, mode) == -1)
 	{
         ereport(FATAL,
 			(errmsg("failed to bind a socket: \"%s\"",un_addr_tmp.sun_path),
@@ -945,6 +1059,9 @@ static void terminate_all_childrens()
     if(worker_pid > 0)
         kill(worker_pid, SIGINT);
     worker_pid = 0;
+    if(global_pool_pid > 0)
+        kill(global_pool_pid, SIGINT);
+    global_pool_pid = 0;
 	if (pool_config->use_watchdog)
 	{
 		if (pool_config->use_watchdog)
@@ -1360,6 +1477,10 @@ static RETSIGTYPE exit_handler(int sig)
         kill(worker_pid, sig);
     worker_pid = 0;
 
+    if (global_pool_pid > 0)
+        kill(global_pool_pid, sig);
+    global_pool_pid = 0;
+
 	if (pool_config->use_watchdog)
 	{
 		if (watchdog_pid)
@@ -1379,6 +1500,13 @@ static RETSIGTYPE exit_handler(int sig)
         wpid = waitpid(-1, &ret_pid, 0);
     } while (wpid > 0 || (wpid == -1 && errno == EINTR));
 
+	/*
+	 * All the child processes have gone. Save the query cache unless
+	 * immediate shutdown is requested.
+	 */
+	if (sig != SIGQUIT)
+		pool_save_memory_cache();
+
 	process_info = NULL;
 	exit(0);
 }
@@ -2045,6 +2173,13 @@ static void failover(void)
 		 */
 		kill(worker_pid, SIGUSR1);
 
+		/*
+		 * Pooled connections of the global connection pool may use the
+		 * failed node, or may lack the failed back node.
+		 */
+		if (global_pool_pid > 0)
+			kill(global_pool_pid, SIGUSR1);
+
 		if (sync_required)
 			wd_failover_end();
 
@@ -2268,6 +2403,8 @@ static char* process_name_from_pid(pid_t pid)
 		return "PCP child";
 	if (pid == worker_pid)
 		return "worker child";
+	if (pid == global_pool_pid)
+		return "global connection pool manager";
 	if (pool_config->use_watchdog)
 	{
 		if (pid == watchdog_pid)
@@ -2394,6 +2531,19 @@ static void reaper(void)
 				worker_pid = 0;
 		}
 
+		/* exiting process was global connection pool manager */
+		else if (global_pool_pid > 0 && pid == global_pool_pid)
+		{
+			found = true;
+			if (restart_child)
+			{
+				global_pool_pid = worker_fork_a_child(PT_GLOBAL_POOL, do_global_pool_manager, &global_pool_fd);
+				new_pid = global_pool_pid;
+			}
+			else
+				global_pool_pid = 0;
+		}
+
 		/* exiting process was watchdog process */
 		else if (pool_config->use_watchdog)
 		{
@@ -2431,6 +2581,7 @@ static void reaper(void)
 				if (pid == process_info[i].pid)
 				{
 					found = true;
+					stat_clear_child_load(i);
 					/* if found, fork a new child */
 					if (!switching && !exiting && restart_child)
 					{
@@ -2517,10 +2668,15 @@ pool_get_process_list(int *array_size)
 	int	   *array;
 	int		i;
 
-	*array_size = pool_config->num_init_children;
-	array = palloc0(*array_size * sizeof(int));
-	for (i = 0; i < *array_size; i++)
-		array[i] = process_info[i].pid;
+	array = palloc0(pool_config->num_init_children * sizeof(int));
+	*array_size = 0;
+	for (i = 0; i < pool_config->num_init_children; i++)
+	{
+		/* skip unused slots in dynamic process management mode */
+		if (process_info[i].pid == 0)
+			continue;
+		array[(*array_size)++] = process_info[i].pid;
+	}
 
 	return array;
 }
@@ -3108,6 +3264,12 @@ static void initialize_shared_mem_objects(bool clear_memcache_oidmaps)
 				(errmsg("pool_discard_oid_maps: discarded memqcache oid maps")));
 
 			pool_hash_init(pool_config->memqcache_max_num_cache);
+
+			pool_oidmap_init(pool_config->memqcache_max_num_cache);
+
+			pool_inflight_query_init(pool_config->num_init_children);
+
+			pool_load_memory_cache();
 		}
 
 #ifdef USE_MEMCACHED
@@ -3410,6 +3572,9 @@ static void reload_config(void)
 
 	if (worker_pid)
 		kill(worker_pid, SIGHUP);
+
+	if (global_pool_pid)
+		kill(global_pool_pid, SIGHUP);
 }
 
 /* Call back function to unlink the file */
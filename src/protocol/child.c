@@ -35,6 +35,18 @@
 #ifdef HAVE_SYS_SELECT_H
 #include <sys/select.h>
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+/*
+ * If EPOLLEXCLUSIVE is available, children wait for connection requests
+ * with it.  The kernel wakes up only one of the waiting children for a
+ * connection request, so there is no need to serialize accept().
+ */
+#if defined(HAVE_SYS_EPOLL_H) && defined(EPOLLEXCLUSIVE)
+#define USE_EPOLL_EXCLUSIVE_ACCEPT
+#endif
 
 #include <signal.h>
 #include <stdio.h>
@@ -79,6 +91,7 @@ static bool connect_using_existing_connection(POOL_CONNECTION *frontend,
 											  POOL_CONNECTION_POOL *backend,
 											  StartupPacket *sp);
 static void check_restart_request(void);
+static void check_exit_if_idle_request(void);
 static void enable_authentication_timeout(void);
 static void disable_authentication_timeout(void);
 static int wait_for_new_connections(int *fds, struct timeval *timeout, SockAddr *saddr);
@@ -93,6 +106,26 @@ static bool backend_cleanup(POOL_CONNECTION* volatile *frontend, POOL_CONNECTION
 static void free_persisten_db_connection_memory(POOL_CONNECTION_POOL_SLOT *cp);
 static int choose_db_node_id(char *str);
 static void child_will_go_down(int code, Datum arg);
+#ifdef HAVE_SYS_EPOLL_H
+static void do_child_multiplexed(int *fds);
+static void start_session(int listen_fd);
+static void run_session(int i);
+static void process_session(int i);
+static void resume_session(int i);
+static void park_session(int i);
+static void finish_session(int i, bool frontend_invalid);
+static void update_listen_sockets(int *fds, bool listen);
+static void check_idle_sessions(void);
+static void release_backend(int i);
+static bool acquire_backend(int i);
+static void wait_for_backend(int i);
+static void resume_waiting_sessions(void);
+static bool has_named_statements(void);
+static void recreate_prepared_statements(POOL_CONNECTION_POOL *backend);
+#endif
+#ifdef USE_EPOLL_EXCLUSIVE_ACCEPT
+static int create_accept_epoll(int *fds);
+#endif
 /*
  * non 0 means SIGTERM(smart shutdown) or SIGINT(fast shutdown) has arrived
  */
@@ -107,6 +140,7 @@ fd_set  readmask;
 int     nsocks;
 static int child_inet_fd = 0;
 static int child_unix_fd = 0;
+static int accept_epoll_fd = -1;	/* epoll set of listen sockets, if used */
 
 extern int myargc;
 extern char **myargv;
@@ -119,6 +153,53 @@ char remote_host[NI_MAXHOST];	/* client host */
 char remote_port[NI_MAXSERV];	/* client port */
 POOL_CONNECTION* volatile child_frontend = NULL;
 
+static int num_sessions = 0;	/* # of client sessions (max_sessions_per_child > 1) */
+
+#ifdef HAVE_SYS_EPOLL_H
+/*
+ * Client session of a child process multiplexing sessions.  While the
+ * session is parked, i.e. waiting for the next request from frontend,
+ * its per session state is kept here.
+ */
+typedef struct {
+	bool in_use;
+	POOL_CONNECTION *frontend;
+	POOL_CONNECTION_POOL *backend;
+	int pool_index;					/* connection pool used by the session */
+	MemoryContext loop_context;		/* per session ProcessLoopContext */
+	MemoryContext query_context;	/* per session QueryContext */
+	POOL_SESSION_CONTEXT session_context;	/* saved while parked */
+	int backend_fds[MAX_NUM_BACKENDS];	/* backend sockets watched by epoll */
+	int num_backend_fds;
+	bool released;					/* backend connection given back (transaction pooling) */
+	bool waiting;					/* waiting for a backend connection to get free */
+	uint64 wait_seq;				/* order of waiting sessions */
+	StartupPacket *sp;				/* to look for a backend connection (transaction pooling) */
+	int frontend_pid;				/* cancel key sent to frontend (transaction pooling) */
+	int frontend_key;
+	time_t last_activity;
+	char remote_host[NI_MAXHOST];
+	char remote_port[NI_MAXSERV];
+	char remote_ps_data[NI_MAXHOST];
+} CHILD_SESSION;
+
+/* epoll user data of listen sockets. Others are session indexes. */
+#define LISTEN_SOCKET_TAG	((uint64) 1 << 32)
+#define MAX_EPOLL_EVENTS	64
+
+static CHILD_SESSION *sessions;
+static int max_sessions;
+static int current_session = -1;
+static int epoll_fd = -1;
+static bool listening = false;
+static bool child_connected = false;	/* true if has been accepted connections from frontend */
+static int sessions_count = 0;	/* used if child_max_connections > 0 */
+static time_t idle_since;
+static MemoryContext child_loop_context;
+static bool backend_released = false;	/* waiting sessions may get a backend connection */
+static uint64 wait_seq = 0;
+#endif
+
 #ifdef DEBUG
 bool stop_now = false;
 #endif
@@ -172,6 +253,11 @@ void do_child(int *fds)
 	for (walk = fds; *walk != -1; walk++)
 		FD_SET(*walk, &readmask);
 
+#ifdef USE_EPOLL_EXCLUSIVE_ACCEPT
+	if (pool_config->max_sessions_per_child <= 1)
+		accept_epoll_fd = create_accept_epoll(fds);
+#endif
+
 	/* Create per loop iteration memory context */
 	ProcessLoopContext = AllocSetContextCreate(TopMemoryContext,
 											  "pgpool_child_main_loop",
@@ -211,6 +297,17 @@ void do_child(int *fds)
 		pool_reopen_passwd_file();
 	}
 
+	if (pool_config->max_sessions_per_child > 1)
+	{
+#ifdef HAVE_SYS_EPOLL_H
+		do_child_multiplexed(fds);
+#else
+		ereport(WARNING,
+				(errmsg("max_sessions_per_child = %d is ignored", pool_config->max_sessions_per_child),
+				 errdetail("epoll is not available on this platform")));
+		pool_config->max_sessions_per_child = 1;
+#endif
+	}
 
 	if (sigsetjmp(local_sigjmp_buf, 1) != 0)
 	{
@@ -237,6 +334,10 @@ void do_child(int *fds)
 
 		if (accepted)
 			connection_count_down();
+
+		/* Let children waiting for the result of our query go ahead */
+		if (pool_config->memory_cache_enabled)
+			pool_release_inflight_query();
         
         backend_cleanup(&child_frontend, backend, frontend_invalid);
 
@@ -295,10 +396,12 @@ void do_child(int *fds)
 		/* pgpool stop request already sent? */
 		check_stop_request();
 		check_restart_request();
+		check_exit_if_idle_request();
 		accepted = 0;
 		/* Destroy session context for just in case... */
 		pool_session_context_destroy();
 
+		pool_get_my_process_info()->wait_for_connect = 1;
 		front_end_fd = wait_for_new_connections(fds, &timeout, &saddr);
 		if(front_end_fd == OPERATION_TIMEOUT)
 		{
@@ -314,6 +417,7 @@ void do_child(int *fds)
 		if(front_end_fd == RETRY)
 			continue;
 
+		pool_get_my_process_info()->wait_for_connect = 0;
 		connection_count_up();
 		accepted = 1;
 
@@ -366,137 +470,1030 @@ void do_child(int *fds)
 		 */
 		pool_coninfo_set_frontend_connected(pool_get_process_context()->proc_id, pool_pool_index());
 
-		/* create memory context for query processing */
-		QueryContext = AllocSetContextCreate(ProcessLoopContext,
-										  "child_query_process",
-										  ALLOCSET_DEFAULT_MINSIZE,
-										  ALLOCSET_DEFAULT_INITSIZE,
-										  ALLOCSET_DEFAULT_MAXSIZE);
- 		/* query process loop */
-		for (;;)
-		{
-			POOL_STATUS status;
-			/* Reset the query process memory context */
-			MemoryContextSwitchTo(QueryContext);
-			MemoryContextResetAndDeleteChildren(QueryContext);
+		/* create memory context for query processing */
+		QueryContext = AllocSetContextCreate(ProcessLoopContext,
+										  "child_query_process",
+										  ALLOCSET_DEFAULT_MINSIZE,
+										  ALLOCSET_DEFAULT_INITSIZE,
+										  ALLOCSET_DEFAULT_MAXSIZE);
+ 		/* query process loop */
+		for (;;)
+		{
+			POOL_STATUS status;
+			/* Reset the query process memory context */
+			MemoryContextSwitchTo(QueryContext);
+			MemoryContextResetAndDeleteChildren(QueryContext);
+
+			status = pool_process_query(child_frontend, backend, 0);
+            if(status != POOL_CONTINUE)
+            {
+                backend_cleanup(&child_frontend, backend, false);
+                break;
+            }
+		}
+
+		/* Destroy session context */
+		pool_session_context_destroy();
+
+		/* Mark this connection pool is not connected from frontend */
+		pool_coninfo_unset_frontend_connected(pool_get_process_context()->proc_id, pool_pool_index());
+
+		accepted = 0;
+		connection_count_down();
+
+		timeout.tv_sec = pool_config->child_life_time;
+		timeout.tv_usec = 0;
+
+		/* increment queries counter if necessary */
+		if ( pool_config->child_max_connections > 0 )
+			connections_count++;
+
+		/* check if maximum connections count for this child reached */
+		if ( ( pool_config->child_max_connections > 0 ) &&
+			( connections_count >= pool_config->child_max_connections ) )
+		{
+			ereport(LOG,
+					(errmsg("child exiting, %d connections reached", pool_config->child_max_connections)));
+			child_exit(POOL_EXIT_AND_RESTART);
+		}
+	}
+	child_exit(POOL_EXIT_NO_RESTART);
+}
+
+/* -------------------------------------------------------------------
+ * private functions
+ * -------------------------------------------------------------------
+ */
+
+/*
+ * function cleans up the backend connection, when process query returns with an error
+ * return true if backend connection is cached
+ */
+static bool
+backend_cleanup(POOL_CONNECTION* volatile *frontend, POOL_CONNECTION_POOL* volatile backend, bool frontend_invalid)
+{
+    StartupPacket *sp;
+    bool cache_connection = false;
+
+    if (backend == NULL)
+        return false;
+
+    sp = MASTER_CONNECTION(backend)->sp;
+
+    /*
+     * cach connection if connection cache configuration parameter is enabled
+	 * and frontend connection is not invalid
+     */
+    if (sp && pool_config->connection_cache != 0 && frontend_invalid == false )
+    {
+        if (*frontend)
+        {
+            MemoryContext oldContext = CurrentMemoryContext;
+            PG_TRY();
+            {
+                if(pool_process_query(*frontend, backend, 1) == POOL_CONTINUE)
+                {
+                    pool_connection_pool_timer(backend);
+                    cache_connection = true;
+                }
+            }
+            PG_CATCH();
+            {
+                /* ignore the error message */
+                MemoryContextSwitchTo(oldContext);
+                FlushErrorState();
+            }
+            PG_END_TRY();
+        }
+    }
+
+	if (cache_connection)
+	{
+		/*
+		 * For those special databases, and when frontend client exits abnormally,
+		 * we don't cache connection to backend.
+		 */
+		if ((sp &&
+			(!strcmp(sp->database, "template0") ||
+			 !strcmp(sp->database, "template1") ||
+			 !strcmp(sp->database, "postgres") ||
+			 !strcmp(sp->database, "regression"))) ||
+			 (*frontend != NULL &&
+			  ((*frontend)->socket_state == POOL_SOCKET_EOF ||
+			  (*frontend)->socket_state == POOL_SOCKET_ERROR)))
+			cache_connection = false;
+	}
+	/*
+	 * Close frontend connection
+	 */
+	reset_connection();
+	pool_close(*frontend);
+	*frontend = NULL;
+
+    if (cache_connection == false)
+    {
+		pool_send_frontend_exits(backend);
+        if(sp)
+            pool_discard_cp(sp->user, sp->database, sp->major);
+    }
+	else if (pool_config->global_connection_pool && pool_global_pool_put(backend))
+	{
+		/* the global connection pool manager keeps the connection now */
+		pool_release_cp(backend);
+	}
+
+	/* reset the config parameters */
+	reset_all_variables(NULL,NULL);
+    return cache_connection;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/*
+ * child main loop used if max_sessions_per_child > 1
+ *
+ * Client sessions are served one request at a time.  When a session
+ * becomes idle, i.e. pool_process_query() returns POOL_IDLE, its state is
+ * saved and the process waits for any of the listen sockets, frontend
+ * sockets and backend sockets of parked sessions to get ready using
+ * epoll.
+ */
+static void
+do_child_multiplexed(int *fds)
+{
+	sigjmp_buf	local_sigjmp_buf;
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	int *walk;
+
+	/*
+	 * In transaction pooling mode sessions share connection pools, so
+	 * max_pool does not limit the number of sessions.
+	 */
+	if (pool_config->pooling_mode == POOLING_TRANSACTION)
+		max_sessions = pool_config->max_sessions_per_child;
+	else
+		max_sessions = Min(pool_config->max_sessions_per_child, pool_config->max_pool);
+	if (max_sessions < pool_config->max_sessions_per_child)
+		ereport(LOG,
+				(errmsg("child process serves at most %d client sessions", max_sessions),
+				 errdetail("each session needs its own connection pool, max_pool is %d", pool_config->max_pool)));
+
+	sessions = palloc0(sizeof(CHILD_SESSION) * max_sessions);
+	child_loop_context = ProcessLoopContext;
+
+	epoll_fd = epoll_create(max_sessions + 1);
+	if (epoll_fd < 0)
+		ereport(FATAL,
+				(errmsg("failed to create epoll instance"),
+				 errdetail("epoll_create failed with error : \"%s\"", strerror(errno))));
+
+	for (walk = fds; *walk != -1; walk++)
+		pool_set_nonblock(*walk);
+
+	if (sigsetjmp(local_sigjmp_buf, 1) != 0)
+	{
+		bool frontend_invalid = getfrontendinvalid();
+
+		disable_authentication_timeout();
+		/* Since not using PG_TRY, must reset error stack by hand */
+		error_context_stack = NULL;
+
+		/* See comments in do_child() */
+		if(pool_get_session_context(true) ||
+		   !child_frontend ||
+		   child_frontend->socket_state != POOL_SOCKET_EOF)
+			EmitErrorReport();
+
+		if (pool_config->memory_cache_enabled)
+			pool_release_inflight_query();
+
+		if (current_session >= 0)
+			finish_session(current_session, frontend_invalid);
+
+		MemoryContextSwitchTo(TopMemoryContext);
+		FlushErrorState();
+	}
+
+	/* We can now handle ereport(ERROR) */
+	PG_exception_stack = &local_sigjmp_buf;
+
+	for (;;)
+	{
+		int nevents;
+		int timeout;
+		int i;
+		bool retiring;
+
+		ProcessLoopContext = child_loop_context;
+		MemoryContextSwitchTo(ProcessLoopContext);
+		MemoryContextResetAndDeleteChildren(ProcessLoopContext);
+
+		idle = (num_sessions == 0);
+
+		/* pgpool stop request already sent? */
+		check_stop_request();
+
+		retiring = pool_config->child_max_connections > 0 &&
+			sessions_count >= pool_config->child_max_connections;
+
+		/* we count as an idle child only while serving no session */
+		pool_get_my_process_info()->wait_for_connect = (num_sessions == 0);
+
+		if (num_sessions == 0)
+		{
+			check_restart_request();
+			check_exit_if_idle_request();
+
+			if (retiring)
+			{
+				ereport(LOG,
+						(errmsg("child exiting, %d connections reached", pool_config->child_max_connections)));
+				child_exit(POOL_EXIT_AND_RESTART);
+			}
+		}
+
+		/* Let sessions waiting for a backend connection go on, if possible */
+		if (backend_released)
+			resume_waiting_sessions();
+
+		/* Accept new connections only if we have room for them */
+		update_listen_sockets(fds, num_sessions < max_sessions && !retiring &&
+							  exit_request == 0 && *InRecovery != RECOVERY_ONLINE);
+
+		timeout = -1;
+		if (num_sessions > 0)
+		{
+			if (pool_config->client_idle_limit > 0 ||
+				pool_config->client_idle_limit_in_recovery != 0)
+				timeout = 1000;
+		}
+		else if (pool_config->child_life_time > 0 && child_connected)
+			timeout = Max(idle_since + pool_config->child_life_time - time(NULL), 0) * 1000;
+
+		/* wait for online recovery to finish */
+		if (!listening && *InRecovery != RECOVERY_INIT && (timeout < 0 || timeout > 1000))
+			timeout = 1000;
+
+		if (num_sessions == 0)
+			set_ps_display("wait for connection request", false);
+
+		nevents = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+
+		if (nevents < 0 && errno != EINTR)
+			ereport(FATAL,
+					(errmsg("unable to read data"),
+					 errdetail("epoll_wait() system call failed with reason \"%s\"", strerror(errno))));
+
+		/* check backend timer is expired */
+		if (backend_timer_expired)
+		{
+			pool_backend_timer();
+			backend_timer_expired = 0;
+			backend_released = true;
+		}
+
+		if (num_sessions == 0 && child_connected && pool_config->child_life_time > 0 &&
+			time(NULL) >= idle_since + pool_config->child_life_time)
+		{
+			ereport(DEBUG1,
+					(errmsg("child life %d seconds expired", pool_config->child_life_time)));
+			child_exit(POOL_EXIT_AND_RESTART);
+		}
+
+		for (i = 0; i < nevents; i++)
+		{
+			uint64 tag = events[i].data.u64;
+
+			if (tag & LISTEN_SOCKET_TAG)
+			{
+				if (listening && num_sessions < max_sessions)
+					start_session((int) (tag & ~LISTEN_SOCKET_TAG));
+			}
+			else
+				run_session((int) tag);
+		}
+
+		check_idle_sessions();
+	}
+}
+
+/*
+ * Add listen sockets to or remove them from the epoll set.
+ */
+static void
+update_listen_sockets(int *fds, bool listen)
+{
+	struct epoll_event ev;
+	int *walk;
+
+	if (listen == listening)
+		return;
+
+	for (walk = fds; *walk != -1; walk++)
+	{
+		int rtn;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u64 = LISTEN_SOCKET_TAG | *walk;
+
+		rtn = -1;
+#ifdef USE_EPOLL_EXCLUSIVE_ACCEPT
+		/* Avoid waking up all children, if the kernel supports it */
+		if (listen)
+		{
+			ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+			rtn = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, *walk, &ev);
+			ev.events = EPOLLIN;
+		}
+		if (rtn < 0 && (!listen || errno == EINVAL))
+#endif
+			rtn = epoll_ctl(epoll_fd, listen ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, *walk, &ev);
+
+		if (rtn < 0)
+			ereport(FATAL,
+					(errmsg("failed to wait for connection request"),
+					 errdetail("epoll_ctl on listen socket failed with error : \"%s\"", strerror(errno))));
+	}
+	listening = listen;
+}
+
+/*
+ * Accept a new connection from frontend and start a session for it.
+ */
+static void
+start_session(int listen_fd)
+{
+	CHILD_SESSION *s;
+	POOL_CONNECTION_POOL *backend;
+	StartupPacket *sp;
+	SockAddr saddr;
+	struct epoll_event ev;
+	char psbuf[NI_MAXHOST + 128];
+	int front_end_fd;
+	int i, j;
+
+	memset(&saddr, 0, sizeof(saddr));
+	saddr.salen = sizeof(saddr.addr);
+
+	front_end_fd = accept(listen_fd, (struct sockaddr *)&saddr.addr, &saddr.salen);
+	if (front_end_fd < 0)
+	{
+		/*
+		 * "Resource temporarily unavailable" (EAGAIN or EWOULDBLOCK)
+		 * means other child took the connection.
+		 */
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			ereport(ERROR,
+				(errmsg("failed to accept user connection"),
+					errdetail("accept on socket failed with error : \"%s\"",strerror(errno))));
+		return;
+	}
+
+	for (i = 0; i < max_sessions; i++)
+	{
+		if (!sessions[i].in_use)
+			break;
+	}
+
+	s = &sessions[i];
+	memset(s, 0, sizeof(*s));
+	s->in_use = true;
+	s->pool_index = -1;
+	s->loop_context = AllocSetContextCreate(TopMemoryContext,
+											"pgpool_child_session",
+											ALLOCSET_DEFAULT_MINSIZE,
+											ALLOCSET_DEFAULT_INITSIZE,
+											ALLOCSET_DEFAULT_MAXSIZE);
+	s->query_context = AllocSetContextCreate(s->loop_context,
+											 "child_query_process",
+											 ALLOCSET_DEFAULT_MINSIZE,
+											 ALLOCSET_DEFAULT_INITSIZE,
+											 ALLOCSET_DEFAULT_MAXSIZE);
+	num_sessions++;
+	idle = 0;
+
+	connection_count_up();
+	accepted++;
+
+	resume_session(i);
+
+	check_config_reload();
+	validate_backend_connectivity(front_end_fd);
+	child_frontend = get_connection(front_end_fd, &saddr);
+	s->frontend = child_frontend;
+
+	/* set frontend fd to blocking */
+	pool_unset_nonblock(child_frontend->fd);
+
+	backend = get_backend_connection(child_frontend);
+	if (!backend)
+	{
+		finish_session(i, false);
+		return;
+	}
+	s->backend = backend;
+	child_connected = true;
+
+	/*
+	 * show ps status
+	 */
+	sp = MASTER_CONNECTION(backend)->sp;
+	snprintf(psbuf, sizeof(psbuf), "%d sessions, last %s %s %s",
+			 num_sessions, sp->user, sp->database, remote_ps_data);
+	set_ps_display(psbuf, false);
+
+	/*
+	 * Initialize per session context
+	 */
+	pool_init_session_context(child_frontend, backend);
+
+	/*
+	 * Set protocol versions
+	 */
+	pool_set_major_version(sp->major);
+	pool_set_minor_version(sp->minor);
+
+	/*
+	 * Mark this connection pool is connected from frontend
+	 */
+	pool_coninfo_set_frontend_connected(pool_get_process_context()->proc_id, pool_pool_index());
+
+	/*
+	 * Remember what is needed to get a backend connection again after
+	 * giving it back to the pool
+	 */
+	if (pool_config->pooling_mode == POOLING_TRANSACTION)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(s->loop_context);
+
+		s->sp = StartupPacketCopy(sp);
+		MemoryContextSwitchTo(oldContext);
+		for (j = 0; j < NUM_BACKENDS; j++)
+		{
+			if (VALID_BACKEND(j))
+			{
+				s->frontend_pid = backend->info[j].frontend_pid;
+				s->frontend_key = backend->info[j].frontend_key;
+				break;
+			}
+		}
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = i;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, child_frontend->fd, &ev) < 0)
+		ereport(ERROR,
+				(errmsg("failed to accept user connection"),
+				 errdetail("epoll_ctl on frontend socket failed with error : \"%s\"", strerror(errno))));
+
+	/*
+	 * Backends' ReadyForQuery may be in the read buffer already, which
+	 * epoll does not tell us about.  Process the session until it
+	 * becomes idle.
+	 */
+	process_session(i);
+}
+
+/*
+ * Process requests of a session until it becomes idle or ends.
+ */
+static void
+run_session(int i)
+{
+	CHILD_SESSION *s = &sessions[i];
+
+	if (!s->in_use)
+		return;
+
+	resume_session(i);
+
+	/* In transaction pooling mode, get a backend connection first */
+	if (s->released && !acquire_backend(i))
+	{
+		wait_for_backend(i);
+		return;
+	}
+
+	process_session(i);
+}
+
+/*
+ * Process requests of current session until it becomes idle or ends.
+ */
+static void
+process_session(int i)
+{
+	CHILD_SESSION *s = &sessions[i];
+	POOL_STATUS status;
+
+	for (;;)
+	{
+		/* Reset the query process memory context */
+		MemoryContextSwitchTo(QueryContext);
+		MemoryContextResetAndDeleteChildren(QueryContext);
+
+		status = pool_process_query(child_frontend, s->backend, 0);
+		if (status == POOL_IDLE)
+		{
+			park_session(i);
+			break;
+		}
+		else if (status != POOL_CONTINUE)
+		{
+			finish_session(i, false);
+			break;
+		}
+	}
+}
+
+/*
+ * Make a session current.
+ */
+static void
+resume_session(int i)
+{
+	CHILD_SESSION *s = &sessions[i];
+
+	current_session = i;
+	ProcessLoopContext = s->loop_context;
+	QueryContext = s->query_context;
+	MemoryContextSwitchTo(ProcessLoopContext);
+
+	child_frontend = s->frontend;
+	pool_set_pool_index(s->pool_index);
+	if (s->backend || s->released)
+		pool_session_context_restore(&s->session_context);
+
+	memcpy(remote_host, s->remote_host, sizeof(remote_host));
+	memcpy(remote_port, s->remote_port, sizeof(remote_port));
+	memcpy(remote_ps_data, s->remote_ps_data, sizeof(remote_ps_data));
+
+	s->last_activity = time(NULL);
+}
+
+/*
+ * Save the state of current session, which is waiting for the next
+ * request, and watch its sockets.
+ */
+static void
+park_session(int i)
+{
+	CHILD_SESSION *s = &sessions[i];
+	struct epoll_event ev;
+	int j;
+
+	/*
+	 * In transaction pooling mode, give the backend connection back to
+	 * the pool if nothing ties the session to it.
+	 */
+	if (pool_config->pooling_mode == POOLING_TRANSACTION && s->backend &&
+		pool_can_release_backend())
+		release_backend(i);
+
+	/*
+	 * Watch backend sockets as well, so that we notice notifications and
+	 * terminated backends while the session is idle.  The set of backend
+	 * connections does not change while the session uses them.
+	 */
+	if (s->backend && s->num_backend_fds == 0)
+	{
+		for (j = 0; j < NUM_BACKENDS; j++)
+		{
+			if (!VALID_BACKEND(j) || !CONNECTION_SLOT(s->backend, j))
+				continue;
+
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.u64 = i;
+			if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, CONNECTION(s->backend, j)->fd, &ev) == 0)
+				s->backend_fds[s->num_backend_fds++] = CONNECTION(s->backend, j)->fd;
+		}
+	}
+
+	s->pool_index = pool_pool_index();
+	pool_session_context_save(&s->session_context);
+
+	memcpy(s->remote_host, remote_host, sizeof(remote_host));
+	memcpy(s->remote_port, remote_port, sizeof(remote_port));
+	memcpy(s->remote_ps_data, remote_ps_data, sizeof(remote_ps_data));
+
+	s->last_activity = time(NULL);
+
+	child_frontend = NULL;
+	pool_set_pool_index(-1);
+	current_session = -1;
+	ProcessLoopContext = child_loop_context;
+	MemoryContextSwitchTo(TopMemoryContext);
+}
+
+/*
+ * Terminate current session and release its resources.
+ */
+static void
+finish_session(int i, bool frontend_invalid)
+{
+	CHILD_SESSION *s = &sessions[i];
+	int j;
+
+	/*
+	 * Forget about the session first, so that an error occurred while
+	 * cleaning up does not bring us here again.
+	 */
+	s->in_use = false;
+	current_session = -1;
+	num_sessions--;
+	if (accepted > 0)
+	{
+		accepted--;
+		connection_count_down();
+	}
+
+	/* Stop watching the sockets before they are closed or cached */
+	if (child_frontend && !s->waiting)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, child_frontend->fd, NULL);
+	for (j = 0; j < s->num_backend_fds; j++)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->backend_fds[j], NULL);
+
+	MemoryContextSwitchTo(s->loop_context);
+
+	if (s->backend)
+		backend_cleanup(&child_frontend, s->backend, frontend_invalid);
+	else
+		pool_discard_current_cp();
+
+	if (pool_get_session_context(true))
+	{
+		/* Destroy session context */
+		pool_session_context_destroy();
+
+		/* Mark this connection pool is not connected from frontend */
+		if (pool_pool_index() >= 0)
+			pool_coninfo_unset_frontend_connected(pool_get_process_context()->proc_id, pool_pool_index());
+	}
+
+	if (child_frontend)
+	{
+		pool_close(child_frontend);
+		child_frontend = NULL;
+	}
+
+	pool_set_pool_index(-1);
+	ProcessLoopContext = child_loop_context;
+	MemoryContextSwitchTo(TopMemoryContext);
+	MemoryContextDelete(s->loop_context);
+	memset(s, 0, sizeof(*s));
+
+	/* increment connections counter if necessary */
+	if (pool_config->child_max_connections > 0)
+		sessions_count++;
+
+	if (num_sessions == 0)
+	{
+		idle_since = time(NULL);
+		idle = 1;
+	}
+
+	/* The backend connection may be cached for waiting sessions */
+	backend_released = true;
+}
+
+/*
+ * Disconnect sessions which have been idle longer than client_idle_limit
+ * (or client_idle_limit_in_recovery).
+ */
+static void
+check_idle_sessions(void)
+{
+	time_t now;
+	int i;
+
+	if (num_sessions == 0)
+		return;
+
+	now = time(NULL);
+
+	for (i = 0; i < max_sessions; i++)
+	{
+		CHILD_SESSION *s = &sessions[i];
+
+		if (!s->in_use || (!s->backend && !s->released) || s->waiting)
+			continue;
+
+		if (*InRecovery == RECOVERY_INIT && pool_config->client_idle_limit > 0)
+		{
+			if (now - s->last_activity > pool_config->client_idle_limit)
+			{
+				resume_session(i);
+				ereport(FRONTEND_ERROR,
+						(pool_error_code("57000"),
+						 errmsg("unable to read data"),
+						 errdetail("child connection forced to terminate due to client_idle_limit:%d is reached",
+								   pool_config->client_idle_limit)));
+			}
+		}
+		else if (*InRecovery > RECOVERY_INIT && pool_config->client_idle_limit_in_recovery > 0)
+		{
+			if (now - s->last_activity > pool_config->client_idle_limit_in_recovery)
+			{
+				resume_session(i);
+				ereport(FRONTEND_ERROR,
+						(pool_error_code("57000"),
+						 errmsg("unable to read data"),
+						 errdetail("child connection forced to terminate due to client_idle_limit_in_recovery:%d is reached",
+								   pool_config->client_idle_limit_in_recovery)));
+			}
+		}
+		else if (*InRecovery > RECOVERY_INIT && pool_config->client_idle_limit_in_recovery == -1)
+		{
+			resume_session(i);
+			ereport(FRONTEND_ERROR,
+					(pool_error_code("57000"),
+					 errmsg("connection terminated due to online recovery"),
+					 errdetail("child connection forced to terminate due to client_idle_limitis:-1")));
+		}
+	}
+}
+
+/*
+ * Give the backend connection of current session back to the connection
+ * pool, so that other sessions can use it.  Used in transaction pooling
+ * mode when the session is idle and nothing ties it to the backend.
+ */
+static void
+release_backend(int i)
+{
+	CHILD_SESSION *s = &sessions[i];
+	POOL_CONNECTION_POOL *backend = s->backend;
+	int j;
+
+	/*
+	 * Prepared statements are created again on the backend connection
+	 * the session gets next time.  Do not leave them to other sessions.
+	 */
+	if (has_named_statements())
+	{
+		for (j = 0; j < NUM_BACKENDS; j++)
+		{
+			if (!VALID_BACKEND(j))
+				continue;
+
+			do_command(child_frontend, CONNECTION(backend, j), "DEALLOCATE ALL",
+					   MAJOR(backend), MASTER_CONNECTION(backend)->pid,
+					   MASTER_CONNECTION(backend)->key, 0);
+		}
+	}
+
+	for (j = 0; j < s->num_backend_fds; j++)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->backend_fds[j], NULL);
+	s->num_backend_fds = 0;
+
+	pool_coninfo_unset_frontend_connected(pool_get_process_context()->proc_id, pool_pool_index());
+
+	/* Now the connection pool is free as if it were cached */
+	pool_connection_pool_timer(backend);
+
+	pool_session_context_set_backend(NULL);
+	pool_set_pool_index(-1);
+	s->backend = NULL;
+	s->released = true;
+	backend_released = true;
+
+	ereport(DEBUG1,
+			(errmsg("session %d released backend connection", i)));
+}
+
+/*
+ * Get a backend connection for current session, which gave its backend
+ * connection back to the pool.  Returns false if all the connections
+ * for the user and database are used by other sessions.  If there's no
+ * connection at all, the session cannot go on and is terminated.
+ */
+static bool
+acquire_backend(int i)
+{
+	CHILD_SESSION *s = &sessions[i];
+	POOL_CONNECTION_POOL *backend;
+	int j;
+
+	backend = pool_get_idle_cp(s->sp);
+
+	/* look for an idle connection returned by other child processes */
+	if (backend == NULL && pool_config->global_connection_pool)
+		backend = pool_create_cp_from_global_pool(s->sp);
+
+	if (backend == NULL)
+	{
+		if (pool_cp_exists(s->sp))
+			return false;
+
+		ereport(FRONTEND_ERROR,
+				(pool_error_code("57P01"),
+				 errmsg("unable to get backend connection"),
+				 errdetail("all connections of user \"%s\" database \"%s\" have been closed",
+						   s->sp->user, s->sp->database)));
+	}
+
+	s->backend = backend;
+	s->pool_index = pool_pool_index();
+	s->released = false;
+	pool_session_context_set_backend(backend);
+
+	for (j = 0; j < NUM_BACKENDS; j++)
+	{
+		if (!VALID_BACKEND(j))
+			continue;
+
+		backend->info[j].frontend_pid = s->frontend_pid;
+		backend->info[j].frontend_key = s->frontend_key;
+	}
+	pool_coninfo_set_frontend_connected(pool_get_process_context()->proc_id, pool_pool_index());
+
+	recreate_prepared_statements(backend);
+
+	ereport(DEBUG1,
+			(errmsg("session %d acquired backend connection pool %d", i, s->pool_index)));
+
+	return true;
+}
+
+/*
+ * Park current session until a backend connection gets free.  The
+ * frontend socket is not watched meanwhile, since we cannot read the
+ * request anyway.
+ */
+static void
+wait_for_backend(int i)
+{
+	CHILD_SESSION *s = &sessions[i];
 
-			status = pool_process_query(child_frontend, backend, 0);
-            if(status != POOL_CONTINUE)
-            {
-                backend_cleanup(&child_frontend, backend, false);
-                break;
-            }
-		}
+	if (!s->waiting)
+	{
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, child_frontend->fd, NULL);
+		s->waiting = true;
+		s->wait_seq = ++wait_seq;
+	}
+	park_session(i);
+}
 
-		/* Destroy session context */
-		pool_session_context_destroy();
+/*
+ * Let the sessions waiting for a backend connection go on in the order
+ * they started to wait, as far as backend connections are available.
+ */
+static void
+resume_waiting_sessions(void)
+{
+	uint64 last = 0;
 
-		/* Mark this connection pool is not connected from frontend */
-		pool_coninfo_unset_frontend_connected(pool_get_process_context()->proc_id, pool_pool_index());
+	for (;;)
+	{
+		CHILD_SESSION *s;
+		struct epoll_event ev;
+		int next = -1;
+		int i;
 
-		accepted = 0;
-		connection_count_down();
+		for (i = 0; i < max_sessions; i++)
+		{
+			if (!sessions[i].in_use || !sessions[i].waiting || sessions[i].wait_seq <= last)
+				continue;
 
-		timeout.tv_sec = pool_config->child_life_time;
-		timeout.tv_usec = 0;
+			if (next < 0 || sessions[i].wait_seq < sessions[next].wait_seq)
+				next = i;
+		}
+		if (next < 0)
+			break;
 
-		/* increment queries counter if necessary */
-		if ( pool_config->child_max_connections > 0 )
-			connections_count++;
+		s = &sessions[next];
+		last = s->wait_seq;
 
-		/* check if maximum connections count for this child reached */
-		if ( ( pool_config->child_max_connections > 0 ) &&
-			( connections_count >= pool_config->child_max_connections ) )
+		resume_session(next);
+		if (!acquire_backend(next))
 		{
-			ereport(LOG,
-					(errmsg("child exiting, %d connections reached", pool_config->child_max_connections)));
-			child_exit(POOL_EXIT_AND_RESTART);
+			park_session(next);
+			continue;
 		}
+
+		s->waiting = false;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u64 = next;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, child_frontend->fd, &ev) < 0)
+			ereport(ERROR,
+					(errmsg("unable to read data from frontend"),
+					 errdetail("epoll_ctl on frontend socket failed with error : \"%s\"", strerror(errno))));
+
+		process_session(next);
 	}
-	child_exit(POOL_EXIT_NO_RESTART);
-}
 
-/* -------------------------------------------------------------------
- * private functions
- * -------------------------------------------------------------------
- */
+	backend_released = false;
+}
 
 /*
- * function cleans up the backend connection, when process query returns with an error
- * return true if backend connection is cached
+ * Return true if current session has prepared statements.
  */
 static bool
-backend_cleanup(POOL_CONNECTION* volatile *frontend, POOL_CONNECTION_POOL* volatile backend, bool frontend_invalid)
+has_named_statements(void)
 {
-    StartupPacket *sp;
-    bool cache_connection = false;
+	POOL_SENT_MESSAGE_LIST *msglist = &pool_get_session_context(false)->message_list;
+	int i;
 
-    if (backend == NULL)
-        return false;
+	for (i = 0; i < msglist->size; i++)
+	{
+		POOL_SENT_MESSAGE *msg = msglist->sent_messages[i];
 
-    sp = MASTER_CONNECTION(backend)->sp;
+		if ((msg->kind == 'P' || msg->kind == 'Q') && *msg->name != '\0')
+			return true;
+	}
+	return false;
+}
 
-    /*
-     * cach connection if connection cache configuration parameter is enabled
-	 * and frontend connection is not invalid
-     */
-    if (sp && pool_config->connection_cache != 0 && frontend_invalid == false )
-    {
-        if (*frontend)
-        {
-            MemoryContext oldContext = CurrentMemoryContext;
-            PG_TRY();
-            {
-                if(pool_process_query(*frontend, backend, 1) == POOL_CONTINUE)
-                {
-                    pool_connection_pool_timer(backend);
-                    cache_connection = true;
-                }
-            }
-            PG_CATCH();
-            {
-                /* ignore the error message */
-                MemoryContextSwitchTo(oldContext);
-                FlushErrorState();
-            }
-            PG_END_TRY();
-        }
-    }
+/*
+ * Create the prepared statements of current session on the backend
+ * connection it has just got, on the nodes they were created originally.
+ * PREPARE is sent as it is, and Parse messages are followed by Sync.
+ */
+static void
+recreate_prepared_statements(POOL_CONNECTION_POOL *backend)
+{
+	POOL_SENT_MESSAGE_LIST *msglist = &pool_get_session_context(false)->message_list;
+	bool parse_sent[MAX_NUM_BACKENDS];
+	int i, j;
 
-	if (cache_connection)
+	memset(parse_sent, 0, sizeof(parse_sent));
+
+	for (i = 0; i < msglist->size; i++)
 	{
-		/*
-		 * For those special databases, and when frontend client exits abnormally,
-		 * we don't cache connection to backend.
-		 */
-		if ((sp &&
-			(!strcmp(sp->database, "template0") ||
-			 !strcmp(sp->database, "template1") ||
-			 !strcmp(sp->database, "postgres") ||
-			 !strcmp(sp->database, "regression"))) ||
-			 (*frontend != NULL &&
-			  ((*frontend)->socket_state == POOL_SOCKET_EOF ||
-			  (*frontend)->socket_state == POOL_SOCKET_ERROR)))
-			cache_connection = false;
+		POOL_SENT_MESSAGE *msg = msglist->sent_messages[i];
+
+		if ((msg->kind != 'P' && msg->kind != 'Q') || *msg->name == '\0' ||
+			msg->state != POOL_SENT_MESSAGE_CREATED)
+			continue;
+
+		for (j = 0; j < NUM_BACKENDS; j++)
+		{
+			if (!VALID_BACKEND(j))
+				continue;
+			if (msg->query_context && !msg->query_context->where_to_send[j])
+				continue;
+
+			if (msg->kind == 'Q')
+			{
+				do_command(child_frontend, CONNECTION(backend, j), msg->contents,
+						   MAJOR(backend), MASTER_CONNECTION(backend)->pid,
+						   MASTER_CONNECTION(backend)->key, 0);
+			}
+			else
+			{
+				int sendlen = htonl(msg->len + 4);
+
+				pool_write(CONNECTION(backend, j), "P", 1);
+				pool_write(CONNECTION(backend, j), &sendlen, sizeof(sendlen));
+				pool_write(CONNECTION(backend, j), msg->contents, msg->len);
+				parse_sent[j] = true;
+			}
+		}
 	}
-	/*
-	 * Close frontend connection
-	 */
-	reset_connection();
-	pool_close(*frontend);
-	*frontend = NULL;
 
-    if (cache_connection == false)
-    {
-		pool_send_frontend_exits(backend);
-        if(sp)
-            pool_discard_cp(sp->user, sp->database, sp->major);
-    }
+	for (j = 0; j < NUM_BACKENDS; j++)
+	{
+		POOL_CONNECTION *cp = CONNECTION(backend, j);
+		bool failed = false;
+		char kind;
+		int len;
+		char *buf;
 
-	/* reset the config parameters */
-	reset_all_variables(NULL,NULL);
-    return cache_connection;
+		if (!VALID_BACKEND(j) || !parse_sent[j])
+			continue;
+
+		pool_write(cp, "S", 1);
+		len = htonl(4);
+		pool_write_and_flush(cp, &len, sizeof(len));
+
+		/* Read ParseComplete or ErrorResponse until ReadyForQuery */
+		for (;;)
+		{
+			pool_read(cp, &kind, sizeof(kind));
+			pool_read(cp, &len, sizeof(len));
+			len = ntohl(len) - 4;
+			buf = len > 0 ? pool_read2(cp, len) : NULL;
+
+			if (kind == 'E')
+				failed = true;
+			else if (kind == 'Z')
+			{
+				if (buf)
+					cp->tstate = *buf;
+				break;
+			}
+		}
+
+		if (failed)
+			ereport(FRONTEND_ERROR,
+					(errmsg("unable to create prepared statements on backend connection"),
+					 errdetail("backend node %d returned error", j)));
+	}
 }
+#endif	/* HAVE_SYS_EPOLL_H */
 
 /*
  * Read startup packet
@@ -760,7 +1757,14 @@ void cancel_request(CancelPacket *sp)
 					(errmsg("processing cancel request"),
 						 errdetail("connection info: address:%p database:%s user:%s pid:%d key:%d i:%d",
 								   c, c->database, c->user, ntohl(c->pid), ntohl(c->key),i)));
-				if (c->pid == sp->pid && c->key == sp->key)
+				/*
+				 * In transaction pooling mode the frontend knows the
+				 * cancel key generated by us, which follows the session
+				 * to the backend connection it uses now.
+				 */
+				if (pool_config->pooling_mode == POOLING_TRANSACTION ?
+					(c->connected && c->frontend_pid == sp->pid && c->frontend_key == sp->key) :
+					(c->pid == sp->pid && c->key == sp->key))
 				{
 					ereport(DEBUG1,
 						(errmsg("processing cancel request"),
@@ -865,7 +1869,7 @@ static POOL_CONNECTION_POOL *connect_backend(StartupPacket *sp, POOL_CONNECTION
 	int i;
 
 	/* connect to the backend */
-	backend = pool_create_cp();
+	backend = pool_create_cp(sp);
 	if (backend == NULL)
 	{
 		pool_send_error_message(frontend, sp->major, "XX000", "connection cache is full", "",
@@ -984,9 +1988,8 @@ static RETSIGTYPE die(int sig)
  */
 static RETSIGTYPE close_idle_connection(int sig)
 {
-	int i, j;
+	int j;
 	POOL_CONNECTION_POOL *p = pool_connection_pool;
-	ConnectionInfo *info;
 	int save_errno = errno;
 
 #ifdef NOT_USED
@@ -1012,25 +2015,7 @@ static RETSIGTYPE close_idle_connection(int sig)
 #endif
 
 			pool_send_frontend_exits(p);
-
-			for (i=0;i<NUM_BACKENDS;i++)
-			{
-				if (!VALID_BACKEND(i))
-					continue;
-
-				if (i == 0)
-				{
-					/* only first backend allocated the memory for the start up packet */
-					pool_free_startup_packet(CONNECTION_SLOT(p, i)->sp);
-                    CONNECTION_SLOT(p, i)->sp = NULL;
-
-				}
-				pool_close(CONNECTION(p, i));
-			}
-			info = p->info;
-			memset(p, 0, sizeof(POOL_CONNECTION_POOL));
-			p->info = info;
-			memset(p->info, 0, sizeof(ConnectionInfo));
+			pool_release_cp(p);
 		}
 	}
 
@@ -1047,6 +2032,17 @@ static RETSIGTYPE authentication_timeout(int sig)
 	ereport(LOG,
 			(errmsg("authentication timeout")));
 
+	/*
+	 * If other client sessions are served by this process, just shut down
+	 * the connection being authenticated.  Reading from it fails and only
+	 * the session is cleaned up.
+	 */
+	if (num_sessions > 1 && child_frontend)
+	{
+		shutdown(child_frontend->fd, SHUT_RDWR);
+		return;
+	}
+
 	child_exit(POOL_EXIT_AND_RESTART);
 }
 
@@ -1151,7 +2147,7 @@ child_will_go_down(int code, Datum arg)
 	}
 	
 	/* count down global connection counter */
-	if (accepted)
+	for (; accepted > 0; accepted--)
 		connection_count_down();
 	
 	if (pool_config->memory_cache_enabled && !pool_is_shmem_cache())
@@ -1660,6 +2656,7 @@ int select_load_balancing_node(void)
 {
 	int selected_slot;
 	double total_weight,r;
+	double weight[MAX_NUM_BACKENDS];
 	int i;
 	int index;
 	POOL_SESSION_CONTEXT *ses = pool_get_session_context(false);
@@ -1740,6 +2737,86 @@ int select_load_balancing_node(void)
 		return suggested_node_id;
 	}
 
+	/*
+	 * Choose the least loaded backend, i.e. the one with the fewest
+	 * active sessions plus in-flight queries.  Ties are broken by
+	 * preferring the higher weight.
+	 */
+	if (pool_config->load_balance_algorithm == LB_LEAST_OUTSTANDING)
+	{
+		int load;
+		int min_load = -1;
+
+		selected_slot = MASTER_NODE_ID;
+
+		for (i=0;i<NUM_BACKENDS;i++)
+		{
+			if (suggested_node_id == -1 && i == PRIMARY_NODE_ID)
+				continue;
+
+			if (!VALID_BACKEND(i) || BACKEND_INFO(i).backend_weight <= 0.0)
+				continue;
+
+			load = stat_get_node_load(i);
+
+			if (min_load < 0 || load < min_load ||
+				(load == min_load &&
+				 BACKEND_INFO(i).backend_weight > BACKEND_INFO(selected_slot).backend_weight))
+			{
+				min_load = load;
+				selected_slot = i;
+			}
+		}
+
+		ereport(DEBUG1,
+			(errmsg("selecting load balance node"),
+				 errdetail("selected backend id is %d with load %d", selected_slot, min_load)));
+		return selected_slot;
+	}
+
+	for (i=0;i<NUM_BACKENDS;i++)
+		weight[i] = BACKEND_INFO(i).backend_weight;
+
+	/*
+	 * With latency based load balancing, divide each weight by the
+	 * node's average response time so that slow nodes get less traffic
+	 * but are still probed now and then.  Until every candidate has
+	 * enough samples, plain backend_weight is used so that all of them
+	 * get measured.
+	 */
+	if (pool_config->load_balance_algorithm == LB_LATENCY)
+	{
+		double latency[MAX_NUM_BACKENDS];
+		bool enough_samples = true;
+
+		for (i=0;i<NUM_BACKENDS;i++)
+		{
+			latency[i] = 0.0;
+
+			if (suggested_node_id == -1 && i == PRIMARY_NODE_ID)
+				continue;
+
+			if (!VALID_BACKEND(i) || weight[i] <= 0.0)
+				continue;
+
+			latency[i] = stat_get_latency(i);
+			if (latency[i] <= 0.0)
+			{
+				enough_samples = false;
+				break;
+			}
+		}
+
+		if (enough_samples)
+		{
+			for (i=0;i<NUM_BACKENDS;i++)
+			{
+				if (latency[i] > 0.0)
+					weight[i] /= latency[i];
+			}
+		}
+	}
+
 	/* Choose a backend in random manner with weight */
 	selected_slot = MASTER_NODE_ID;
 	total_weight = 0.0;
@@ -1751,10 +2828,10 @@ int select_load_balancing_node(void)
 			if (suggested_node_id == -1)
 			{
 				if (i != PRIMARY_NODE_ID)
-					total_weight += BACKEND_INFO(i).backend_weight;
+					total_weight += weight[i];
 			}
 			else
-				total_weight += BACKEND_INFO(i).backend_weight;
+				total_weight += weight[i];
 		}
 	}
 
@@ -1770,13 +2847,13 @@ int select_load_balancing_node(void)
 		if (suggested_node_id == -1 && i == PRIMARY_NODE_ID)
 			continue;
 
-		if (VALID_BACKEND(i) && BACKEND_INFO(i).backend_weight > 0.0)
+		if (VALID_BACKEND(i) && weight[i] > 0.0)
 		{
 			if(r >= total_weight)
 				selected_slot = i;
 			else
 				break;
-			total_weight += BACKEND_INFO(i).backend_weight;
+			total_weight += weight[i];
 		}
 	}
 	ereport(DEBUG1,
@@ -1849,6 +2926,57 @@ static void check_restart_request(void)
 	}
 }
 
+static void check_exit_if_idle_request(void)
+{
+	/* In dynamic process management mode, pgpool main asks surplus idle
+	 * children to exit.  We are not restarted in this case.
+	 */
+	if (pool_get_my_process_info()->exit_if_idle)
+	{
+		ereport(DEBUG1,
+			(errmsg("too many idle children"),
+				 errdetail("exiting myself")));
+
+		child_exit(POOL_EXIT_NO_RESTART);
+	}
+}
+
+#ifdef USE_EPOLL_EXCLUSIVE_ACCEPT
+/*
+ * Create an epoll set of the listen sockets using EPOLLEXCLUSIVE.  Returns
+ * -1 if the kernel does not support it, in which case select() is used
+ * as before.
+ */
+static int
+create_accept_epoll(int *fds)
+{
+	struct epoll_event ev;
+	int efd;
+	int *walk;
+
+	efd = epoll_create(1);
+	if (efd < 0)
+		return -1;
+
+	for (walk = fds; *walk != -1; walk++)
+	{
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+		ev.data.fd = *walk;
+
+		if (epoll_ctl(efd, EPOLL_CTL_ADD, *walk, &ev) < 0)
+		{
+			ereport(DEBUG1,
+					(errmsg("EPOLLEXCLUSIVE is not available, using select() to wait for connection request"),
+					 errdetail("epoll_ctl failed with error : \"%s\"", strerror(errno))));
+			close(efd);
+			return -1;
+		}
+	}
+	return efd;
+}
+#endif
+
 /*
  * wait_for_new_connections()
  * functions calls select on sockets and wait for new client
@@ -1867,6 +2995,7 @@ wait_for_new_connections(int *fds, struct timeval *timeout, SockAddr *saddr)
 	int afd;
 	int *walk;
 	int on;
+	bool serialize;
 
 #ifdef ACCEPT_PERFORMANCE
 	struct timeval now1, now2;
@@ -1880,7 +3009,10 @@ wait_for_new_connections(int *fds, struct timeval *timeout, SockAddr *saddr)
 	for (walk = fds; *walk != -1; walk++)
 		pool_set_nonblock(*walk);
 
-	if (SERIALIZE_ACCEPT)
+	/* No need to serialize accept() if we are using EPOLLEXCLUSIVE */
+	serialize = SERIALIZE_ACCEPT && accept_epoll_fd < 0;
+
+	if (serialize)
 		set_ps_display("wait for accept lock", false);
 	else
 		set_ps_display("wait for connection request", false);
@@ -1908,7 +3040,7 @@ wait_for_new_connections(int *fds, struct timeval *timeout, SockAddr *saddr)
 	 * If child life time is disabled and serialize_accept is on, we serialize
 	 * select() and accept() to avoid the "Thundering herd" problem.
 	 */
-	if (SERIALIZE_ACCEPT)
+	if (serialize)
 	{
 		pool_semaphore_lock(ACCEPT_FD_SEM);
 		set_ps_display("wait for connection request", false);
@@ -1916,11 +3048,24 @@ wait_for_new_connections(int *fds, struct timeval *timeout, SockAddr *saddr)
 			   (errmsg("LOCKING select()")));
 	}
 
-	numfds = select(nsocks, &rmask, NULL, NULL, timeoutval);
+#ifdef USE_EPOLL_EXCLUSIVE_ACCEPT
+	if (accept_epoll_fd >= 0)
+	{
+		struct epoll_event ev;
+
+		numfds = epoll_wait(accept_epoll_fd, &ev, 1,
+							timeoutval ? timeoutval->tv_sec * 1000 + timeoutval->tv_usec / 1000 : -1);
+		FD_ZERO(&rmask);
+		if (numfds > 0)
+			FD_SET(ev.data.fd, &rmask);
+	}
+	else
+#endif
+		numfds = select(nsocks, &rmask, NULL, NULL, timeoutval);
 
 	save_errno = errno;
 
-	if (SERIALIZE_ACCEPT)
+	if (serialize)
 	{
 		pool_semaphore_unlock(ACCEPT_FD_SEM);
 		ereport(DEBUG1,
@@ -2345,6 +3490,10 @@ retry_startup:
 		}
 	}
 
+	/* look for an idle connection returned by other child processes */
+	if (backend == NULL && pool_config->global_connection_pool)
+		backend = pool_create_cp_from_global_pool(sp);
+
 	if (backend == NULL)
 	{
 		/* create a new connection to backend */
@@ -50,13 +50,50 @@
 #include "utils/memutils.h"
 #include "context/pool_process_context.h"
 
+/* true if the connection pool is used by a frontend session rather than cached */
+#define POOL_CP_IN_USE(p) (MASTER_CONNECTION(p) && MASTER_CONNECTION(p)->closetime == 0)
+
 static int pool_index;	/* Active pool index */
 POOL_CONNECTION_POOL *pool_connection_pool;	/* connection pool */
+
+/*
+ * Connection pools are indexed by the hash of user, database and
+ * protocol major version, so that pool_get_cp() looks at only the pools
+ * which may match.  Pools which are not used by any frontend are kept in
+ * LRU order, and empty pools in a free list, so that get_free_cp() does
+ * not need to scan all the pools either.
+ */
+typedef struct {
+	int list_prev;		/* neighbours in the free or LRU list, -1 if none */
+	int list_next;
+	int hash_next;		/* next pool in the hash bucket, -1 if none */
+	uint32 hashkey;		/* hash value of the pool, if hashed */
+	bool hashed;		/* true if linked in a hash bucket */
+	char list;			/* 'F': free list, 'L': LRU list, '\0': none */
+} POOL_CP_INDEX;
+
+typedef struct {
+	int head;
+	int tail;
+} POOL_CP_LIST;
+
+static POOL_CP_INDEX *cp_index;
+static int *cp_buckets;		/* heads of hash buckets */
+static uint32 cp_nbuckets;	/* power of 2 */
+static POOL_CP_LIST cp_free_list;
+static POOL_CP_LIST cp_lru_list;
+
 volatile sig_atomic_t backend_timer_expired = 0; /* flag for connection closed timer is expired */
 volatile sig_atomic_t health_check_timer_expired;		/* non 0 if health check timer expired */
 static POOL_CONNECTION_POOL_SLOT *create_cp(POOL_CONNECTION_POOL_SLOT *cp, int slot);
 static POOL_CONNECTION_POOL *new_connection(POOL_CONNECTION_POOL *p);
+static POOL_CONNECTION_POOL *get_free_cp(int *index);
 static int check_socket_status(int fd);
+static uint32 cp_hash(char *user, char *database, int protoMajor);
+static void cp_hash_insert(int index, StartupPacket *sp);
+static void cp_hash_delete(int index);
+static void cp_list_append(POOL_CP_LIST *list, char kind, int index);
+static void cp_list_delete(int index);
 static bool connect_with_timeout(int fd, struct addrinfo *walk, char *host, int port, bool retry);
 
 /*
@@ -75,6 +112,22 @@ int pool_init_cp(void)
 		pool_connection_pool[i].info = pool_coninfo(pool_get_process_context()->proc_id, i, 0);
 		memset(pool_connection_pool[i].info, 0, sizeof(ConnectionInfo) * MAX_NUM_BACKENDS);
 	}
+
+	/* Initialize the index. All the pools are empty. */
+	for (cp_nbuckets = 1; cp_nbuckets < pool_config->max_pool; cp_nbuckets <<= 1)
+		;
+	cp_buckets = palloc(sizeof(int) * cp_nbuckets);
+	for (i = 0; i < cp_nbuckets; i++)
+		cp_buckets[i] = -1;
+
+	cp_index = palloc0(sizeof(POOL_CP_INDEX) * pool_config->max_pool);
+	cp_free_list.head = cp_free_list.tail = -1;
+	cp_lru_list.head = cp_lru_list.tail = -1;
+	for (i = 0; i < pool_config->max_pool; i++)
+	{
+		cp_index[i].hash_next = -1;
+		cp_list_append(&cp_free_list, 'F', i);
+	}
     MemoryContextSwitchTo(oldContext);
 	return 0;
 }
@@ -86,8 +139,8 @@ POOL_CONNECTION_POOL *pool_get_cp(char *user, char *database, int protoMajor, in
 {
 	pool_sigset_t oldmask;
 
-	int i, freed = 0;
-	ConnectionInfo *info;
+	int i;
+	uint32 hashkey;
 
 	POOL_CONNECTION_POOL *connection_pool = pool_connection_pool;
 
@@ -102,8 +155,24 @@ POOL_CONNECTION_POOL *pool_get_cp(char *user, char *database, int protoMajor, in
 
 	POOL_SETMASK2(&BlockSig, &oldmask);
 
-	for (i=0;i<pool_config->max_pool;i++)
+	hashkey = cp_hash(user, database, protoMajor);
+
+	for (i=cp_buckets[hashkey & (cp_nbuckets - 1)];i>=0;i=cp_index[i].hash_next)
 	{
+		connection_pool = &pool_connection_pool[i];
+
+		if (cp_index[i].hashkey != hashkey)
+			continue;
+
+		/*
+		 * If this process multiplexes client sessions, a session which
+		 * already owns a connection pool must only see its own, and a new
+		 * session must not pick up one which is used by other session.
+		 */
+		if (pool_config->max_sessions_per_child > 1 &&
+			(pool_index >= 0 ? i != pool_index : POOL_CP_IN_USE(connection_pool)))
+			continue;
+
 		if (MASTER_CONNECTION(connection_pool) &&
 			MASTER_CONNECTION(connection_pool)->sp &&
 			MASTER_CONNECTION(connection_pool)->sp->major == protoMajor &&
@@ -116,6 +185,7 @@ POOL_CONNECTION_POOL *pool_get_cp(char *user, char *database, int protoMajor, in
 
 			/* mark this connection is under use */
 			MASTER_CONNECTION(connection_pool)->closetime = 0;
+			cp_list_delete(i);
 			for (j=0;j<NUM_BACKENDS;j++)
 			{
 				connection_pool->info[j].counter++;
@@ -148,27 +218,7 @@ POOL_CONNECTION_POOL *pool_get_cp(char *user, char *database, int protoMajor, in
 						(errmsg("connection closed."),
 							 errdetail("retry to create new connection pool")));
 
-					for (j=0;j<NUM_BACKENDS;j++)
-					{
-						if (!VALID_BACKEND(j) || (CONNECTION_SLOT(connection_pool, j) == NULL))
-							continue;
-
-						if (!freed)
-						{
-							pool_free_startup_packet(CONNECTION_SLOT(connection_pool, j)->sp);
-                            CONNECTION_SLOT(connection_pool, j)->sp = NULL;
-
-							freed = 1;
-						}
-
-						pool_close(CONNECTION(connection_pool, j));
-						pfree(CONNECTION_SLOT(connection_pool, j));
-					}
-					info = connection_pool->info;
-					memset(connection_pool, 0, sizeof(POOL_CONNECTION_POOL));
-					connection_pool->info = info;
-					info->swallow_termination = 0;
-					memset(connection_pool->info, 0, sizeof(ConnectionInfo) * MAX_NUM_BACKENDS);
+					pool_release_cp(connection_pool);
 					POOL_SETMASK(&oldmask);
 					return NULL;
 				}
@@ -177,7 +227,6 @@ POOL_CONNECTION_POOL *pool_get_cp(char *user, char *database, int protoMajor, in
 			pool_index = i;
 			return connection_pool;
 		}
-		connection_pool++;
 	}
 
 	POOL_SETMASK(&oldmask);
@@ -190,8 +239,6 @@ POOL_CONNECTION_POOL *pool_get_cp(char *user, char *database, int protoMajor, in
 void pool_discard_cp(char *user, char *database, int protoMajor)
 {
 	POOL_CONNECTION_POOL *p = pool_get_cp(user, database, protoMajor, 0);
-	ConnectionInfo *info;
-	int i, freed = 0;
 
 	if (p == NULL)
 	{
@@ -200,9 +247,145 @@ void pool_discard_cp(char *user, char *database, int protoMajor)
 		return;
 	}
 
+	pool_release_cp(p);
+}
+
+
+/*
+* create a connection pool by user and database
+*/
+POOL_CONNECTION_POOL *pool_create_cp(StartupPacket *sp)
+{
+	POOL_CONNECTION_POOL *p;
+	int index;
+
+	p = get_free_cp(&index);
+	if (p == NULL)
+		return NULL;
+
+	pool_index = index;
+	p = new_connection(p);
+	if (p)
+		cp_hash_insert(index, sp);
+	return p;
+}
+
+/*
+ * Create a connection pool out of backend connections handed over by the
+ * global connection pool manager.  Returns NULL if the manager has no
+ * connection for the startup packet.
+ */
+POOL_CONNECTION_POOL *pool_create_cp_from_global_pool(StartupPacket *sp)
+{
+	POOL_CONNECTION_POOL *p;
+	int index;
+
+	p = get_free_cp(&index);
+	if (p == NULL)
+		return NULL;
+
+	if (!pool_global_pool_get(p, sp))
+		return NULL;
+
+	pool_index = index;
+	cp_hash_insert(index, sp);
+	return p;
+}
+
+/*
+ * Look for a connection pool which is not used by any session of this
+ * process and whose startup packet is identical to "sp", and mark it in
+ * use.  Pools whose sockets turned out to be broken are discarded.
+ * Used in transaction pooling mode by a session which gave its backend
+ * connection back to the pool.  Returns NULL if there's none.
+ */
+POOL_CONNECTION_POOL *pool_get_idle_cp(StartupPacket *sp)
+{
+	POOL_CONNECTION_POOL *p;
+	uint32 hashkey = cp_hash(sp->user, sp->database, sp->major);
+	int i, j, next;
+
+	for (i=cp_buckets[hashkey & (cp_nbuckets - 1)];i>=0;i=next)
+	{
+		p = &pool_connection_pool[i];
+		next = cp_index[i].hash_next;
+
+		if (cp_index[i].hashkey != hashkey ||
+			!MASTER_CONNECTION(p) || POOL_CP_IN_USE(p) || !MASTER_CONNECTION(p)->sp)
+			continue;
+
+		if (MASTER_CONNECTION(p)->sp->len != sp->len ||
+			memcmp(MASTER_CONNECTION(p)->sp->startup_packet, sp->startup_packet, sp->len) != 0)
+			continue;
+
+		for (j=0;j<NUM_BACKENDS;j++)
+		{
+			if (!VALID_BACKEND(j))
+				continue;
+
+			if (!CONNECTION_SLOT(p, j) || check_socket_status(CONNECTION(p, j)->fd) < 0)
+				break;
+		}
+
+		if (j < NUM_BACKENDS)
+		{
+			ereport(LOG,
+				(errmsg("connection closed."),
+					 errdetail("discarding idle connection pool of user: \"%s\" database: \"%s\"",
+							   sp->user, sp->database)));
+			pool_release_cp(p);
+			continue;
+		}
+
+		MASTER_CONNECTION(p)->closetime = 0;
+		cp_list_delete(i);
+		for (j=0;j<NUM_BACKENDS;j++)
+			p->info[j].counter++;
+
+		pool_index = i;
+		return p;
+	}
+
+	return NULL;
+}
+
+/*
+ * Return true if a connection pool whose startup packet is identical to
+ * "sp" exists, whether it is used by a session or not.
+ */
+bool pool_cp_exists(StartupPacket *sp)
+{
+	POOL_CONNECTION_POOL *p;
+	uint32 hashkey = cp_hash(sp->user, sp->database, sp->major);
+	int i;
+
+	for (i=cp_buckets[hashkey & (cp_nbuckets - 1)];i>=0;i=cp_index[i].hash_next)
+	{
+		p = &pool_connection_pool[i];
+		if (cp_index[i].hashkey == hashkey &&
+			MASTER_CONNECTION(p) && MASTER_CONNECTION(p)->sp &&
+			MASTER_CONNECTION(p)->sp->len == sp->len &&
+			memcmp(MASTER_CONNECTION(p)->sp->startup_packet, sp->startup_packet, sp->len) == 0)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Close the backend connections of a connection pool and make the pool
+ * empty.  Terminate message is not sent to the backends, so this is also
+ * used after the connections have been handed over to the global
+ * connection pool manager.
+ */
+void pool_release_cp(POOL_CONNECTION_POOL *p)
+{
+	ConnectionInfo *info;
+	int i, freed = 0;
+	int index = p - pool_connection_pool;
+
 	for (i=0;i<NUM_BACKENDS;i++)
 	{
-		if (!VALID_BACKEND(i))
+		if (!VALID_BACKEND(i) || CONNECTION_SLOT(p, i) == NULL)
 			continue;
 
 		if (!freed)
@@ -210,7 +393,7 @@ void pool_discard_cp(char *user, char *database, int protoMajor)
 			pool_free_startup_packet(CONNECTION_SLOT(p, i)->sp);
 			freed = 1;
 		}
-        CONNECTION_SLOT(p, i)->sp = NULL;
+		CONNECTION_SLOT(p, i)->sp = NULL;
 		pool_close(CONNECTION(p, i));
 		pfree(CONNECTION_SLOT(p, i));
 	}
@@ -219,19 +402,23 @@ void pool_discard_cp(char *user, char *database, int protoMajor)
 	memset(p, 0, sizeof(POOL_CONNECTION_POOL));
 	p->info = info;
 	memset(p->info, 0, sizeof(ConnectionInfo) * MAX_NUM_BACKENDS);
-}
 
+	cp_hash_delete(index);
+	cp_list_delete(index);
+	cp_list_append(&cp_free_list, 'F', index);
+}
 
 /*
-* create a connection pool by user and database
-*/
-POOL_CONNECTION_POOL *pool_create_cp(void)
+ * Find an empty connection pool.  If there's none, discard the least
+ * recently used one.  Connections used by other sessions of this process
+ * cannot be discarded.  The index of the pool is returned in *index.
+ * Returns NULL if all the pools are in use.
+ */
+static POOL_CONNECTION_POOL *get_free_cp(int *index)
 {
-	int i, freed = 0;
+	int i;
 	time_t closetime;
 	POOL_CONNECTION_POOL *oldestp;
-	POOL_CONNECTION_POOL *ret;
-	ConnectionInfo *info;
 
 	POOL_CONNECTION_POOL *p = pool_connection_pool;
     /* if no connection pool exists we have no reason to live */
@@ -241,46 +428,47 @@ POOL_CONNECTION_POOL *pool_create_cp(void)
 				 errmsg("unable to create connection"),
 					errdetail("connection pool is not initialized")));
 
-	for (i=0;i<pool_config->max_pool;i++)
+	if (cp_free_list.head >= 0)
 	{
-		if (MASTER_CONNECTION(p) == NULL)
-		{
-			ret = new_connection(p);
-			if (ret)
-				pool_index = i;
-			return ret;
-		}
-		p++;
+		*index = cp_free_list.head;
+		return &pool_connection_pool[*index];
 	}
+
 	ereport(DEBUG1,
 		(errmsg("creating connection pool"),
 			 errdetail("no empty connection slot was found")));
 
 	/*
-	 * no empty connection slot was found. look for the oldest connection and discard it.
+	 * no empty connection slot was found. discard the least recently used
+	 * connection.
 	 */
-	oldestp = p = pool_connection_pool;
-	closetime = MASTER_CONNECTION(p)->closetime;
-	pool_index = 0;
-
-	for (i=0;i<pool_config->max_pool;i++)
+	oldestp = NULL;
+	if (cp_lru_list.head >= 0)
 	{
-		ereport(DEBUG1,
-			(errmsg("creating connection pool"),
-				errdetail("user: %s database: %s closetime: %ld",
-					   MASTER_CONNECTION(p)->sp->user,
-					   MASTER_CONNECTION(p)->sp->database,
-					   MASTER_CONNECTION(p)->closetime)));
-
-		if (MASTER_CONNECTION(p)->closetime < closetime)
+		*index = cp_lru_list.head;
+		oldestp = &pool_connection_pool[*index];
+	}
+	else if (pool_config->max_sessions_per_child <= 1)
+	{
+		/*
+		 * A connection left in use by a session which failed halfway.
+		 * Discard the oldest one as we always did.
+		 */
+		closetime = 0;
+		for (i=0;i<pool_config->max_pool;i++, p++)
 		{
-			closetime = MASTER_CONNECTION(p)->closetime;
-			oldestp = p;
-			pool_index = i;
+			if (oldestp == NULL || MASTER_CONNECTION(p)->closetime < closetime)
+			{
+				closetime = MASTER_CONNECTION(p)->closetime;
+				oldestp = p;
+				*index = i;
+			}
 		}
-		p++;
 	}
 
+	if (oldestp == NULL)
+		return NULL;
+
 	p = oldestp;
 	pool_send_frontend_exits(p);
 
@@ -291,30 +479,9 @@ POOL_CONNECTION_POOL *pool_create_cp(void)
 				   MASTER_CONNECTION(p)->sp->user,
 				   MASTER_CONNECTION(p)->sp->database)));
 
-	for (i=0;i<NUM_BACKENDS;i++)
-	{
-		if (!VALID_BACKEND(i))
-			continue;
-
-		if (!freed)
-		{
-			pool_free_startup_packet(CONNECTION_SLOT(p, i)->sp);
-            CONNECTION_SLOT(p, i)->sp = NULL;
-
-			freed = 1;
-		}
-
-		pool_close(CONNECTION(p, i));
-		pfree(CONNECTION_SLOT(p, i));
-	}
-
-	info = p->info;
-	memset(p, 0, sizeof(POOL_CONNECTION_POOL));
-	p->info = info;
-	memset(p->info, 0, sizeof(ConnectionInfo) * MAX_NUM_BACKENDS);
+	pool_release_cp(p);
 
-	ret = new_connection(p);
-	return ret;
+	return p;
 }
 
 /*
@@ -322,8 +489,7 @@ POOL_CONNECTION_POOL *pool_create_cp(void)
  */
 void pool_connection_pool_timer(POOL_CONNECTION_POOL *backend)
 {
-	POOL_CONNECTION_POOL *p = pool_connection_pool;
-	int i;
+	int index = backend - pool_connection_pool;
 
 	ereport(DEBUG1,
 		(errmsg("setting backend connection close timer"),
@@ -331,22 +497,16 @@ void pool_connection_pool_timer(POOL_CONNECTION_POOL *backend)
 
 	MASTER_CONNECTION(backend)->closetime = time(NULL);		/* set connection close time */
 
+	/* the pool is now the most recently used idle one */
+	cp_list_delete(index);
+	cp_list_append(&cp_lru_list, 'L', index);
+
 	if (pool_config->connection_life_time == 0)
 		return;
 
-	/* look for any other timeout */
-	for (i=0;i<pool_config->max_pool;i++, p++)
-	{
-		if (!MASTER_CONNECTION(p))
-			continue;
-		if (!MASTER_CONNECTION(p)->sp)
-			continue;
-		if (MASTER_CONNECTION(p)->sp->user == NULL)
-			continue;
-
-		if (p != backend && MASTER_CONNECTION(p)->closetime)
-			return;
-	}
+	/* other idle pool has set the timer already */
+	if (cp_lru_list.head != index)
+		return;
 
 	/* no other timer found. set my timer */
 	ereport(DEBUG1,
@@ -366,13 +526,8 @@ RETSIGTYPE pool_backend_timer_handler(int sig)
 
 void pool_backend_timer(void)
 {
-#define TMINTMAX 0x7fffffff
-
-	POOL_CONNECTION_POOL *p = pool_connection_pool;
-	int i, j;
+	POOL_CONNECTION_POOL *p;
 	time_t now;
-	time_t nearest = TMINTMAX;
-	ConnectionInfo *info;
 
 	POOL_SETMASK(&BlockSig);
 
@@ -381,66 +536,38 @@ void pool_backend_timer(void)
 	ereport(DEBUG1,
 		(errmsg("backend timer handler called at%ld", now)));
 
-	for (i=0;i<pool_config->max_pool;i++, p++)
+	/*
+	 * Idle connections are in the order of their close time.  Discard
+	 * the expired ones from the head.
+	 */
+	while (cp_lru_list.head >= 0)
 	{
-		if (!MASTER_CONNECTION(p))
-			continue;
-		if (!MASTER_CONNECTION(p)->sp)
-			continue;
-		if (MASTER_CONNECTION(p)->sp->user == NULL)
-			continue;
-
-		/* timer expire? */
-		if (MASTER_CONNECTION(p)->closetime)
-		{
-			int freed = 0;
+		p = &pool_connection_pool[cp_lru_list.head];
 
-			ereport(DEBUG1,
-				(errmsg("backend timer handler called"),
-					errdetail("expire time: %ld",
-						   MASTER_CONNECTION(p)->closetime+pool_config->connection_life_time)));
-
-			if (now >= (MASTER_CONNECTION(p)->closetime+pool_config->connection_life_time))
-			{
-				/* discard expired connection */
-				ereport(DEBUG1,
-					(errmsg("backend timer handler called"),
-						errdetail("expired user: \"%s\" database: \"%s\"",
-							   MASTER_CONNECTION(p)->sp->user, MASTER_CONNECTION(p)->sp->database)));
-				pool_send_frontend_exits(p);
+		ereport(DEBUG1,
+			(errmsg("backend timer handler called"),
+				errdetail("expire time: %ld",
+					   MASTER_CONNECTION(p)->closetime+pool_config->connection_life_time)));
 
-				for (j=0;j<NUM_BACKENDS;j++)
-				{
-					if (!VALID_BACKEND(j))
-						continue;
+		if (now < (MASTER_CONNECTION(p)->closetime+pool_config->connection_life_time))
+			break;
 
-					if (!freed)
-					{
-						pool_free_startup_packet(CONNECTION_SLOT(p, j)->sp);
-						freed = 1;
-					}
-                    CONNECTION_SLOT(p, j)->sp = NULL;
-					pool_close(CONNECTION(p, j));
-					pfree(CONNECTION_SLOT(p, j));
-				}
-				info = p->info;
-				memset(p, 0, sizeof(POOL_CONNECTION_POOL));
-				p->info = info;
-				memset(p->info, 0, sizeof(ConnectionInfo) * MAX_NUM_BACKENDS);
-			}
-			else
-			{
-				/* look for nearest timer */
-				if (MASTER_CONNECTION(p)->closetime < nearest)
-					nearest = MASTER_CONNECTION(p)->closetime;
-			}
-		}
+		/* discard expired connection */
+		ereport(DEBUG1,
+			(errmsg("backend timer handler called"),
+				errdetail("expired user: \"%s\" database: \"%s\"",
+					   MASTER_CONNECTION(p)->sp->user, MASTER_CONNECTION(p)->sp->database)));
+		pool_send_frontend_exits(p);
+		pool_release_cp(p);
 	}
 
 	/* any remaining timer */
-	if (nearest != TMINTMAX)
+	if (cp_lru_list.head >= 0)
 	{
-		nearest = pool_config->connection_life_time - (now - nearest);
+		time_t nearest;
+
+		p = &pool_connection_pool[cp_lru_list.head];
+		nearest = pool_config->connection_life_time - (now - MASTER_CONNECTION(p)->closetime);
 		if (nearest <= 0)
 		  nearest = 1;
 		pool_alarm(pool_backend_timer_handler, nearest);
@@ -927,6 +1054,104 @@ static POOL_CONNECTION_POOL *new_connection(POOL_CONNECTION_POOL *p)
 	return NULL;
 }
 
+/*
+ * Hash value of the key of connection pools (FNV-1a)
+ */
+static uint32 cp_hash(char *user, char *database, int protoMajor)
+{
+	uint32 h = 2166136261U;
+	unsigned char *c;
+
+	for (c = (unsigned char *)user; *c; c++)
+		h = (h ^ *c) * 16777619U;
+	h = (h ^ '\0') * 16777619U;	/* separate user from database */
+	for (c = (unsigned char *)database; *c; c++)
+		h = (h ^ *c) * 16777619U;
+	return (h ^ protoMajor) * 16777619U;
+}
+
+/*
+ * Add a connection pool which has got backend connections to the hash
+ * index.
+ */
+static void cp_hash_insert(int index, StartupPacket *sp)
+{
+	uint32 bucket;
+
+	cp_hash_delete(index);
+	cp_list_delete(index);
+
+	cp_index[index].hashkey = cp_hash(sp->user, sp->database, sp->major);
+	bucket = cp_index[index].hashkey & (cp_nbuckets - 1);
+	cp_index[index].hash_next = cp_buckets[bucket];
+	cp_buckets[bucket] = index;
+	cp_index[index].hashed = true;
+}
+
+/*
+ * Remove a connection pool from the hash index.
+ */
+static void cp_hash_delete(int index)
+{
+	int *walk;
+
+	if (!cp_index[index].hashed)
+		return;
+
+	for (walk = &cp_buckets[cp_index[index].hashkey & (cp_nbuckets - 1)];
+		 *walk >= 0; walk = &cp_index[*walk].hash_next)
+	{
+		if (*walk == index)
+		{
+			*walk = cp_index[index].hash_next;
+			break;
+		}
+	}
+	cp_index[index].hash_next = -1;
+	cp_index[index].hashed = false;
+}
+
+/*
+ * Append a connection pool to the free list or LRU list.
+ */
+static void cp_list_append(POOL_CP_LIST *list, char kind, int index)
+{
+	cp_index[index].list = kind;
+	cp_index[index].list_prev = list->tail;
+	cp_index[index].list_next = -1;
+	if (list->tail >= 0)
+		cp_index[list->tail].list_next = index;
+	else
+		list->head = index;
+	list->tail = index;
+}
+
+/*
+ * Remove a connection pool from the list it is in, if any.
+ */
+static void cp_list_delete(int index)
+{
+	POOL_CP_LIST *list;
+	POOL_CP_INDEX *e = &cp_index[index];
+
+	if (e->list == '\0')
+		return;
+
+	list = e->list == 'F' ? &cp_free_list : &cp_lru_list;
+
+	if (e->list_prev >= 0)
+		cp_index[e->list_prev].list_next = e->list_next;
+	else
+		list->head = e->list_next;
+	if (e->list_next >= 0)
+		cp_index[e->list_next].list_prev = e->list_prev;
+	else
+		list->tail = e->list_prev;
+
+	e->list = '\0';
+	e->list_prev = e->list_next = -1;
+}
+
 /* check_socket_status()
  * RETURN: 0 => OK
  *        -1 => broken socket.
@@ -965,3 +1190,33 @@ int pool_pool_index(void)
 {
 	return pool_index;
 }
+
+/*
+ * Set current used index. -1 means the session does not own any
+ * connection pool yet.  Used by a child process multiplexing client
+ * sessions when it switches sessions.
+ */
+void pool_set_pool_index(int index)
+{
+	pool_index = index;
+}
+
+/*
+ * Discard the connection pool of current session if it is not released
+ * yet.  Called when the session failed before it got the connection pool
+ * handed over to it, e.g. authentication failed.
+ */
+void pool_discard_current_cp(void)
+{
+	POOL_CONNECTION_POOL *p;
+
+	if (pool_connection_pool == NULL || pool_index < 0 || pool_index >= pool_config->max_pool)
+		return;
+
+	p = &pool_connection_pool[pool_index];
+	if (!POOL_CP_IN_USE(p) || !MASTER_CONNECTION(p)->sp)
+		return;
+
+	pool_discard_cp(MASTER_CONNECTION(p)->sp->user, MASTER_CONNECTION(p)->sp->database,
+					MASTER_CONNECTION(p)->sp->major);
+}
@@ -0,0 +1,1015 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2017	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_global_pool.c: connection pool shared by child processes
+ *
+ * The global connection pool manager process keeps idle, already
+ * authenticated backend connections which child processes returned at
+ * the end of client sessions.  A child process which cannot find a
+ * connection in its own connection pool asks the manager for one before
+ * connecting to backends.  Backend sockets are passed over a UNIX domain
+ * socket using SCM_RIGHTS, along with the data needed to reuse them,
+ * i.e. authentication data, cancel key and parameter status.
+ */
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <netdb.h>
+
+#include "pool.h"
+#include "pool_config.h"
+#include "utils/pool_stream.h"
+#include "utils/palloc.h"
+#include "utils/memutils.h"
+#include "utils/elog.h"
+#include "utils/pool_signal.h"
+#include "parser/stringinfo.h"
+#include "context/pool_process_context.h"
+
+/* message kinds */
+#define GP_GET			'G'		/* child asks for a connection */
+#define GP_PUT			'P'		/* child returns a connection */
+#define GP_FOUND		'F'		/* manager hands over a connection */
+#define GP_NOT_FOUND	'N'		/* manager has no connection */
+
+#define GP_TIMEOUT		1		/* seconds to wait for the peer */
+#define GP_MAX_DATA_LEN	(1024 * 1024)	/* sanity limit of connection data */
+
+/*
+ * Message exchanged between child processes and the manager.  Followed
+ * by sp_len bytes of startup packet and data_len bytes of connection
+ * data.  nfds backend sockets are passed along with the message.
+ */
+typedef struct
+{
+	char		kind;
+	char		nodes[MAX_NUM_BACKENDS];	/* non 0 if the node is connected */
+	int			nfds;
+	int			sp_len;
+	int			data_len;
+} GlobalPoolMessage;
+
+/*
+ * Per backend connection data, in the order of node id.  Followed by
+ * num_params pairs of null terminated parameter name and value.
+ */
+typedef struct
+{
+	int			pid;
+	int			key;
+	time_t		create_time;
+	int			auth_kind;
+	int			pwd_size;
+	char		password[MAX_PASSWORD_SIZE];
+	char		salt[4];
+	char		tstate;
+	int			num_params;
+} GlobalPoolSlotData;
+
+/* idle connection kept by the manager */
+typedef struct
+{
+	bool		used;
+	char		nodes[MAX_NUM_BACKENDS];
+	int			fds[MAX_NUM_BACKENDS];
+	int			nfds;
+	char	   *sp;
+	int			sp_len;
+	char	   *data;
+	int			data_len;
+	time_t		pooled_time;
+} GlobalPoolEntry;
+
+static GlobalPoolEntry *entries;
+static volatile sig_atomic_t shutdown_request = 0;
+static volatile sig_atomic_t discard_request = 0;
+static volatile sig_atomic_t reload_config_request = 0;
+
+static int gp_connect(void);
+static bool gp_peer_is_trusted(int sock);
+static bool gp_send(int sock, GlobalPoolMessage *msg, char *sp, char *data, int *fds);
+static bool gp_recv(int sock, GlobalPoolMessage *msg, char **sp, char **data, int *fds);
+static bool gp_read(int sock, char *buf, int len);
+static void gp_set_timeout(int sock);
+static void gp_close_fds(int *fds, int nfds);
+static void handle_request(int sock);
+static GlobalPoolEntry *find_entry(GlobalPoolMessage *msg, char *sp);
+static void store_entry(GlobalPoolMessage *msg, char *sp, char *data, int *fds);
+static void discard_entry(GlobalPoolEntry *e, bool terminate);
+static void discard_expired_entries(void);
+static bool entry_nodes_valid(char *nodes);
+static RETSIGTYPE my_signal_handler(int sig);
+static RETSIGTYPE reload_config_handler(int sig);
+static void reload_config(void);
+
+/*
+ * Get the path of the UNIX domain socket of the manager.
+ */
+void pool_global_pool_socket_path(char *path, int len)
+{
+	snprintf(path, len, "%s/.s.PGPOOL_GLOBAL_POOL.%d",
+			 pool_config->socket_dir, pool_config->port);
+}
+
+/*
+ * Ask the manager for backend connections matching the startup
+ * packet.  If found, the slots of the connection pool "p" are filled and
+ * true is returned.  The startup packet of the slots is left NULL.
+ */
+bool pool_global_pool_get(POOL_CONNECTION_POOL *p, StartupPacket *sp)
+{
+	GlobalPoolMessage msg;
+	GlobalPoolMessage reply;
+	GlobalPoolSlotData d;
+	MemoryContext oldContext;
+	int fds[MAX_NUM_BACKENDS];
+	char *data;
+	char *cp;
+	char *end;
+	int sock;
+	int nfds = 0;
+	int i, j, n;
+	bool ok;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.kind = GP_GET;
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		if (VALID_BACKEND(i))
+		{
+			msg.nodes[i] = 1;
+			nfds++;
+		}
+	}
+	msg.sp_len = sp->len;
+
+	sock = gp_connect();
+	if (sock < 0)
+		return false;
+
+	ok = gp_send(sock, &msg, sp->startup_packet, NULL, NULL) &&
+		gp_recv(sock, &reply, NULL, &data, fds);
+	close(sock);
+
+	if (!ok)
+		return false;
+
+	if (reply.kind != GP_FOUND)
+	{
+		ereport(DEBUG1,
+				(errmsg("no connection found in global connection pool"),
+				 errdetail("user: \"%s\" database: \"%s\"", sp->user, sp->database)));
+		return false;
+	}
+
+	if (reply.nfds != nfds || memcmp(reply.nodes, msg.nodes, sizeof(msg.nodes)) != 0)
+	{
+		ereport(LOG,
+				(errmsg("discarding connection from global connection pool"),
+				 errdetail("backend nodes do not match")));
+		gp_close_fds(fds, reply.nfds);
+		return false;
+	}
+
+	/* verify the connection data before using it */
+	cp = data;
+	end = data + reply.data_len;
+	for (n = 0; n < nfds && cp + sizeof(d) <= end; n++)
+	{
+		memcpy(&d, cp, sizeof(d));
+		cp += sizeof(d);
+		for (j = 0; j < d.num_params * 2 && cp < end; j++)
+			cp += strnlen(cp, end - cp) + 1;
+		if (j < d.num_params * 2)
+			break;
+	}
+
+	if (n != nfds || cp != end)
+	{
+		ereport(LOG,
+				(errmsg("discarding connection from global connection pool"),
+				 errdetail("broken connection data")));
+		gp_close_fds(fds, nfds);
+		return false;
+	}
+
+	oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+	cp = data;
+	n = 0;
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		POOL_CONNECTION_POOL_SLOT *s;
+
+		if (!msg.nodes[i])
+			continue;
+
+		memcpy(&d, cp, sizeof(d));
+		cp += sizeof(d);
+
+		s = palloc0(sizeof(POOL_CONNECTION_POOL_SLOT));
+		s->con = pool_open(fds[n++], true);
+		s->pid = d.pid;
+		s->key = d.key;
+		s->closetime = 0;
+		s->sp = NULL;
+
+		pool_set_db_node_id(s->con, i);
+		s->con->isbackend = 1;
+		s->con->auth_kind = d.auth_kind;
+		s->con->pwd_size = d.pwd_size;
+		memcpy(s->con->password, d.password, sizeof(d.password));
+		memcpy(s->con->salt, d.salt, sizeof(d.salt));
+		s->con->tstate = d.tstate;
+
+		pool_init_params(&s->con->params);
+		for (j = 0; j < d.num_params; j++)
+		{
+			char *name = cp;
+			char *value = name + strlen(name) + 1;
+
+			cp = value + strlen(value) + 1;
+			pool_add_param(&s->con->params, name, value);
+		}
+
+		p->slots[i] = s;
+
+		p->info[i].pid = d.pid;
+		p->info[i].key = d.key;
+		p->info[i].major = sp->major;
+		p->info[i].minor = sp->minor;
+		strlcpy(p->info[i].database, sp->database, sizeof(p->info[i].database));
+		strlcpy(p->info[i].user, sp->user, sizeof(p->info[i].user));
+		p->info[i].counter = 1;
+		p->info[i].create_time = d.create_time;
+		p->info[i].swallow_termination = 0;
+		s->con->con_info = &p->info[i];
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	ereport(DEBUG1,
+			(errmsg("reusing connection from global connection pool"),
+			 errdetail("user: \"%s\" database: \"%s\"", sp->user, sp->database)));
+	return true;
+}
+
+/*
+ * Hand over backend connections of the connection pool to the manager.
+ * If true is returned, the caller must release the connection pool
+ * without terminating the backend connections.
+ */
+bool pool_global_pool_put(POOL_CONNECTION_POOL *p)
+{
+	GlobalPoolMessage msg;
+	GlobalPoolSlotData d;
+	StringInfo data;
+	int fds[MAX_NUM_BACKENDS];
+	int sock;
+	int i, j;
+	bool ok;
+
+	if (MASTER_CONNECTION(p) == NULL || MASTER_CONNECTION(p)->sp == NULL)
+		return false;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.kind = GP_PUT;
+	data = makeStringInfo();
+
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		POOL_CONNECTION *con;
+
+		if (!VALID_BACKEND(i))
+			continue;
+
+		con = CONNECTION(p, i);
+
+		/*
+		 * SSL state cannot be handed over.  Also the connection must not
+		 * have any pending data.
+		 */
+		if (con->ssl_active > 0 || con->len > 0 || con->wqlen > 0)
+			return false;
+
+		memset(&d, 0, sizeof(d));
+		d.pid = CONNECTION_SLOT(p, i)->pid;
+		d.key = CONNECTION_SLOT(p, i)->key;
+		d.create_time = p->info[i].create_time;
+		d.auth_kind = con->auth_kind;
+		d.pwd_size = con->pwd_size;
+		memcpy(d.password, con->password, sizeof(d.password));
+		memcpy(d.salt, con->salt, sizeof(d.salt));
+		d.tstate = con->tstate;
+		d.num_params = con->params.num;
+		appendBinaryStringInfo(data, (char *) &d, sizeof(d));
+
+		for (j = 0; j < con->params.num; j++)
+		{
+			appendBinaryStringInfo(data, con->params.names[j], strlen(con->params.names[j]) + 1);
+			appendBinaryStringInfo(data, con->params.values[j], strlen(con->params.values[j]) + 1);
+		}
+
+		msg.nodes[i] = 1;
+		fds[msg.nfds++] = con->fd;
+	}
+
+	if (msg.nfds == 0)
+		return false;
+
+	msg.sp_len = MASTER_CONNECTION(p)->sp->len;
+	msg.data_len = data->len;
+
+	sock = gp_connect();
+	if (sock < 0)
+		return false;
+
+	ok = gp_send(sock, &msg, MASTER_CONNECTION(p)->sp->startup_packet, data->data, fds);
+	close(sock);
+
+	if (ok)
+		ereport(DEBUG1,
+				(errmsg("returned connection to global connection pool"),
+				 errdetail("user: \"%s\" database: \"%s\"",
+						   MASTER_CONNECTION(p)->sp->user, MASTER_CONNECTION(p)->sp->database)));
+	return ok;
+}
+
+/*
+ * global connection pool manager main loop
+ */
+void do_global_pool_manager(int *listen_fd)
+{
+	sigjmp_buf	local_sigjmp_buf;
+	MemoryContext GlobalPoolMemoryContext;
+	struct pollfd pfd;
+
+	ereport(DEBUG1,
+			(errmsg("I am global connection pool manager pid:%d", getpid())));
+
+	/* Identify myself via ps */
+	init_ps_display("", "", "", "");
+	set_ps_display("global connection pool manager", false);
+
+	/* set up signal handlers */
+	signal(SIGALRM, SIG_DFL);
+	signal(SIGTERM, my_signal_handler);
+	signal(SIGINT, my_signal_handler);
+	signal(SIGHUP, reload_config_handler);
+	signal(SIGQUIT, my_signal_handler);
+	signal(SIGCHLD, SIG_IGN);
+	signal(SIGUSR1, my_signal_handler);
+	signal(SIGUSR2, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Create per loop iteration memory context */
+	GlobalPoolMemoryContext = AllocSetContextCreate(TopMemoryContext,
+													"global_pool_main_loop",
+													ALLOCSET_DEFAULT_MINSIZE,
+													ALLOCSET_DEFAULT_INITSIZE,
+													ALLOCSET_DEFAULT_MAXSIZE);
+
+	MemoryContextSwitchTo(TopMemoryContext);
+
+	entries = palloc0(sizeof(GlobalPoolEntry) * pool_config->global_pool_size);
+
+	if (sigsetjmp(local_sigjmp_buf, 1) != 0)
+	{
+		error_context_stack = NULL;
+		EmitErrorReport();
+		MemoryContextSwitchTo(TopMemoryContext);
+		FlushErrorState();
+	}
+	/* We can now handle ereport(ERROR) */
+	PG_exception_stack = &local_sigjmp_buf;
+
+	for (;;)
+	{
+		int sock;
+
+		MemoryContextSwitchTo(GlobalPoolMemoryContext);
+		MemoryContextResetAndDeleteChildren(GlobalPoolMemoryContext);
+
+		if (shutdown_request)
+		{
+			int i;
+
+			for (i = 0; i < pool_config->global_pool_size; i++)
+				discard_entry(&entries[i], true);
+			exit(0);
+		}
+
+		if (reload_config_request)
+			reload_config();
+
+		/* failover or failback happened */
+		if (discard_request)
+		{
+			int i;
+
+			ereport(LOG,
+					(errmsg("discarding all connections in global connection pool")));
+
+			for (i = 0; i < pool_config->global_pool_size; i++)
+				discard_entry(&entries[i], true);
+			discard_request = 0;
+		}
+
+		discard_expired_entries();
+
+		pfd.fd = *listen_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 1000) <= 0)
+			continue;
+
+		sock = accept(*listen_fd, NULL, NULL);
+		if (sock < 0)
+			continue;
+
+		/* Do not pass or take sockets from other users */
+		if (!gp_peer_is_trusted(sock))
+		{
+			close(sock);
+			continue;
+		}
+
+		gp_set_timeout(sock);
+		handle_request(sock);
+		close(sock);
+	}
+}
+
+/*
+ * Process a request from a child process
+ */
+static void handle_request(int sock)
+{
+	GlobalPoolMessage msg;
+	GlobalPoolMessage reply;
+	GlobalPoolEntry *e;
+	int fds[MAX_NUM_BACKENDS];
+	char *sp;
+	char *data;
+
+	if (!gp_recv(sock, &msg, &sp, &data, fds))
+		return;
+
+	switch (msg.kind)
+	{
+		case GP_GET:
+			e = find_entry(&msg, sp);
+
+			memset(&reply, 0, sizeof(reply));
+			if (e == NULL)
+			{
+				reply.kind = GP_NOT_FOUND;
+				gp_send(sock, &reply, NULL, NULL, NULL);
+				break;
+			}
+
+			reply.kind = GP_FOUND;
+			memcpy(reply.nodes, e->nodes, sizeof(reply.nodes));
+			reply.nfds = e->nfds;
+			reply.data_len = e->data_len;
+
+			/*
+			 * The connection belongs to the child process now.  Even if
+			 * sending failed, we cannot tell whether the child process
+			 * received the sockets, so just forget it.
+			 */
+			gp_send(sock, &reply, NULL, e->data, e->fds);
+			discard_entry(e, false);
+			break;
+
+		case GP_PUT:
+			if (msg.nfds > 0)
+				store_entry(&msg, sp, data, fds);
+			break;
+
+		default:
+			ereport(LOG,
+					(errmsg("invalid request to global connection pool manager"),
+					 errdetail("unknown message kind '%c'", msg.kind)));
+			gp_close_fds(fds, msg.nfds);
+			break;
+	}
+}
+
+/*
+ * Find an idle connection matching the request.  The most recently
+ * returned one is preferred.  Connections whose sockets turned out to be
+ * closed are discarded.
+ */
+static GlobalPoolEntry *find_entry(GlobalPoolMessage *msg, char *sp)
+{
+	for (;;)
+	{
+		GlobalPoolEntry *e = NULL;
+		struct pollfd pfds[MAX_NUM_BACKENDS];
+		int i;
+
+		for (i = 0; i < pool_config->global_pool_size; i++)
+		{
+			if (!entries[i].used ||
+				entries[i].sp_len != msg->sp_len ||
+				memcmp(entries[i].nodes, msg->nodes, sizeof(msg->nodes)) != 0 ||
+				memcmp(entries[i].sp, sp, msg->sp_len) != 0)
+				continue;
+
+			if (e == NULL || entries[i].pooled_time > e->pooled_time)
+				e = &entries[i];
+		}
+
+		if (e == NULL)
+			return NULL;
+
+		/* idle backends do not send anything unless they are closing */
+		for (i = 0; i < e->nfds; i++)
+		{
+			pfds[i].fd = e->fds[i];
+			pfds[i].events = POLLIN;
+			pfds[i].revents = 0;
+		}
+
+		if (poll(pfds, e->nfds, 0) == 0 && entry_nodes_valid(e->nodes))
+			return e;
+
+		ereport(DEBUG1,
+				(errmsg("discarding closed connection in global connection pool")));
+		discard_entry(e, false);
+	}
+}
+
+/*
+ * Keep connections returned by a child process.  If the pool is full,
+ * the oldest one is discarded.
+ */
+static void store_entry(GlobalPoolMessage *msg, char *sp, char *data, int *fds)
+{
+	GlobalPoolEntry *e = NULL;
+	int i;
+
+	if (!entry_nodes_valid(msg->nodes))
+	{
+		gp_close_fds(fds, msg->nfds);
+		return;
+	}
+
+	for (i = 0; i < pool_config->global_pool_size; i++)
+	{
+		if (!entries[i].used)
+		{
+			e = &entries[i];
+			break;
+		}
+
+		if (e == NULL || entries[i].pooled_time < e->pooled_time)
+			e = &entries[i];
+	}
+
+	if (e->used)
+	{
+		ereport(DEBUG1,
+				(errmsg("global connection pool is full"),
+				 errdetail("discarding the oldest connection")));
+		discard_entry(e, true);
+	}
+
+	e->used = true;
+	memcpy(e->nodes, msg->nodes, sizeof(e->nodes));
+	memcpy(e->fds, fds, sizeof(int) * msg->nfds);
+	e->nfds = msg->nfds;
+	e->sp = MemoryContextAlloc(TopMemoryContext, msg->sp_len);
+	memcpy(e->sp, sp, msg->sp_len);
+	e->sp_len = msg->sp_len;
+	e->data = MemoryContextAlloc(TopMemoryContext, Max(msg->data_len, 1));
+	memcpy(e->data, data, msg->data_len);
+	e->data_len = msg->data_len;
+	e->pooled_time = time(NULL);
+}
+
+/*
+ * Forget an idle connection.  If terminate is true, Terminate message is
+ * sent to the backends before closing the sockets.
+ */
+static void discard_entry(GlobalPoolEntry *e, bool terminate)
+{
+	int i;
+
+	if (!e->used)
+		return;
+
+	for (i = 0; i < e->nfds; i++)
+	{
+		if (terminate)
+		{
+			static char terminate_message[] = {'X', 0, 0, 0, 4};
+
+			if (write(e->fds[i], terminate_message, sizeof(terminate_message)) < 0)
+				ereport(DEBUG1,
+						(errmsg("failed to send terminate message to backend"),
+						 errdetail("%s", strerror(errno))));
+		}
+		close(e->fds[i]);
+	}
+
+	pfree(e->sp);
+	pfree(e->data);
+	memset(e, 0, sizeof(*e));
+}
+
+/*
+ * Discard connections which have been idle longer than
+ * connection_life_time.
+ */
+static void discard_expired_entries(void)
+{
+	time_t now;
+	int i;
+
+	if (pool_config->connection_life_time <= 0)
+		return;
+
+	now = time(NULL);
+	for (i = 0; i < pool_config->global_pool_size; i++)
+	{
+		if (entries[i].used &&
+			now >= entries[i].pooled_time + pool_config->connection_life_time)
+			discard_entry(&entries[i], true);
+	}
+}
+
+/*
+ * Return true if all the backend nodes of the connection are still
+ * alive.
+ */
+static bool entry_nodes_valid(char *nodes)
+{
+	int i;
+
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		if (nodes[i] &&
+			BACKEND_INFO(i).backend_status != CON_UP &&
+			BACKEND_INFO(i).backend_status != CON_CONNECT_WAIT)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Connect to the manager.  Returns -1 on failure.
+ */
+static int gp_connect(void)
+{
+	struct sockaddr_un addr;
+	int sock;
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	pool_global_pool_socket_path(addr.sun_path, sizeof(addr.sun_path));
+
+	gp_set_timeout(sock);
+
+	if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+	{
+		ereport(DEBUG1,
+				(errmsg("failed to connect to global connection pool manager"),
+				 errdetail("connect() failed with error \"%s\"", strerror(errno))));
+		close(sock);
+		return -1;
+	}
+
+	/* Make sure that the socket is not bound by somebody else */
+	if (!gp_peer_is_trusted(sock))
+	{
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/*
+ * Returns true if the peer of the socket runs as the same user as us.
+ * Backend connections are passed over the socket, so they must not go to
+ * or come from other users.  If the platform cannot tell the peer, we rely
+ * on the permission of the socket file, which only allows our user.
+ */
+static bool gp_peer_is_trusted(int sock)
+{
+	uid_t uid;
+#if defined(SO_PEERCRED)
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+		len != sizeof(cred))
+	{
+		ereport(LOG,
+				(errmsg("failed to get peer credentials of global connection pool socket"),
+				 errdetail("getsockopt() failed with error \"%s\"", strerror(errno))));
+		return false;
+	}
+	uid = cred.uid;
+#elif defined(HAVE_GETPEEREID)
+	gid_t gid;
+
+	if (getpeereid(sock, &uid, &gid) < 0)
+	{
+		ereport(LOG,
+				(errmsg("failed to get peer credentials of global connection pool socket"),
+				 errdetail("getpeereid() failed with error \"%s\"", strerror(errno))));
+		return false;
+	}
+#else
+	return true;
+#endif
+
+	if (uid != geteuid())
+	{
+		ereport(LOG,
+				(errmsg("rejected connection on global connection pool socket"),
+				 errdetail("peer user id %d is not ours (%d)", (int) uid, (int) geteuid())));
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Do not let a stuck peer block us forever.
+ */
+static void gp_set_timeout(int sock)
+{
+	struct timeval tv = {GP_TIMEOUT, 0};
+
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/*
+ * Send a message along with msg->nfds sockets.
+ */
+static bool gp_send(int sock, GlobalPoolMessage *msg, char *sp, char *data, int *fds)
+{
+	union
+	{
+		struct cmsghdr cmsg;
+		char		buf[CMSG_SPACE(sizeof(int) * MAX_NUM_BACKENDS)];
+	} cbuf;
+	struct msghdr mh;
+	struct iovec iov;
+	char *buf;
+	int len;
+	int sent;
+
+	len = sizeof(*msg) + msg->sp_len + msg->data_len;
+	buf = palloc(len);
+	memcpy(buf, msg, sizeof(*msg));
+	if (msg->sp_len > 0)
+		memcpy(buf + sizeof(*msg), sp, msg->sp_len);
+	if (msg->data_len > 0)
+		memcpy(buf + sizeof(*msg) + msg->sp_len, data, msg->data_len);
+
+	memset(&mh, 0, sizeof(mh));
+	if (msg->nfds > 0)
+	{
+		struct cmsghdr *cmsg;
+
+		mh.msg_control = cbuf.buf;
+		mh.msg_controllen = CMSG_SPACE(sizeof(int) * msg->nfds);
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * msg->nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * msg->nfds);
+	}
+
+	for (sent = 0; sent < len;)
+	{
+		ssize_t n;
+
+		iov.iov_base = buf + sent;
+		iov.iov_len = len - sent;
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+
+		n = sendmsg(sock, &mh, 0);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			ereport(DEBUG1,
+					(errmsg("failed to send message to global connection pool"),
+					 errdetail("sendmsg() failed with error \"%s\"", strerror(errno))));
+			pfree(buf);
+			return false;
+		}
+		sent += n;
+
+		/* the sockets have gone with the first byte */
+		mh.msg_control = NULL;
+		mh.msg_controllen = 0;
+	}
+
+	pfree(buf);
+	return true;
+}
+
+/*
+ * Receive a message and sockets sent by gp_send().  The startup packet
+ * and the connection data are palloc'd.  If sp is NULL, the message must
+ * not contain a startup packet.
+ */
+static bool gp_recv(int sock, GlobalPoolMessage *msg, char **sp, char **data, int *fds)
+{
+	union
+	{
+		struct cmsghdr cmsg;
+		char		buf[CMSG_SPACE(sizeof(int) * MAX_NUM_BACKENDS)];
+	} cbuf;
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t n;
+	int nfds = 0;
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = msg;
+	iov.iov_len = sizeof(*msg);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cbuf.buf;
+	mh.msg_controllen = sizeof(cbuf.buf);
+
+	do
+	{
+		n = recvmsg(sock, &mh, 0);
+	} while (n < 0 && errno == EINTR);
+
+	if (n <= 0)
+	{
+		ereport(DEBUG1,
+				(errmsg("failed to receive message from global connection pool"),
+				 errdetail("recvmsg() failed with error \"%s\"", n < 0 ? strerror(errno) : "EOF")));
+		return false;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		{
+			nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nfds);
+		}
+	}
+
+	if (n < sizeof(*msg) && !gp_read(sock, (char *) msg + n, sizeof(*msg) - n))
+	{
+		gp_close_fds(fds, nfds);
+		return false;
+	}
+
+	if ((mh.msg_flags & MSG_CTRUNC) || nfds != msg->nfds ||
+		msg->sp_len < 0 || msg->sp_len > MAX_STARTUP_PACKET_LENGTH ||
+		(sp == NULL && msg->sp_len > 0) ||
+		msg->data_len < 0 || msg->data_len > GP_MAX_DATA_LEN)
+	{
+		ereport(LOG,
+				(errmsg("invalid message in global connection pool"),
+				 errdetail("kind: '%c' nfds: %d received fds: %d", msg->kind, msg->nfds, nfds)));
+		gp_close_fds(fds, nfds);
+		return false;
+	}
+
+	if (sp)
+	{
+		*sp = palloc(Max(msg->sp_len, 1));
+		if (!gp_read(sock, *sp, msg->sp_len))
+		{
+			gp_close_fds(fds, nfds);
+			return false;
+		}
+	}
+
+	*data = palloc(Max(msg->data_len, 1));
+	if (!gp_read(sock, *data, msg->data_len))
+	{
+		gp_close_fds(fds, nfds);
+		return false;
+	}
+
+	return true;
+}
+
+static bool gp_read(int sock, char *buf, int len)
+{
+	while (len > 0)
+	{
+		ssize_t n = read(sock, buf, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			ereport(DEBUG1,
+					(errmsg("failed to receive message from global connection pool"),
+					 errdetail("read() failed with error \"%s\"", n < 0 ? strerror(errno) : "EOF")));
+			return false;
+		}
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+static void gp_close_fds(int *fds, int nfds)
+{
+	int i;
+
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+}
+
+static RETSIGTYPE my_signal_handler(int sig)
+{
+	int save_errno = errno;
+
+	POOL_SETMASK(&BlockSig);
+
+	switch (sig)
+	{
+		case SIGTERM:
+		case SIGINT:
+		case SIGQUIT:
+			shutdown_request = 1;
+			break;
+
+			/* Failover or failback */
+		case SIGUSR1:
+			discard_request = 1;
+			break;
+
+		default:
+			exit(1);
+			break;
+	}
+
+	POOL_SETMASK(&UnBlockSig);
+
+	errno = save_errno;
+}
+
+static RETSIGTYPE reload_config_handler(int sig)
+{
+	int save_errno = errno;
+	POOL_SETMASK(&BlockSig);
+	reload_config_request = 1;
+	POOL_SETMASK(&UnBlockSig);
+	errno = save_errno;
+}
+
+static void reload_config(void)
+{
+	MemoryContext oldContext;
+
+	ereport(LOG,
+			(errmsg("reloading config file")));
+	oldContext = MemoryContextSwitchTo(TopMemoryContext);
+	pool_get_config(get_config_file_name(), CFGCXT_RELOAD);
+	MemoryContextSwitchTo(oldContext);
+	reload_config_request = 0;
+}
@@ -41,6 +41,7 @@
 #include <netinet/in.h>
 #include <ctype.h>
 #include <regex.h>
+#include <poll.h>
 
 #include "pool.h"
 #include "pool_config.h"
@@ -607,45 +608,39 @@ void pool_set_timeout(int timeoutval)
 /*
  * Wait until read data is ready.
  * return values: 0: normal 1: data is not ready -1: error
+ *
+ * Note that pool_read() and friends try to read the socket before
+ * calling this, so this is only called when there's no data in the
+ * socket buffer.
  */
 int pool_check_fd(POOL_CONNECTION *cp)
 {
-	fd_set readmask;
-	fd_set exceptmask;
-	int fd;
+	struct pollfd pfd;
+	int timeout;
 	int fds;
-	struct timeval timeout;
-	struct timeval *timeoutp;
 	int save_errno;
 
 	/*
 	 * If SSL is enabled, we need to check SSL internal buffer
-	 * is empty or not first. Otherwise select(2) will stuck.
+	 * is empty or not first. Otherwise poll(2) will stuck.
 	 */
 	if (pool_ssl_pending(cp))
 	{
 		return 0;
 	}
 
-	fd = cp->fd;
-
 	if (timeoutsec >= 0)
-	{
-		timeout.tv_sec = timeoutsec;
-		timeout.tv_usec = 0;
-		timeoutp = &timeout;
-	}
+		timeout = timeoutsec * 1000;
 	else
-		timeoutp = NULL;
+		timeout = -1;
 
 	for (;;)
 	{
-		FD_ZERO(&readmask);
-		FD_ZERO(&exceptmask);
-		FD_SET(fd, &readmask);
-		FD_SET(fd, &exceptmask);
+		pfd.fd = cp->fd;
+		pfd.events = POLLIN | POLLPRI;
+		pfd.revents = 0;
 
-		fds = select(fd+1, &readmask, NULL, &exceptmask, timeoutp);
+		fds = poll(&pfd, 1, timeout);
 		save_errno = errno;
 		if (fds == -1)
 		{
@@ -661,16 +656,16 @@ int pool_check_fd(POOL_CONNECTION *cp)
 				continue;
 
 			ereport(WARNING,
-					(errmsg("waiting for reading data. select failed with error: \"%s\"", strerror(errno))));
+					(errmsg("waiting for reading data. poll failed with error: \"%s\"", strerror(errno))));
 			break;
 		}
 		else if (fds == 0)		/* timeout */
 			return 1;
 
-		if (FD_ISSET(fd, &exceptmask))
+		if (pfd.revents & (POLLPRI | POLLNVAL))
 		{
 			ereport(WARNING,
-					(errmsg("waiting for reading data. exception occurred in select ")));
+					(errmsg("waiting for reading data. exception occurred in poll ")));
 			break;
 		}
 		errno = save_errno;
@@ -731,7 +726,6 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend,
 									POOL_CONNECTION_POOL *backend)
 {
 	int len, len1 = 0;
-	char *p = NULL;
 	char *p1 = NULL;
 	int sendlen;
 	int i;
@@ -742,13 +736,11 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend,
 	len -= 4;
 	len1 = len;
 
-	p = pool_read2(MASTER(backend), len);
-	if (p == NULL)
-        ereport(ERROR,
-            (errmsg("unable to forward message to frontend"),
-                 errdetail("read from backend failed")));
-	p1 = palloc(len);
-	memcpy(p1, p, len);
+	/*
+	 * Reading from other backends below does not touch the receive buffer
+	 * of the master, so we can refer to the message in place.
+	 */
+	p1 = pool_read_direct(MASTER(backend), len);
 
 	/*
 	 * If we received a notification message in master/slave mode,
@@ -778,11 +770,7 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend,
 				len = ntohl(len);
 				len -= 4;
 
-				p = pool_read2(CONNECTION(backend, i), len);
-				if (p == NULL)
-                    ereport(ERROR,
-                        (errmsg("unable to forward message to frontend"),
-                             errdetail("read on backend node failed")));
+				pool_read_direct(CONNECTION(backend, i), len);
 
 				if (len != len1)
 				{
@@ -844,7 +832,120 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend,
                      errdetail("FATAL error occured on backend")));
 	}
 
-	pfree(p1);
+	return POOL_CONTINUE;
+}
+
+/*
+ * Return true if the DataRow which has just been read by
+ * read_kind_from_backend() and the following DataRows can be forwarded
+ * by PassThroughToFrontend(), that is, only one backend is involved in
+ * the current query and nothing needs to look into each row.
+ */
+bool pool_can_pass_through_rows(POOL_CONNECTION_POOL *backend)
+{
+	int i;
+
+	if (MAJOR(backend) != PROTO_MAJOR_V3)
+		return false;
+
+	/* the query result is being collected for the query cache */
+	if (pool_config->memory_cache_enabled && pool_is_cache_safe() &&
+		!pool_is_cache_exceeded())
+		return false;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (VALID_BACKEND(i) && !IS_MASTER_NODE_ID(i))
+			return false;
+	}
+	return VALID_BACKEND(MASTER_NODE_ID);
+}
+
+/*
+ * Forward a run of DataRow messages from the master backend to frontend
+ * as raw bytes.  The kind of the first DataRow ('D') has been already
+ * read. Only message headers are looked at to find the end of the run:
+ * complete DataRows found in the receive buffer are forwarded at once,
+ * and a DataRow which is not received entirely yet is forwarded in
+ * chunks.  Returns when the next message is not a DataRow
+ * (e.g. CommandComplete, ErrorResponse or NoticeResponse), leaving it to
+ * the usual message processing.
+ *
+ * Like SimpleForwardToFrontend(), this does not flush the frontend.
+ */
+POOL_STATUS PassThroughToFrontend(POOL_CONNECTION *frontend,
+								  POOL_CONNECTION_POOL *backend)
+{
+	POOL_CONNECTION *cp = MASTER(backend);
+	char kind = 'D';
+	char *p;
+	int len;
+	int span;
+	int avail;
+	int nrows = 0;
+
+	pool_write(frontend, &kind, 1);
+
+	for (;;)
+	{
+		/* length of the current DataRow including the length itself */
+		p = pool_peek(cp, sizeof(len));
+		memcpy(&len, p, sizeof(len));
+		len = ntohl(len);
+		if (len < (int) sizeof(len))
+			ereport(ERROR,
+					(errmsg("unable to forward message to frontend"),
+					 errdetail("invalid DataRow length %d", len)));
+
+		avail = pool_read_buffer_length(cp);
+		nrows++;
+
+		if (len <= avail)
+		{
+			/*
+			 * Find as many complete DataRows as possible in the receive
+			 * buffer.
+			 */
+			span = len;
+			while (span + 1 + sizeof(len) <= avail && p[span] == 'D')
+			{
+				memcpy(&len, p + span + 1, sizeof(len));
+				len = ntohl(len);
+				if (len < (int) sizeof(len) || span + 1 + len > avail)
+					break;
+				span += 1 + len;
+				nrows++;
+			}
+
+			p = pool_read_direct(cp, span);
+			pool_write(frontend, p, span);
+		}
+		else
+		{
+			/* the DataRow is not entirely received yet. stream it */
+			while (len > 0)
+			{
+				span = Min(len, Max(avail, RECVBUFSZ));
+				p = pool_read_direct(cp, span);
+				pool_write(frontend, p, span);
+				len -= span;
+				avail = pool_read_buffer_length(cp);
+			}
+		}
+
+		/* next message kind */
+		p = pool_peek(cp, 1);
+		if (*p != 'D')
+			break;
+
+		pool_read_direct(cp, 1);
+		pool_write(frontend, &kind, 1);
+	}
+
+	ereport(DEBUG1,
+			(errmsg("PassThroughToFrontend: forwarded %d rows from backend %d",
+					nrows, cp->db_node_id)));
+
 	return POOL_CONTINUE;
 }
 
@@ -3282,6 +3383,9 @@ void read_kind_from_backend(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *bac
 							 errdetail("kind == 0")));
 				}
 
+				/* First response to a measured SELECT has arrived */
+				pool_end_latency_sample(i);
+
 				ereport(DEBUG1,
 					(errmsg("reading backend data packet kind"),
 						 errdetail("backend:%d kind:'%c'",i, kind)));
@@ -4522,6 +4626,7 @@ static POOL_STATUS read_packets_and_process(POOL_CONNECTION *frontend, POOL_CONN
 	int num_fds, was_error = 0;
 	POOL_STATUS status;
 	int i;
+	bool parkable;
 
 	/*
 	 * frontend idle counters. depends on the following
@@ -4559,6 +4664,7 @@ SELECT_RETRY:
 
 		session_context = pool_get_session_context(false);
 		node_id = select_load_balancing_node();
+		pool_set_load_counted_node(node_id);
 
 		for (i=0;i<NUM_BACKENDS;i++)
 		{
@@ -4591,6 +4697,22 @@ SELECT_RETRY:
 	else
 		timeout = NULL;
 
+	/*
+	 * If this process multiplexes client sessions and the session is
+	 * waiting for the next request, just poll the sockets. If nothing has
+	 * arrived, return POOL_IDLE so that the caller can serve other
+	 * sessions meanwhile. client_idle_limit is taken care of by the
+	 * caller in this case.
+	 */
+	parkable = !reset_request && pool_config->max_sessions_per_child > 1 &&
+		pool_can_park_session();
+	if (parkable)
+	{
+		timeoutdata.tv_sec = 0;
+		timeoutdata.tv_usec = 0;
+		timeout = &timeoutdata;
+	}
+
 	fds = select(num_fds, &readmask, &writemask, &exceptmask, timeout);
 
 	if (fds == -1)
@@ -4606,6 +4728,9 @@ SELECT_RETRY:
 	/* select timeout */
 	if (fds == 0)
 	{
+		if (parkable)
+			return POOL_IDLE;
+
 		if (*InRecovery == RECOVERY_INIT && pool_config->client_idle_limit > 0)
 		{
 			idle_count++;
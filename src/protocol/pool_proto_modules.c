@@ -445,6 +445,33 @@ POOL_STATUS SimpleQuery(POOL_CONNECTION *frontend,
 									   query_context->original_query))
 			{
 				pool_set_cache_safe();
+
+				/*
+				 * If other child is executing the same query, wait for it to
+				 * register the result to the cache rather than sending the
+				 * same query to backends.  This is only done outside of
+				 * transaction since the result is not cached until commit.
+				 */
+				if (TSTATE(backend, MASTER_SLAVE ? PRIMARY_NODE_ID : REAL_MASTER_NODE_ID) == 'I')
+				{
+					bool foundp;
+
+					status = pool_coalesce_cache_miss(frontend, backend, contents, &foundp);
+					if (status != POOL_CONTINUE)
+					{
+						pool_query_context_destroy(query_context);
+						return status;
+					}
+
+					if (foundp)
+					{
+						pool_ps_idle_display(backend);
+						pool_query_context_destroy(query_context);
+						pool_set_skip_reading_from_backends();
+						pool_stats_count_up_num_cache_hits();
+						return POOL_CONTINUE;
+					}
+				}
 			}
 			else
 			{
@@ -1921,6 +1948,11 @@ POOL_STATUS ReadyForQuery(POOL_CONNECTION *frontend,
 
 		pool_unset_query_in_progress();
 	}
+
+	/* Let children waiting for the result of our query go ahead */
+	if (pool_config->memory_cache_enabled)
+		pool_release_inflight_query();
+
 	if (!pool_is_doing_extended_query_message())
 	{
 		if (!(node && IsA(node, PrepareStmt)))
@@ -1929,6 +1961,9 @@ POOL_STATUS ReadyForQuery(POOL_CONNECTION *frontend,
         }
 	}
 
+	/* Queries sent so far are no longer outstanding */
+	pool_unset_queries_in_flight();
+
 	/*
 	 * Show ps idle status
 	 */
@@ -2629,6 +2664,9 @@ POOL_STATUS ProcessBackendResponse(POOL_CONNECTION *frontend,
 			case 'E':	/* ErrorResponse */
 				status = ErrorResponse3(frontend, backend);
 				pool_unset_command_success();
+				/* The result will not be cached */
+				if (pool_config->memory_cache_enabled)
+					pool_release_inflight_query();
 				if (TSTATE(backend, MASTER_SLAVE ? PRIMARY_NODE_ID :
 						   REAL_MASTER_NODE_ID) != 'I')
 					pool_set_failed_transaction();
@@ -2682,6 +2720,13 @@ POOL_STATUS ProcessBackendResponse(POOL_CONNECTION *frontend,
 					pool_unset_query_in_progress();
 				break;
 
+			case 'D':	/* DataRow */
+				if (pool_can_pass_through_rows(backend))
+					status = PassThroughToFrontend(frontend, backend);
+				else
+					status = SimpleForwardToFrontend(kind, frontend, backend);
+				break;
+
 			default:
 				status = SimpleForwardToFrontend(kind, frontend, backend);
 				break;
@@ -2709,6 +2754,8 @@ POOL_STATUS ProcessBackendResponse(POOL_CONNECTION *frontend,
 
 			case 'E':	/* ErrorResponse */
 				status = ErrorResponse(frontend, backend);
+				if (pool_config->memory_cache_enabled)
+					pool_release_inflight_query();
 				if (TSTATE(backend, MASTER_SLAVE ? PRIMARY_NODE_ID :
 						   REAL_MASTER_NODE_ID) != 'I')
 					pool_set_failed_transaction();
@@ -3759,4 +3806,25 @@ void pool_at_command_success(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *ba
 				discard_temp_table_relcache();
 		}
 	}
+
+	/*
+	 * In transaction pooling mode, if the command left state in the
+	 * backend which survives the transaction, keep using the backend
+	 * connection until the session ends.
+	 */
+	if (pool_config->pooling_mode == POOLING_TRANSACTION && pool_has_session_state(node))
+		pool_set_backend_pinned();
+
+	/*
+	 * With read_your_writes, remember that the session has written
+	 * something so that its next load balanced read waits for standbys
+	 * to catch up with the write.
+	 */
+	if (pool_config->read_your_writes && STREAM &&
+		((!is_select_query(node, query) &&
+		  !IsA(node, TransactionStmt) &&
+		  !IsA(node, VariableSetStmt) &&
+		  !IsA(node, VariableShowStmt)) ||
+		 pool_has_function_call(node)))
+		pool_set_write_lsn_pending();
 }
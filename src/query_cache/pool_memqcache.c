@@ -36,12 +36,13 @@
 #include <ctype.h>
 #include <arpa/inet.h>
 #include <dirent.h>
+#include <signal.h>
+#include <sys/time.h>
 
 #ifdef USE_MEMCACHED
 #include <libmemcached/memcached.h>
 #endif
 
-#include "auth/md5.h"
 #include "pool_config.h"
 #include "protocol/pool_proto_modules.h"
 #include "parser/parsenodes.h"
@@ -51,6 +52,7 @@
 #include "utils/pool_select_walker.h"
 #include "utils/pool_stream.h"
 #include "utils/pool_stream.h"
+#include "utils/pool_lz.h"
 #include "utils/elog.h"
 #include "utils/palloc.h"
 #include "utils/memutils.h"
@@ -61,11 +63,14 @@ memcached_st *memc;
 #endif
 
 static char* encode_key(const char *s, char *buf, POOL_CONNECTION_POOL *backend);
+static void hash_cache_key_part(const char *data, size_t len, uint64 *h1p, uint64 *h2p);
+static char *make_full_cache_key(const char *s, POOL_CONNECTION_POOL *backend, int *len);
 #ifdef DEBUG
 static void dump_cache_data(const char *data, size_t len);
 #endif
-static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *data, size_t datalen, int num_oids, int *oids);
-static int pool_fetch_cache(POOL_CONNECTION_POOL *backend, const char *query, char **buf, size_t *len);
+static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *data, size_t datalen, int raw_length, int num_oids, int *oids);
+static char *pool_compress_cache_data(char *data, size_t datalen, size_t *size);
+static int pool_fetch_cache(POOL_CONNECTION_POOL *backend, const char *query, char **buf, size_t *len, bool *stale);
 static int send_cached_messages(POOL_CONNECTION *frontend, const char *qcache, int qcachelen);
 static void send_message(POOL_CONNECTION *conn, char kind, int len, const char *data);
 #ifdef USE_MEMCACHED
@@ -76,11 +81,11 @@ static int pool_get_dropdb_table_oids(int **oids, int dboid);
 static void pool_discard_dml_table_oid(void);
 static void pool_invalidate_query_cache(int num_table_oids, int *table_oid, bool unlink, int dboid);
 static int pool_get_database_oid(void);
-static void pool_add_table_oid_map(POOL_CACHEKEY *cachkey, int num_table_oids, int *table_oids);
+static int pool_add_table_oid_map(POOL_CACHEKEY *cachkey, int num_table_oids, int *table_oids);
 static void pool_reset_memqcache_buffer(void);
-static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char *data, int size);
-static POOL_CACHEID *pool_find_item_on_shmem_cache(POOL_QUERY_HASH *query_hash);
-static char *pool_get_item_shmem_cache(POOL_QUERY_HASH *query_hash, int *size, int *sts);
+static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char *data, int size, char *key, int key_length, int raw_length);
+static POOL_CACHEID *pool_find_item_on_shmem_cache(POOL_QUERY_HASH *query_hash, bool *stale);
+static char *pool_get_item_shmem_cache(POOL_QUERY_HASH *query_hash, int *size, int *sts, char *key, int key_length, bool *stale, int *raw_length);
 static POOL_QUERY_CACHE_ARRAY * pool_add_query_cache_array(POOL_QUERY_CACHE_ARRAY *cache_array, POOL_TEMP_QUERY_CACHE *cache);
 static void pool_add_temp_query_cache(POOL_TEMP_QUERY_CACHE *temp_cache, char kind, char *data, int data_len);
 static void pool_add_oids_temp_query_cache(POOL_TEMP_QUERY_CACHE *temp_cache, int num_oids, int *oids);
@@ -112,6 +117,8 @@ static char *block_address(int blockid);
 static POOL_CACHE_ITEM_POINTER *item_pointer(char *block, int i);
 static POOL_CACHE_ITEM_HEADER *item_header(char *block, int i);
 static POOL_CACHE_BLOCKID pool_reuse_block(void);
+static POOL_CACHE_BLOCKID pool_evict_items(size_t free_space);
+static void pool_compact_block(POOL_CACHE_BLOCKID blockid);
 #ifdef SHMEMCACHE_DEBUG
 static void dump_shmem_cache(POOL_CACHE_BLOCKID blockid);
 #endif
@@ -124,6 +131,22 @@ static void put_back_hash_element(volatile POOL_HASH_ELEMENT *element);
 static bool is_free_hash_element(void);
 static void inject_cached_message(POOL_CONNECTION *backend, char *qcache, int qcachelen);
 
+static void pool_oidmap_reset(void);
+static int pool_oidmap_add(int dboid, int tableoid, POOL_CACHEID *cacheid);
+static void pool_oidmap_invalidate(int dboid, int tableoid);
+static int pool_oidmap_get_db_table_oids(int **oids, int dboid);
+static void pool_oidmap_discard_db(int dboid);
+
+static bool pool_claim_cache_revalidation(POOL_CONNECTION_POOL *backend, const char *query);
+
+/*
+ * Lock mode of the shmem cache lock held by us
+ */
+#define SHMEM_UNLOCKED	0
+#define SHMEM_SHARED	1
+#define SHMEM_EXCLUSIVE	2
+static int shmem_lock_mode = SHMEM_UNLOCKED;
+
 /*
  * Connect to Memcached
  */
@@ -221,9 +244,44 @@ void memqcache_register(char kind,
 }
 
 /*
- * Commit SELECT results to cache storage.
+ * Compress SELECT results to be committed to shmem cache if they are as
+ * large as memqcache_compress_threshold, so that more results fit in the
+ * cache.  Returns palloc'd compressed data and sets its length to *size,
+ * or returns NULL if the data is not to be compressed or compression does
+ * not save space.  This is CPU intensive for large results, so call this
+ * before acquiring the shmem cache lock.
+ */
+static char *pool_compress_cache_data(char *data, size_t datalen, size_t *size)
+{
+	char *compressed;
+	int len;
+
+	if (!pool_is_shmem_cache() || data == NULL || datalen == -1 ||
+		pool_config->memqcache_compress_threshold <= 0 ||
+		datalen < pool_config->memqcache_compress_threshold)
+		return NULL;
+
+	compressed = palloc(datalen);
+	len = pool_lz_compress(data, datalen, compressed, datalen - 1);
+	if (len <= 0)
+	{
+		pfree(compressed);
+		return NULL;
+	}
+
+	ereport(DEBUG1,
+		(errmsg("commiting SELECT results to cache storage"),
+			 errdetail("compressed %zd bytes to %d bytes", datalen, len)));
+
+	*size = len;
+	return compressed;
+}
+
+/*
+ * Commit SELECT results to cache storage.  If raw_length > 0, data has
+ * been compressed by pool_compress_cache_data() from raw_length bytes.
  */
-static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *data, size_t datalen, int num_oids, int *oids)
+static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *data, size_t datalen, int raw_length, int num_oids, int *oids)
 {
 #ifdef USE_MEMCACHED
 	memcached_return rc;
@@ -253,7 +311,7 @@ static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *d
 	dump_cache_data(data, datalen);
 #endif
 
-	/* encode md5key for memcached */
+	/* encode cache key */
 	encode_key(query, tmpkey, backend);
 	ereport(DEBUG2,
 		(errmsg("commiting SELECT results to cache storage"),
@@ -273,7 +331,8 @@ static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *d
 
 		memcpy(query_hash.query_hash, tmpkey, sizeof(query_hash.query_hash));
 
-		cacheid = pool_hash_search(&query_hash);
+		/* This also removes the item if it has expired */
+		cacheid = pool_find_item_on_shmem_cache(&query_hash, NULL);
 
 		if (cacheid != NULL)
 		{
@@ -285,7 +344,16 @@ static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *d
 		}
 		else
 		{
-			cacheid = pool_add_item_shmem_cache(&query_hash, data, datalen);
+			char *key = NULL;
+			int key_length = 0;
+
+			if (pool_config->memqcache_key_verification)
+				key = make_full_cache_key(query, backend, &key_length);
+
+			cacheid = pool_add_item_shmem_cache(&query_hash, data, datalen,
+												key, key_length, raw_length);
+			if (key)
+				pfree(key);
 			if (cacheid == NULL)
 			{
 				ereport(LOG,
@@ -322,9 +390,15 @@ static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *d
 #endif
 
 	/*
-	 * Register cache id to oid map
+	 * Register cache id to oid map.  If we fail to register it on shmem,
+	 * the cache entry could not be invalidated later. So remove it.
 	 */
-	pool_add_table_oid_map(&cachekey, num_oids, oids);
+	if (pool_add_table_oid_map(&cachekey, num_oids, oids) != 0 &&
+		pool_is_shmem_cache())
+	{
+		pool_delete_item_shmem_cache(&cachekey.cacheid);
+		return -1;
+	}
 
 	return 0;
 }
@@ -334,19 +408,24 @@ static int pool_commit_cache(POOL_CONNECTION_POOL *backend, char *query, char *d
  * Return:
  * 0: fetch success, 
  * 1: not found
+ * *stale is set to true if the cache entry has expired but still in
+ * memqcache_stale_grace.
  */
-static int pool_fetch_cache(POOL_CONNECTION_POOL *backend, const char *query, char **buf, size_t *len)
+static int pool_fetch_cache(POOL_CONNECTION_POOL *backend, const char *query, char **buf, size_t *len, bool *stale)
 {
 	char *ptr;
 	char tmpkey[MAX_KEY];
 	int sts;
 	char *p;
+	int raw_length = 0;
+
+	*stale = false;
 
 	if (strlen(query) <= 0)
 		ereport(ERROR,
 			(errmsg("fetching from cache storage, no query")));
 
-	/* encode md5key for memcached */
+	/* encode cache key */
 	encode_key(query, tmpkey, backend);
 	ereport(DEBUG1,
 		(errmsg("fetching from cache storage"),
@@ -357,10 +436,17 @@ static int pool_fetch_cache(POOL_CONNECTION_POOL *backend, const char *query, ch
 	{
 		POOL_QUERY_HASH query_hash;
 		int mylen;
+		char *key = NULL;
+		int key_length = 0;
 
 		memcpy(query_hash.query_hash, tmpkey, sizeof(query_hash.query_hash));
 
-		ptr = pool_get_item_shmem_cache(&query_hash, &mylen, &sts);
+		if (pool_config->memqcache_key_verification)
+			key = make_full_cache_key(query, backend, &key_length);
+
+		ptr = pool_get_item_shmem_cache(&query_hash, &mylen, &sts, key, key_length, stale, &raw_length);
+		if (key)
+			pfree(key);
 		if (ptr == NULL)
 		{
 			ereport(DEBUG1,
@@ -410,9 +496,28 @@ static int pool_fetch_cache(POOL_CONNECTION_POOL *backend, const char *query, ch
 	}
 #endif
 
-	p = palloc(*len);
-
-	memcpy(p, ptr, *len);
+	if (raw_length > 0)
+	{
+		/*
+		 * Compressed on shmem. Decompress straight into the buffer to
+		 * be sent to frontend.
+		 */
+		p = palloc(raw_length);
+		if (pool_lz_decompress(ptr, *len, p, raw_length) != raw_length)
+		{
+			ereport(LOG,
+				(errmsg("fetching from cache storage"),
+					 errdetail("failed to decompress cache item for query:\"%s\"", query)));
+			pfree(p);
+			return 1;
+		}
+		*len = raw_length;
+	}
+	else
+	{
+		p = palloc(*len);
+		memcpy(p, ptr, *len);
+	}
 
 	if (!pool_is_shmem_cache())
 	{
@@ -433,42 +538,168 @@ static int pool_fetch_cache(POOL_CONNECTION_POOL *backend, const char *query, ch
 
 /*
  * encode key.
- * create cache key as md5(username + query string + database name)
+ * create cache key as 128 bit hash of username, query string and
+ * database name, printed in 32 hex characters.  The parts are hashed
+ * one by one rather than concatenated.
  */
 static char* encode_key(const char *s, char *buf, POOL_CONNECTION_POOL *backend)
 {
-	char* strkey;
-	int u_length;
-	int d_length;
-	int q_length;
-	int length;
+	uint64 h1 = 0;
+	uint64 h2 = 0;
 
-	u_length = strlen(backend->info->user);
 	ereport(DEBUG1,
 		(errmsg("memcache encode key"),
 			 errdetail("username: \"%s\" database_name: \"%s\"", backend->info->user,backend->info->database)));
-
-	d_length = strlen(backend->info->database);
-
-	q_length = strlen(s);
 	ereport(DEBUG1,
 		(errmsg("memcache encode key"),
 			 errdetail("query: \"%s\"", s)));
 
-	length = u_length + d_length + q_length + 1;
-
-	strkey = (char*)palloc(sizeof(char) * length);
+	hash_cache_key_part(backend->info->user, strlen(backend->info->user), &h1, &h2);
+	hash_cache_key_part(s, strlen(s), &h1, &h2);
+	hash_cache_key_part(backend->info->database, strlen(backend->info->database), &h1, &h2);
 
-	snprintf(strkey, length, "%s%s%s", backend->info->user, s, backend->info->database);
-
-	pool_md5_hash(strkey, strlen(strkey), buf);
+	snprintf(buf, POOL_MD5_HASHKEYLEN+1, "%016llx%016llx",
+			 (unsigned long long)h1, (unsigned long long)h2);
 	ereport(DEBUG1,
 		(errmsg("memcache encode key"),
-			 errdetail("`%s' -> `%s'", strkey, buf)));
-	pfree(strkey);
+			 errdetail("key: `%s'", buf)));
 	return buf;
 }
 
+#define ROTL64(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64 fmix64(uint64 k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+/*
+ * Load a 64 bit block as a little endian word, so that the same key is
+ * made on any platform.
+ */
+static inline uint64 load_le64(const unsigned char *p)
+{
+	return ((uint64)p[0]) |
+		((uint64)p[1] << 8) |
+		((uint64)p[2] << 16) |
+		((uint64)p[3] << 24) |
+		((uint64)p[4] << 32) |
+		((uint64)p[5] << 40) |
+		((uint64)p[6] << 48) |
+		((uint64)p[7] << 56);
+}
+
+/*
+ * Hash a part of the cache key.  This is MurmurHash3 x64_128 except
+ * that the 128 bit state in *h1 and *h2 is carried over from the
+ * previous part instead of a seed.  Since the length is mixed into the
+ * state, ("ab", "c") and ("a", "bc") give different keys.
+ */
+static void hash_cache_key_part(const char *data, size_t len, uint64 *h1p, uint64 *h2p)
+{
+	const uint64 c1 = 0x87c37b91114253d5ULL;
+	const uint64 c2 = 0x4cf5ad432745937fULL;
+	const unsigned char *blocks = (const unsigned char *)data;
+	const unsigned char *tail;
+	uint64 h1 = *h1p;
+	uint64 h2 = *h2p;
+	uint64 k1;
+	uint64 k2;
+	size_t nblocks = len / 16;
+	size_t i;
+
+	for (i = 0; i < nblocks; i++)
+	{
+		k1 = load_le64(blocks + i * 16);
+		k2 = load_le64(blocks + i * 16 + 8);
+
+		k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = ROTL64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = ROTL64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	tail = blocks + nblocks * 16;
+	k1 = 0;
+	k2 = 0;
+
+	switch (len & 15)
+	{
+		case 15: k2 ^= ((uint64)tail[14]) << 48;
+			/* FALLTHROUGH */
+		case 14: k2 ^= ((uint64)tail[13]) << 40;
+			/* FALLTHROUGH */
+		case 13: k2 ^= ((uint64)tail[12]) << 32;
+			/* FALLTHROUGH */
+		case 12: k2 ^= ((uint64)tail[11]) << 24;
+			/* FALLTHROUGH */
+		case 11: k2 ^= ((uint64)tail[10]) << 16;
+			/* FALLTHROUGH */
+		case 10: k2 ^= ((uint64)tail[9]) << 8;
+			/* FALLTHROUGH */
+		case 9: k2 ^= ((uint64)tail[8]);
+			k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+			/* FALLTHROUGH */
+		case 8: k1 ^= ((uint64)tail[7]) << 56;
+			/* FALLTHROUGH */
+		case 7: k1 ^= ((uint64)tail[6]) << 48;
+			/* FALLTHROUGH */
+		case 6: k1 ^= ((uint64)tail[5]) << 40;
+			/* FALLTHROUGH */
+		case 5: k1 ^= ((uint64)tail[4]) << 32;
+			/* FALLTHROUGH */
+		case 4: k1 ^= ((uint64)tail[3]) << 24;
+			/* FALLTHROUGH */
+		case 3: k1 ^= ((uint64)tail[2]) << 16;
+			/* FALLTHROUGH */
+		case 2: k1 ^= ((uint64)tail[1]) << 8;
+			/* FALLTHROUGH */
+		case 1: k1 ^= ((uint64)tail[0]);
+			k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= (uint64)len;
+	h2 ^= (uint64)len;
+
+	h1 += h2;
+	h2 += h1;
+
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+
+	h1 += h2;
+	h2 += h1;
+
+	*h1p = h1;
+	*h2p = h2;
+}
+
+/*
+ * Build the whole cache key, that is "username\0database name\0query
+ * string", to be stored along with the cache entry for verification.
+ * Returns palloc'ed key and sets its length to *len.
+ */
+static char *make_full_cache_key(const char *s, POOL_CONNECTION_POOL *backend, int *len)
+{
+	int u_length = strlen(backend->info->user) + 1;
+	int d_length = strlen(backend->info->database) + 1;
+	int q_length = strlen(s);
+	char *key;
+
+	key = palloc(u_length + d_length + q_length);
+	memcpy(key, backend->info->user, u_length);
+	memcpy(key + u_length, backend->info->database, d_length);
+	memcpy(key + u_length + d_length, s, q_length);
+	*len = u_length + d_length + q_length;
+	return key;
+}
+
 #ifdef DEBUG
 /*
  * dump cache data
@@ -544,10 +775,16 @@ static int send_cached_messages(POOL_CONNECTION *frontend, const char *qcache, i
 			continue;
 		}
 
-		/* send message to frontend */
+		/*
+		 * send message to frontend. The message body is not copied into
+		 * the write buffer but referenced, so the caller must not free
+		 * qcache until the frontend is flushed.
+		 */
 		ereport(DEBUG1,
 			(errmsg("memcache: sending cached messages: '%c' len: %d", tmpkind, len)));
-		send_message(frontend, tmpkind, len, p);
+		pool_write(frontend, &tmpkind, 1);
+		pool_write(frontend, &tmplen, sizeof(tmplen));
+		pool_write_ref(frontend, (void *)p, len-sizeof(tmplen));
 
 		msg++;
 	}
@@ -610,6 +847,7 @@ POOL_STATUS pool_fetch_from_memory_cache(POOL_CONNECTION *frontend,
 	char *qcache;
 	size_t qcachelen;
 	int sts;
+	bool stale;
 	pool_sigset_t oldmask;
 
 	ereport(DEBUG1,
@@ -618,11 +856,11 @@ POOL_STATUS pool_fetch_from_memory_cache(POOL_CONNECTION *frontend,
 	*foundp = false;
     
     POOL_SETMASK2(&BlockSig, &oldmask);
-	pool_shmem_lock();
+	pool_shmem_lock_shared();
 
     PG_TRY();
     {
-        sts = pool_fetch_cache(backend, contents, &qcache, &qcachelen);
+        sts = pool_fetch_cache(backend, contents, &qcache, &qcachelen, &stale);
     }
     PG_CATCH();
     {
@@ -639,6 +877,21 @@ POOL_STATUS pool_fetch_from_memory_cache(POOL_CONNECTION *frontend,
 		/* Cache not found */
 		return POOL_CONTINUE;
 
+	/*
+	 * The cache entry has expired but is still in the grace period.  If
+	 * nobody is refreshing it, behave as if cache not found so that the
+	 * query is executed and the result replaces the entry.  Other
+	 * children keep on using the stale entry meanwhile.
+	 */
+	if (stale && pool_claim_cache_revalidation(backend, contents))
+	{
+		ereport(DEBUG1,
+				(errmsg("fetch from memory cache"),
+				 errdetail("refreshing stale cache entry, %s", contents)));
+		pfree(qcache);
+		return POOL_CONTINUE;
+	}
+
 	/*
 	 * Cache found. If we are doing extended query and in streaming
 	 * replication mode, we need to retrieve any responses from backend and
@@ -664,8 +917,6 @@ POOL_STATUS pool_fetch_from_memory_cache(POOL_CONNECTION *frontend,
 		send_cached_messages(frontend, qcache, qcachelen);
 	}
 
-	pfree(qcache);
-
 	/*
 	 * Send a "READY FOR QUERY" if not in extended query.
 	 */
@@ -684,10 +935,14 @@ POOL_STATUS pool_fetch_from_memory_cache(POOL_CONNECTION *frontend,
 	{
 		if (pool_flush(frontend))
 		{
+			pfree(qcache);
 			return POOL_END;
 		}
 	}
 
+	/* send_cached_messages() refers to qcache until flushed */
+	pfree(qcache);
+
 	*foundp = true;
 
 	if (pool_config->log_per_node_statement)
@@ -1149,6 +1404,9 @@ static int pool_get_dropdb_table_oids(int **oids, int dboid)
 	struct dirent *dp;
 	char path[1024];
 
+	if (pool_is_shmem_cache())
+		return pool_oidmap_get_db_table_oids(oids, dboid);
+
 	snprintf(path, sizeof(path), "%s/%d", pool_config->memqcache_oiddir, dboid);
 	if ((dir = opendir(path)) == NULL)
 	{
@@ -1283,13 +1541,16 @@ int pool_get_database_oid_from_dbname(char *dbname)
 
 /*
  * Add cache id(shmem case) or hash key(memcached case) to table oid
- * map file.  Caller must hold shmem lock before calling this function
- * to avoid file extension conflict among different pgpool child
- * process.
+ * map.  Caller must hold shmem lock before calling this function to
+ * avoid the oid map conflict among different pgpool child process.
  * As of pgpool-II 3.2, pool_handle_query_cache is responsible for that.
  * (pool_handle_query_cache -> pool_commit_cache -> pool_add_table_oid_map)
+ *
+ * In shmem case the map is kept on shared memory (see pool_oidmap_init),
+ * otherwise in memqcache_oiddir/database_oid/table_oid files.
+ * Returns 0 on success, -1 on error.
  */
-static void pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids, int *table_oids)
+static int pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids, int *table_oids)
 {
 	char *dir;
 	int dboid;
@@ -1297,6 +1558,28 @@ static void pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids,
 	int i;
 	int len;
 
+	dboid = pool_get_database_oid();
+	ereport(DEBUG1,
+		(errmsg("memcache: adding table oid maps"),
+			 errdetail("dboid %d", dboid)));
+
+	if (dboid <= 0)
+	{
+		ereport(WARNING,
+				(errmsg("memcache: adding table oid maps, failed to get database OID")));
+		return -1;
+	}
+
+	if (pool_is_shmem_cache())
+	{
+		for (i=0;i<num_table_oids;i++)
+		{
+			if (pool_oidmap_add(dboid, table_oids[i], &cachekey->cacheid) != 0)
+				return -1;
+		}
+		return 0;
+	}
+
 	/*
 	 * Create memqcache_oiddir
 	 */
@@ -1308,25 +1591,13 @@ static void pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids,
 		{
 			ereport(WARNING,
 				(errmsg("memcache: adding table oid maps, failed to create directory:\"%s\". error:\"%s\"", dir, strerror(errno))));
-			return;
+			return -1;
 		}
 	}
 
 	/*
 	 * Create memqcache_oiddir/database_oid
 	 */
-	dboid = pool_get_database_oid();
-	ereport(DEBUG1,
-		(errmsg("memcache: adding table oid maps"),
-			 errdetail("dboid %d", dboid)));
-
-	if (dboid <= 0)
-	{
-		ereport(WARNING,
-				(errmsg("memcache: adding table oid maps, failed to get database OID")));
-		return;
-	}
-
 	snprintf(path, sizeof(path), "%s/%d", dir, dboid);
 	if (mkdir(path, S_IREAD|S_IWRITE|S_IEXEC) == -1)
 	{
@@ -1334,18 +1605,11 @@ static void pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids,
 		{
 			ereport(WARNING,
 					(errmsg("memcache: adding table oid maps, failed to create directory:\"%s\". error:\"%s\"", path, strerror(errno))));
-			return;
+			return -1;
 		}
 	}
 
-	if (pool_is_shmem_cache())
-	{
-		len = sizeof(cachekey->cacheid);
-	}
-	else
-	{
-		len = sizeof(cachekey->hashkey);
-	}
+	len = sizeof(cachekey->hashkey);
 
 	for (i=0;i<num_table_oids;i++)
 	{
@@ -1362,7 +1626,7 @@ static void pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids,
 		{
 			ereport(WARNING,
 					(errmsg("memcache: adding table oid maps, failed to open file:\"%s\". error:\"%s\"", path, strerror(errno))));
-			return;
+			return -1;
 		}
 
 		fl.l_type   = F_WRLCK;
@@ -1377,7 +1641,7 @@ static void pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids,
 					(errmsg("memcache: adding table oid maps, failed to lock file:\"%s\". error:\"%s\"", path, strerror(errno))));
 
 			close(fd);
-			return;
+			return -1;
 		}
 
 		/*
@@ -1395,7 +1659,7 @@ static void pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids,
 				ereport(WARNING,
 						(errmsg("memcache: adding table oid maps, failed to read file:\"%s\". error:\"%s\"", path, strerror(errno))));
 				close(fd);
-				return;
+				return -1;
 			}
 			else if (sts == len)
 			{
@@ -1403,7 +1667,7 @@ static void pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids,
 				{
 					/* Same key found. Skip this */
 					close(fd);
-					return;
+					return -1;
 				}
 				continue;
 			}
@@ -1415,7 +1679,7 @@ static void pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids,
 				ereport(WARNING,
 						(errmsg("memcache: adding table oid maps, invalid data length:%d in file:\"%s\". error:\"%s\"",sts, path)));
 				close(fd);
-				return;
+				return -1;
 			}
 			break;
 		}
@@ -1426,7 +1690,7 @@ static void pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids,
 			ereport(WARNING,
 					(errmsg("memcache: adding table oid maps, failed seek on file:\"%s\". error:\"%s\"", path, strerror(errno))));
 			close(fd);
-			return;
+			return -1;
 		}
 
 		/*
@@ -1438,10 +1702,12 @@ static void pool_add_table_oid_map(POOL_CACHEKEY *cachekey, int num_table_oids,
 			ereport(WARNING,
 					(errmsg("memcache: adding table oid maps, failed to write file:\"%s\". error:\"%s\"", path, strerror(errno))));
 			close(fd);
-			return;
+			return -1;
 		}
 		close(fd);
 	}
+
+	return 0;
 }
 
 /*
@@ -1464,29 +1730,22 @@ void pool_discard_oid_maps(void)
 
 void pool_discard_oid_maps_by_db(int dboid)
 {
-	char command[1024];
-
 	if (pool_is_shmem_cache())
 	{
-		snprintf(command, sizeof(command), "/bin/rm -fr %s/%d/",
-				 pool_config->memqcache_oiddir, dboid);
-
 		ereport(DEBUG1,
 				(errmsg("memcache: discarding oid maps by db"),
-				 errdetail("command: '%s\'", command)));
+				 errdetail("dboid: %d", dboid)));
 
-		if(system(command) == -1)
-            ereport(WARNING,
-				(errmsg("unable to execute command \"%s\"",command),
-                     errdetail("system() command failed with error \"%s\"",strerror(errno))));
+		pool_oidmap_discard_db(dboid);
 	}
 }
 
 /*
  * Reading cache id(shmem case) or hash key(memcached case) from table
- * oid map file according to table_oids and discard cache entries.  If
- * unlink is true, the file will be unlinked after successful cache
- * removal.
+ * oid map according to table_oids and discard cache entries.  If
+ * unlink is true, the oid map file will be unlinked after successful
+ * cache removal.  In shmem case the oid map entries are always removed
+ * along with the cache entries.
  */
 static void pool_invalidate_query_cache(int num_table_oids, int *table_oid, bool unlinkp, int dboid)
 {
@@ -1496,6 +1755,30 @@ static void pool_invalidate_query_cache(int num_table_oids, int *table_oid, bool
 	int len;
 	POOL_CACHEKEY buf;
 
+	if (dboid == 0) {
+		dboid = pool_get_database_oid();
+		ereport(DEBUG1,
+			(errmsg("memcache invalidating query cache"),
+				 errdetail("dboid %d", dboid)));
+
+		if (dboid <= 0)
+		{
+			ereport(WARNING,
+					(errmsg("memcache: invalidating query cache, could not get database OID")));
+			return;
+		}
+	}
+
+	if (pool_is_shmem_cache())
+	{
+		for (i=0;i<num_table_oids;i++)
+			pool_oidmap_invalidate(dboid, table_oid[i]);
+#ifdef SHMEMCACHE_DEBUG
+		dump_shmem_cache(0);
+#endif
+		return;
+	}
+
 	/*
 	 * Create memqcache_oiddir
 	 */
@@ -1513,20 +1796,6 @@ static void pool_invalidate_query_cache(int num_table_oids, int *table_oid, bool
 	/*
 	 * Create memqcache_oiddir/database_oid
 	 */
-	if (dboid == 0) {
-		dboid = pool_get_database_oid();
-		ereport(DEBUG1,
-			(errmsg("memcache invalidating query cache"),
-				 errdetail("dboid %d", dboid)));
-
-		if (dboid <= 0)
-		{
-			ereport(WARNING,
-					(errmsg("memcache: invalidating query cache, could not get database OID")));
-			return;
-		}
-	}
-
 	snprintf(path, sizeof(path), "%s/%d", dir, dboid);
 	if (mkdir(path, S_IREAD|S_IWRITE|S_IEXEC) == -1)
 	{
@@ -1538,14 +1807,7 @@ static void pool_invalidate_query_cache(int num_table_oids, int *table_oid, bool
 		}
 	}
 
-	if (pool_is_shmem_cache())
-	{
-		len = sizeof(buf.cacheid);
-	}
-	else
-	{
-		len = sizeof(buf.hashkey);
-	}
+	len = sizeof(buf.hashkey);
 
 	for (i=0;i<num_table_oids;i++)
 	{
@@ -1596,16 +1858,7 @@ static void pool_invalidate_query_cache(int num_table_oids, int *table_oid, bool
 			}
 			else if (sts == len)
 			{
-				if (pool_is_shmem_cache())
-				{
-					ereport(DEBUG1,
-						(errmsg("memcache invalidating query cache"),
-							errdetail("deleting cacheid:%d itemid:%d",
-								   buf.cacheid.blockid, buf.cacheid.itemid)));
-					pool_delete_item_shmem_cache(&buf.cacheid);
-				}
 #ifdef USE_MEMCACHED
-				else
 				{
 					char delbuf[33];
 
@@ -1640,9 +1893,6 @@ static void pool_invalidate_query_cache(int num_table_oids, int *table_oid, bool
 		}
 		close(fd);
 	}
-#ifdef SHMEMCACHE_DEBUG
-	dump_shmem_cache(0);
-#endif
 }
 
 /*
@@ -1790,7 +2040,7 @@ pool_clear_memory_cache(void)
         size = pool_shared_memory_fsmm_size();
         pool_reset_fsmm(size);
 
-        pool_discard_oid_maps();
+        pool_oidmap_reset();
 
         pool_hash_reset(pool_config->memqcache_max_num_cache);
     }
@@ -1838,6 +2088,43 @@ static void *pool_memory_cache_address(void)
  * 255   8160-8192
  */
 
+/*
+ * FSMM index
+ *
+ * Blocks having the same FSMM value are chained into a doubly linked
+ * list per value, and a bitmap tells which lists are not empty.  This
+ * allows to find a block having enough free space in constant time,
+ * rather than scanning whole FSMM.  There are two indexes, one is
+ * keyed by the free space of the block (the FSMM value itself) and the
+ * other by the free space plus the space of deleted items, which turns
+ * into free space by compacting the block.
+ */
+#define POOL_FSMM_NCLASSES	256
+#define POOL_FSMM_BITMAP_WORDS	(POOL_FSMM_NCLASSES/64)
+#define POOL_FSMM_MAX_PROBES	16	/* blocks of the same value checked by pool_get_block */
+
+typedef struct
+{
+	int head[POOL_FSMM_NCLASSES];		/* first block of each value, -1 if none */
+	uint64 bitmap[POOL_FSMM_BITMAP_WORDS];	/* bit is set if the list is not empty */
+} POOL_FSMM_INDEX_HEADER;
+
+typedef struct
+{
+	POOL_FSMM_INDEX_HEADER *header;
+	unsigned char *value;		/* value of each block */
+	int *next;					/* next block having the same value, -1 if none */
+	int *prev;					/* previous block having the same value, -1 if none */
+} POOL_FSMM_INDEX;
+
+static POOL_FSMM_INDEX fsmm_free_index;		/* keyed by free space */
+static POOL_FSMM_INDEX fsmm_reclaim_index;	/* keyed by free space plus deleted space */
+
+static void fsmm_index_create(POOL_FSMM_INDEX *index, unsigned char *value);
+static void fsmm_index_reset(POOL_FSMM_INDEX *index, int value);
+static void fsmm_index_update(POOL_FSMM_INDEX *index, int blockid, int value);
+static int fsmm_index_find(POOL_FSMM_INDEX *index, int value);
+
 /*
  * Calculate necessary shared memory size for FSMM. Should be called after 
  * pool_shared_memory_cache_size.
@@ -1858,12 +2145,15 @@ size_t pool_shared_memory_fsmm_size(void)
 static void *fsmm;
 int pool_init_fsmm(size_t size)
 {
-	int maxblock = 	pool_get_memqcache_blocks();
 	int encode_value;
 
 	fsmm = pool_shared_memory_create(size);
+	fsmm_index_create(&fsmm_free_index, fsmm);
+	fsmm_index_create(&fsmm_reclaim_index, NULL);
+
 	encode_value = POOL_MAX_FREE_SPACE/POOL_FSMM_RATIO;
-	memset(fsmm, encode_value, maxblock);
+	fsmm_index_reset(&fsmm_free_index, encode_value);
+	fsmm_index_reset(&fsmm_reclaim_index, encode_value);
 	return 0;
 }
 
@@ -1902,11 +2192,117 @@ pool_reset_fsmm(size_t size)
 	int encode_value;
 
 	encode_value = POOL_MAX_FREE_SPACE/POOL_FSMM_RATIO;
-	memset(fsmm, encode_value, size);
+	fsmm_index_reset(&fsmm_free_index, encode_value);
+	fsmm_index_reset(&fsmm_reclaim_index, encode_value);
 
 	*pool_fsmm_clock_hand = 0;
 }
 
+/*
+ * Acquire shared memory for FSMM index. If value is NULL, the array of
+ * block values is also allocated.
+ */
+static void fsmm_index_create(POOL_FSMM_INDEX *index, unsigned char *value)
+{
+	int maxblock = pool_get_memqcache_blocks();
+
+	index->header = pool_shared_memory_create(sizeof(POOL_FSMM_INDEX_HEADER));
+	if (value == NULL)
+		value = pool_shared_memory_create(maxblock * sizeof(char));
+	index->value = value;
+	index->next = pool_shared_memory_create(maxblock * sizeof(int));
+	index->prev = pool_shared_memory_create(maxblock * sizeof(int));
+}
+
+/*
+ * Make all blocks have the value.
+ */
+static void fsmm_index_reset(POOL_FSMM_INDEX *index, int value)
+{
+	int maxblock = pool_get_memqcache_blocks();
+	int i;
+
+	for (i=0;i<POOL_FSMM_NCLASSES;i++)
+		index->header->head[i] = -1;
+	memset(index->header->bitmap, 0, sizeof(index->header->bitmap));
+
+	for (i=0;i<maxblock;i++)
+	{
+		index->value[i] = value;
+		index->next[i] = (i == maxblock - 1) ? -1 : i + 1;
+		index->prev[i] = i - 1;
+	}
+
+	index->header->head[value] = 0;
+	index->header->bitmap[value / 64] |= (uint64)1 << (value % 64);
+}
+
+/*
+ * Move the block to the list of the value.
+ */
+static void fsmm_index_update(POOL_FSMM_INDEX *index, int blockid, int value)
+{
+	POOL_FSMM_INDEX_HEADER *header = index->header;
+	int old = index->value[blockid];
+	int next;
+	int prev;
+
+	if (old == value)
+		return;
+
+	/* Remove from the old list */
+	next = index->next[blockid];
+	prev = index->prev[blockid];
+	if (prev >= 0)
+		index->next[prev] = next;
+	else
+		header->head[old] = next;
+	if (next >= 0)
+		index->prev[next] = prev;
+	if (header->head[old] < 0)
+		header->bitmap[old / 64] &= ~((uint64)1 << (old % 64));
+
+	/* Add to the new list */
+	next = header->head[value];
+	index->next[blockid] = next;
+	index->prev[blockid] = -1;
+	if (next >= 0)
+		index->prev[next] = blockid;
+	header->head[value] = blockid;
+	header->bitmap[value / 64] |= (uint64)1 << (value % 64);
+
+	index->value[blockid] = value;
+}
+
+/*
+ * Returns a block having the smallest value which is equal to or
+ * larger than the value, or -1 if none.
+ */
+static int fsmm_index_find(POOL_FSMM_INDEX *index, int value)
+{
+	POOL_FSMM_INDEX_HEADER *header = index->header;
+	uint64 bits;
+	int w;
+	int i;
+
+	if (value >= POOL_FSMM_NCLASSES)
+		return -1;
+
+	for (w = value / 64; w < POOL_FSMM_BITMAP_WORDS; w++)
+	{
+		bits = header->bitmap[w];
+		if (w == value / 64)
+			bits &= ~(uint64)0 << (value % 64);
+		if (bits == 0)
+			continue;
+
+		for (i = 0; !(bits & 1); i++)
+			bits >>= 1;
+		return header->head[w * 64 + i];
+	}
+	return -1;
+}
+
 /*
  * Find victim block using clock algorithm and make it free.
  * Returns new free block id.
@@ -1951,20 +2347,141 @@ static POOL_CACHE_BLOCKID pool_reuse_block(void)
 }
 
 /*
- * Get block id which has enough space
+ * Find room for a new item by evicting cold items rather than whole
+ * block.  The clock hand sweeps blocks, and items in the block whose
+ * usage count is 0 are deleted while others get their usage count
+ * decremented, until the block has free_space bytes of free space
+ * after compaction and a free hash element is available.
+ * Returns the block id.
  */
-static POOL_CACHE_BLOCKID pool_get_block(size_t free_space)
+static POOL_CACHE_BLOCKID pool_evict_items(size_t free_space)
 {
-	int encode_value;
-	unsigned char *p = pool_fsmm_address();
-	int i;
 	int maxblock = pool_get_memqcache_blocks();
+	int max_sweep = maxblock * (POOL_ITEM_MAX_USAGE + 2);
+	POOL_CACHE_BLOCKID blockid;
 	POOL_CACHE_BLOCK_HEADER *bh;
+	POOL_CACHE_ITEM_POINTER *cip;
+	POOL_CACHEID cacheid;
+	long long int num_evicted = 0;
+	char *p;
+	int n;
+	int i;
 
-	if (p == NULL)
+	for (n=0;n<max_sweep;n++)
 	{
-		ereport(WARNING,
-				(errmsg("memcache: getting block: FSMM is not initialized")));
+		blockid = *pool_fsmm_clock_hand;
+		(*pool_fsmm_clock_hand)++;
+		if (*pool_fsmm_clock_hand >= maxblock)
+			*pool_fsmm_clock_hand = 0;
+
+		p = block_address(blockid);
+		bh = (POOL_CACHE_BLOCK_HEADER *)p;
+		pool_init_cache_block(blockid);
+
+		for (i=0;i<bh->num_items && (bh->flags & POOL_BLOCK_USED);i++)
+		{
+			if (bh->free_bytes + bh->deleted_bytes >= free_space &&
+				is_free_hash_element())
+				break;
+
+			cip = item_pointer(p, i);
+			if (cip->flags & POOL_ITEM_DELETED)
+				continue;
+
+			if (cip->usage > 0)
+			{
+				cip->usage--;
+				continue;
+			}
+
+			cacheid.blockid = blockid;
+			cacheid.itemid = i;
+			ereport(DEBUG1,
+				(errmsg("memcache evicting item"),
+					errdetail("blockid: %d itemid: %d", blockid, i)));
+			if (pool_delete_item_shmem_cache(&cacheid) == 0)
+				num_evicted++;
+		}
+
+		if (bh->free_bytes + bh->deleted_bytes >= free_space &&
+			is_free_hash_element())
+		{
+			if (bh->deleted_bytes > 0)
+				pool_compact_block(blockid);
+			if (num_evicted > 0)
+				pool_stats_count_up_num_evictions(num_evicted);
+			return blockid;
+		}
+	}
+
+	/*
+	 * Should not happen since all usage counts must have reached 0 by
+	 * now. Reuse victim block.
+	 */
+	if (num_evicted > 0)
+		pool_stats_count_up_num_evictions(num_evicted);
+	return pool_reuse_block();
+}
+
+/*
+ * Compact the block so that the space of deleted items turns into free
+ * space.  Since the hash table and the table oid map refer to items by
+ * item id, deleted items keep their item pointer and item header so
+ * that live items keep their item ids.
+ */
+static void pool_compact_block(POOL_CACHE_BLOCKID blockid)
+{
+	char *p = block_address(blockid);
+	POOL_CACHE_BLOCK_HEADER *bh = (POOL_CACHE_BLOCK_HEADER *)p;
+	POOL_CACHE_ITEM_POINTER *cip;
+	POOL_CACHE_ITEM_HEADER *cih;
+	char *dst;
+	int i;
+
+	/* Item bodies are ordered from bottom to top of the block */
+	dst = p + pool_config->memqcache_cache_block_size;
+
+	for (i=0;i<bh->num_items;i++)
+	{
+		cip = item_pointer(p, i);
+		cih = item_header(p, i);
+
+		if (cip->flags & POOL_ITEM_DELETED)
+		{
+			cih->total_length = sizeof(POOL_CACHE_ITEM_HEADER);
+			cih->key_length = 0;
+		}
+
+		dst -= cih->total_length;
+		if (dst != p + cip->offset)
+			memmove(dst, p + cip->offset, cih->total_length);
+		cip->offset = dst - p;
+	}
+
+	ereport(DEBUG1,
+		(errmsg("memcache compacting block"),
+			errdetail("blockid: %d reclaimed %d bytes", blockid, bh->deleted_bytes)));
+
+	bh->free_bytes += bh->deleted_bytes;
+	bh->deleted_bytes = 0;
+	pool_update_fsmm(blockid, bh->free_bytes);
+}
+
+/*
+ * Get block id which has enough space
+ */
+static POOL_CACHE_BLOCKID pool_get_block(size_t free_space)
+{
+	int encode_value;
+	unsigned char *p = pool_fsmm_address();
+	int i;
+	int n;
+	POOL_CACHE_BLOCK_HEADER *bh;
+
+	if (p == NULL)
+	{
+		ereport(WARNING,
+				(errmsg("memcache: getting block: FSMM is not initialized")));
 		return -1;
 	}
 
@@ -1978,26 +2495,49 @@ static POOL_CACHE_BLOCKID pool_get_block(size_t free_space)
 
 	encode_value = free_space/POOL_FSMM_RATIO;
 
-	for (i=0;i<maxblock;i++)
+	/*
+	 * Blocks having larger FSMM value surely have enough space.  Look for
+	 * the one having the smallest value to keep larger free space for
+	 * larger items.
+	 */
+	i = fsmm_index_find(&fsmm_free_index, encode_value + 1);
+	if (i >= 0)
+		return (POOL_CACHE_BLOCKID)i;
+
+	/*
+	 * Blocks having the same FSMM value *may* have enough space.  We
+	 * need to make sure it actually has enough space.  Walk the list of
+	 * the value, up to POOL_FSMM_MAX_PROBES blocks to keep this bounded.
+	 */
+	i = fsmm_index_find(&fsmm_free_index, encode_value);
+	for (n = 0; i >= 0 && n < POOL_FSMM_MAX_PROBES; n++)
 	{
-		if (p[i] >= encode_value)
+		if (fsmm_free_index.value[i] != encode_value)
+			break;
+
+		bh = (POOL_CACHE_BLOCK_HEADER *)block_address(i);
+		if (!(bh->flags & POOL_BLOCK_USED) || bh->free_bytes >= free_space)
 		{
-			/*
-			 * This block *may" have enough space.
-			 * We need to make sure it actually has enough space.
-			 */
-			bh = (POOL_CACHE_BLOCK_HEADER *)block_address(i);
-			if (bh->free_bytes >= free_space)
-			{
-				return (POOL_CACHE_BLOCKID)i;
-			}
+			/* Unused block is initialized by caller */
+			return (POOL_CACHE_BLOCKID)i;
 		}
+		i = fsmm_free_index.next[i];
 	}
 
 	/*
-	 * No enough space found. Reuse victim block
+	 * Look for a block which will have enough space by compaction.
 	 */
-	return pool_reuse_block();
+	i = fsmm_index_find(&fsmm_reclaim_index, encode_value + 1);
+	if (i >= 0)
+	{
+		pool_compact_block(i);
+		return (POOL_CACHE_BLOCKID)i;
+	}
+
+	/*
+	 * No enough space found. Evict cold items.
+	 */
+	return pool_evict_items(free_space);
 }
 
 /*
@@ -2007,6 +2547,7 @@ static void pool_update_fsmm(POOL_CACHE_BLOCKID blockid, size_t free_space)
 {
 	int encode_value;
 	char *p = pool_fsmm_address();
+	POOL_CACHE_BLOCK_HEADER *bh;
 
 	if (p == NULL)
 	{
@@ -2032,19 +2573,27 @@ static void pool_update_fsmm(POOL_CACHE_BLOCKID blockid, size_t free_space)
 	}
 
 	encode_value = free_space/POOL_FSMM_RATIO;
+	fsmm_index_update(&fsmm_free_index, blockid, encode_value);
 
-	p[blockid] = encode_value;
+	/* Space of deleted items counts as free for compaction */
+	bh = (POOL_CACHE_BLOCK_HEADER *)block_address(blockid);
+	free_space += bh->deleted_bytes;
+	if (free_space > POOL_MAX_FREE_SPACE)
+		free_space = POOL_MAX_FREE_SPACE;
+	encode_value = free_space/POOL_FSMM_RATIO;
+	fsmm_index_update(&fsmm_reclaim_index, blockid, encode_value);
 
 	return;
 }
 
 /*
- * Add item data to shared memory cache.
+ * Add item data to shared memory cache. If the data is compressed,
+ * raw_length is the length before compression, otherwise 0.
  * On successful registration, returns cache id.
  * The cache id is overwritten by the subsequent call to this function.
  * On error returns NULL.
  */
-static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char *data, int size)
+static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char *data, int size, char *key, int key_length, int raw_length)
 {
 	static POOL_CACHEID cacheid;
 	POOL_CACHE_BLOCKID blockid;
@@ -2089,7 +2638,7 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 	}
 
 	/* Add overhead */
-	request_size = size + sizeof(POOL_CACHE_ITEM_POINTER) + sizeof(POOL_CACHE_ITEM_HEADER);
+	request_size = size + key_length + sizeof(POOL_CACHE_ITEM_POINTER) + sizeof(POOL_CACHE_ITEM_HEADER);
 
 	/* Get cache block which has enough space */
 	blockid = pool_get_block(request_size);
@@ -2109,10 +2658,10 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 	/*
 	 * Make sure that we have at least one free hash element.
 	 */
-	while (!is_free_hash_element())
+	if (!is_free_hash_element())
 	{
-		/* If not, reuse next victim block */
-		blockid = pool_reuse_block();
+		/* If not, evict cold items */
+		blockid = pool_evict_items(request_size);
 		pool_init_cache_block(blockid);
 	}
 
@@ -2250,7 +2799,9 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 
 	/* Fill in cache item header */
 	ci.header.timestamp = time(NULL);
-	ci.header.total_length = sizeof(POOL_CACHE_ITEM_HEADER) + size;
+	ci.header.total_length = sizeof(POOL_CACHE_ITEM_HEADER) + size + key_length;
+	ci.header.key_length = key_length;
+	ci.header.raw_length = raw_length;
 
 	/* Calculate item body address */
 	if (bh->num_items == 0)
@@ -2276,11 +2827,19 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 	memcpy(item + sizeof(POOL_CACHE_ITEM_HEADER), data, size);
 	bh->free_bytes -= size;
 
+	/* Copy cache key for verification if any */
+	if (key_length > 0)
+	{
+		memcpy(item + sizeof(POOL_CACHE_ITEM_HEADER) + size, key, key_length);
+		bh->free_bytes -= key_length;
+	}
+
 	/* Copy cache item pointer */
 	memcpy(&cip_body.query_hash, query_hash, sizeof(POOL_QUERY_HASH));
 	memset(&cip_body.next, 0, sizeof(POOL_CACHEID));
 	cip_body.offset = item - p;
 	cip_body.flags = POOL_ITEM_USED;
+	cip_body.usage = 0;
 	memcpy(item_pointer(p, bh->num_items), &cip_body, sizeof(POOL_CACHE_ITEM_POINTER));
 	bh->free_bytes -= sizeof(POOL_CACHE_ITEM_POINTER);
 
@@ -2321,14 +2880,16 @@ static POOL_CACHEID *pool_add_item_shmem_cache(POOL_QUERY_HASH *query_hash, char
 
 /*
  * Returns item data address on shared memory cache specified by query hash.
- * Also data length is set to *size.
+ * Also data length is set to *size. If the data is compressed, the
+ * length before compression is set to *raw_length, otherwise 0.
  * On error or data not found case returns NULL.
  * Detail is set to *sts. (0: success, 1: not found, -1: error)
  */
-static char *pool_get_item_shmem_cache(POOL_QUERY_HASH *query_hash, int *size, int *sts)
+static char *pool_get_item_shmem_cache(POOL_QUERY_HASH *query_hash, int *size, int *sts, char *key, int key_length, bool *stale, int *raw_length)
 {
 	POOL_CACHEID *cacheid;
 	POOL_CACHE_ITEM_HEADER *cih;
+	POOL_CACHE_ITEM_POINTER *cip;
 
 	if (sts == NULL)
 	{
@@ -2356,7 +2917,7 @@ static char *pool_get_item_shmem_cache(POOL_QUERY_HASH *query_hash, int *size, i
 	/*
 	 * Find cache header by using hash table
 	 */
-	cacheid = pool_find_item_on_shmem_cache(query_hash);
+	cacheid = pool_find_item_on_shmem_cache(query_hash, stale);
 	if (cacheid == NULL)
 	{
 		/* Not found */
@@ -2366,7 +2927,34 @@ static char *pool_get_item_shmem_cache(POOL_QUERY_HASH *query_hash, int *size, i
 
 	cih = pool_cache_item_header(cacheid);
 
-	*size = cih->total_length - sizeof(POOL_CACHE_ITEM_HEADER);
+	*size = cih->total_length - sizeof(POOL_CACHE_ITEM_HEADER) - cih->key_length;
+	*raw_length = cih->raw_length;
+
+	/*
+	 * If requested, make sure that the cache entry is really for the
+	 * query, not for another query having the same hash key.
+	 */
+	if (key != NULL &&
+		(cih->key_length != key_length ||
+		 memcmp((char *)cih + sizeof(POOL_CACHE_ITEM_HEADER) + *size, key, key_length) != 0))
+	{
+		ereport(LOG,
+				(errmsg("memcache: cache key verification failed"),
+				 errdetail("cache entry blockid:%d itemid:%d belongs to another query",
+						   cacheid->blockid, cacheid->itemid)));
+		*sts = 1;
+		return NULL;
+	}
+
+	/*
+	 * Count up usage for eviction.  This may be done by several
+	 * processes holding shared lock at the same time, but losing some
+	 * counts does not matter.
+	 */
+	cip = item_pointer(block_address(cacheid->blockid), cacheid->itemid);
+	if (cip->usage < POOL_ITEM_MAX_USAGE)
+		cip->usage++;
+
 	return (char *)cih + sizeof(POOL_CACHE_ITEM_HEADER);
 }
 
@@ -2374,8 +2962,10 @@ static char *pool_get_item_shmem_cache(POOL_QUERY_HASH *query_hash, int *size, i
  * Find data on shared memory cache specified query hash.
  * On success returns cache id.
  * The cache id is overwritten by the subsequent call to this function.
+ * If "stale" is not NULL, an expired item still in memqcache_stale_grace
+ * is returned as well, and *stale is set to true.
  */
-static POOL_CACHEID *pool_find_item_on_shmem_cache(POOL_QUERY_HASH *query_hash)
+static POOL_CACHEID *pool_find_item_on_shmem_cache(POOL_QUERY_HASH *query_hash, bool *stale)
 {
 	static POOL_CACHEID cacheid;
 	POOL_CACHEID *c;
@@ -2394,13 +2984,30 @@ static POOL_CACHEID *pool_find_item_on_shmem_cache(POOL_QUERY_HASH *query_hash)
 	if (pool_config->memqcache_expire > 0)
 	{
 		now = time(NULL);
-		if (now > (cih->timestamp + pool_config->memqcache_expire))
+		if (now > (cih->timestamp + pool_config->memqcache_expire) &&
+			stale != NULL &&
+			now <= (cih->timestamp + pool_config->memqcache_expire + pool_config->memqcache_stale_grace))
+		{
+			ereport(DEBUG1,
+				(errmsg("memcache finding item"),
+					errdetail("cache is stale: now: %ld timestamp: %ld",
+						   now, cih->timestamp + pool_config->memqcache_expire)));
+			*stale = true;
+		}
+		else if (now > (cih->timestamp + pool_config->memqcache_expire))
 		{
 			ereport(DEBUG1,
 				(errmsg("memcache finding item"),
 					errdetail("cache expired: now: %ld timestamp: %ld",
 						   now, cih->timestamp + pool_config->memqcache_expire)));
-			pool_delete_item_shmem_cache(c);
+
+			/*
+			 * Under a shared lock we must not modify the cache.  The
+			 * item is deleted when a new result for the query is
+			 * committed.
+			 */
+			if (shmem_lock_mode == SHMEM_EXCLUSIVE)
+				pool_delete_item_shmem_cache(c);
 			return NULL;
 		}
 	}
@@ -2479,44 +3086,49 @@ static int pool_delete_item_shmem_cache(POOL_CACHEID *cacheid)
 	memcpy(&key, &cip->query_hash, sizeof(POOL_QUERY_HASH));
 
 	cih = pool_cache_item_header(cacheid);
-	size = cih->total_length + sizeof(POOL_CACHE_ITEM_POINTER);
 
 	/* Delete item pointer */
 	cip->flags |= POOL_ITEM_DELETED;
-
-	/*
-	 * We do NOT count down bh->num_items here. The deleted space will be recycled
-	 * by pool_add_item_shmem_cache(). However, if this is the last item, we can
-	 * recycle whole block.
-	 *
-	 * 2012/4/1: Now we do not pack data in
-	 * pool_add_item_shmem_cache() for performance reason. Also we
-	 * count down num_items if it is the last one.
-	 */
-	if ((bh->num_items -1) == 0)
-	{
-		ereport(DEBUG1,
-			(errmsg("memcache deleting item data"),
-				 errdetail("no item remains. initialize block")));
-		bh->flags = 0;
-		pool_init_cache_block(cacheid->blockid);
-	}
+	bh->deleted_bytes += cih->total_length - sizeof(POOL_CACHE_ITEM_HEADER);
 
 	/* Remove hash index */
 	pool_hash_delete(&key);
 
 	/*
-	 * If the deleted item is last one in the block, we add it to the free space.
+	 * We do NOT count down bh->num_items here. The deleted space will be
+	 * recycled by pool_compact_block(), which keeps item ids as they
+	 * are. However, if this is the last item, we add it to the free
+	 * space along with the deleted items just before it, and if no item
+	 * remains, we can recycle whole block.
 	 */
 	if (cacheid->itemid == (bh->num_items -1))
 	{
-		bh->free_bytes += size;
-		ereport(DEBUG1,
-			(errmsg("memcache deleting item data"),
-				errdetail("deleted %d bytes, freebytes is = %d",
-					   size, bh->free_bytes)));
+		while (bh->num_items > 0)
+		{
+			cip = item_pointer(block_address(cacheid->blockid), bh->num_items - 1);
+			if (!(cip->flags & POOL_ITEM_DELETED))
+				break;
 
-		bh->num_items--;
+			cih = item_header(block_address(cacheid->blockid), bh->num_items - 1);
+			size = cih->total_length + sizeof(POOL_CACHE_ITEM_POINTER);
+			bh->free_bytes += size;
+			bh->deleted_bytes -= cih->total_length - sizeof(POOL_CACHE_ITEM_HEADER);
+			ereport(DEBUG1,
+				(errmsg("memcache deleting item data"),
+					errdetail("deleted %d bytes, freebytes is = %d",
+						   size, bh->free_bytes)));
+
+			bh->num_items--;
+		}
+
+		if (bh->num_items == 0)
+		{
+			ereport(DEBUG1,
+				(errmsg("memcache deleting item data"),
+					 errdetail("no item remains. initialize block")));
+			bh->flags = 0;
+			pool_init_cache_block(cacheid->blockid);
+		}
 	}
 
 	/* Update FSMM */
@@ -2614,14 +3226,28 @@ static void pool_wipe_out_cache_block(POOL_CACHE_BLOCKID blockid)
 #endif
 
 /*
- * Acquire lock: XXX giant lock
+ * Acquire lock in exclusive mode.  Needed for anything modifying the
+ * cache.
  */
 void pool_shmem_lock(void)
 {
 	if (pool_is_shmem_cache())
 	{
-		pool_semaphore_lock(SHM_CACHE_SEM);
+		pool_semaphore_lock_exclusive(SHM_CACHE_SEM, SHM_CACHE_WRITER_SEM);
+		shmem_lock_mode = SHMEM_EXCLUSIVE;
+	}
+}
 
+/*
+ * Acquire lock in shared mode.  Any number of processes can look up the
+ * cache at the same time.
+ */
+void pool_shmem_lock_shared(void)
+{
+	if (pool_is_shmem_cache())
+	{
+		pool_semaphore_lock_shared(SHM_CACHE_SEM, SHM_CACHE_WRITER_SEM);
+		shmem_lock_mode = SHMEM_SHARED;
 	}
 }
 
@@ -2632,7 +3258,11 @@ void pool_shmem_unlock(void)
 {
 	if (pool_is_shmem_cache())
 	{
-		pool_semaphore_unlock(SHM_CACHE_SEM);
+		if (shmem_lock_mode == SHMEM_SHARED)
+			pool_semaphore_unlock_shared(SHM_CACHE_SEM);
+		else if (shmem_lock_mode == SHMEM_EXCLUSIVE)
+			pool_semaphore_unlock_exclusive(SHM_CACHE_SEM, SHM_CACHE_WRITER_SEM);
+		shmem_lock_mode = SHMEM_UNLOCKED;
 	}
 }
 
@@ -3133,20 +3763,35 @@ void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *n
 				 * If we are not inside a transaction, we can
 				 * immediately register to cache storage.
 				 */
-				/* Register to memcached or shmem */
-				POOL_SETMASK2(&BlockSig, &oldmask);
-				pool_shmem_lock();
-
 				cache_buffer =  pool_get_current_cache_buffer(&len);
 				if (cache_buffer)
 				{
 					if (session_context->query_context->skip_cache_commit == false)
 					{
-						if (pool_commit_cache(backend, query, cache_buffer, len, num_oids, oids) != 0)
+						char *compressed;
+						size_t size;
+
+						compressed = pool_compress_cache_data(cache_buffer, len, &size);
+
+						/* Register to memcached or shmem */
+						POOL_SETMASK2(&BlockSig, &oldmask);
+						pool_shmem_lock();
+
+						if (pool_commit_cache(backend, query,
+											  compressed ? compressed : cache_buffer,
+											  compressed ? size : len,
+											  compressed ? len : 0,
+											  num_oids, oids) != 0)
 						{
 							ereport(WARNING,
 									(errmsg("ReadyForQuery: pool_commit_cache failed")));
 						}
+
+						pool_shmem_unlock();
+						POOL_SETMASK(&oldmask);
+
+						if (compressed)
+							pfree(compressed);
 					}
 					/*
 					 * Reset temporary query cache buffer. This is
@@ -3169,8 +3814,6 @@ void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *n
 						session_context->query_context->temp_cache = pool_create_temp_query_cache(query);
 					pfree(cache_buffer);
 				}
-				pool_shmem_unlock();
-				POOL_SETMASK(&oldmask);
 			}
 
 			/* Count up SELECT stats */
@@ -3234,6 +3877,34 @@ void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *n
 	else if (is_commit_query(node))		/* Commit? */
 	{
 		int num_caches;
+		char **buffers = NULL;
+		size_t *buffer_len = NULL;
+		char **compressed = NULL;
+		size_t *compressed_len = NULL;
+
+		/*
+		 * Take out and compress the results to be registered before
+		 * acquiring the lock.
+		 */
+		num_caches = session_context->query_cache_array->num_caches;
+		if (num_caches > 0)
+		{
+			buffers = palloc0(sizeof(char *) * num_caches);
+			buffer_len = palloc0(sizeof(size_t) * num_caches);
+			compressed = palloc0(sizeof(char *) * num_caches);
+			compressed_len = palloc0(sizeof(size_t) * num_caches);
+		}
+		for (i=0;i<num_caches;i++)
+		{
+			POOL_TEMP_QUERY_CACHE *cache;
+
+			cache = session_context->query_cache_array->caches[i];
+			if (!cache || cache->is_discarded)
+				continue;
+
+			buffers[i] = pool_get_buffer(cache->buffer, &buffer_len[i]);
+			compressed[i] = pool_compress_cache_data(buffers[i], buffer_len[i], &compressed_len[i]);
+		}
 
 		POOL_SETMASK2(&BlockSig, &oldmask);
 		pool_shmem_lock();
@@ -3252,32 +3923,47 @@ void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *n
 		 * - We had only SELECTs after last DML
 		 * Thus we can register SELECT results to cache storage.
 		 */
-		num_caches = session_context->query_cache_array->num_caches;
 		for (i=0;i<num_caches;i++)
 		{
 			POOL_TEMP_QUERY_CACHE *cache;
 
 			cache = session_context->query_cache_array->caches[i];
-			if (!cache || cache->is_discarded)
+			if (!cache || cache->is_discarded || !buffers[i])
 				continue;
 
 			num_oids = cache->num_oids;
 			oids = pool_get_buffer(cache->oids, &len);
-			cache_buffer = pool_get_buffer(cache->buffer, &len);
-						
-			if (pool_commit_cache(backend, cache->query, cache_buffer, len, num_oids, oids) != 0)
+
+			if (pool_commit_cache(backend, cache->query,
+								  compressed[i] ? compressed[i] : buffers[i],
+								  compressed[i] ? compressed_len[i] : buffer_len[i],
+								  compressed[i] ? buffer_len[i] : 0,
+								  num_oids, oids) != 0)
 			{
 				ereport(WARNING,
 						(errmsg("ReadyForQuery: pool_commit_cache failed")));
 			}
 			if (oids)
 				pfree(oids);
-			if (cache_buffer)
-				pfree(cache_buffer);
 		}
 		pool_shmem_unlock();
 		POOL_SETMASK(&oldmask);
 
+		for (i=0;i<num_caches;i++)
+		{
+			if (buffers[i])
+				pfree(buffers[i]);
+			if (compressed[i])
+				pfree(compressed[i]);
+		}
+		if (num_caches > 0)
+		{
+			pfree(buffers);
+			pfree(buffer_len);
+			pfree(compressed);
+			pfree(compressed_len);
+		}
+
 		/* Count up number of SELECT stats */
 		pool_stats_count_up_num_selects(pool_tmp_stats_get_num_selects());
 
@@ -3307,11 +3993,13 @@ void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *n
 		else if (is_drop_database(node) && session_context->query_context->dboid != 0)
 		{
 			int dboid = session_context->query_context->dboid;
+
+			/* The oid map on shmem must be looked up under the lock */
+			pool_shmem_lock();
 			num_oids = pool_get_dropdb_table_oids(&oids, dboid);
 
 			if (num_oids > 0 && pool_config->memqcache_auto_cache_invalidation)
 			{
-				pool_shmem_lock();
 				pool_invalidate_query_cache(num_oids, oids, true, dboid);
 				pool_discard_oid_maps_by_db(dboid);
 				pool_shmem_unlock();
@@ -3322,6 +4010,8 @@ void pool_handle_query_cache(POOL_CONNECTION_POOL *backend, char *query, Node *n
 					(errmsg("query cache handler for ReadyForQuery"),
 						 errdetail("deleted all cache files for the DROPped DB")));
 			}
+			else
+				pool_shmem_unlock();
 		}
 		else
 		{
@@ -3480,6 +4170,22 @@ long long int pool_stats_count_up_num_cache_hits(void)
 	return stats->num_cache_hits;
 }
 
+/*
+ * Count up number of evicted cache entries and returns the number.
+ * QUERY_CACHE_STATS_SEM lock is acquired in this function.
+ */
+long long int pool_stats_count_up_num_evictions(long long int num)
+{
+	pool_sigset_t oldmask;
+
+	POOL_SETMASK2(&BlockSig, &oldmask);
+	pool_semaphore_lock(QUERY_CACHE_STATS_SEM);
+	stats->num_evictions += num;
+	pool_semaphore_unlock(QUERY_CACHE_STATS_SEM);
+	POOL_SETMASK(&oldmask);
+	return stats->num_evictions;
+}
+
 /*
  * On shared memory hash table implementation.  We use sub part of md5
  * hash key as hash function.  The experiment has shown that has_any()
@@ -3872,6 +4578,868 @@ static bool is_free_hash_element(void)
 	return hash_free->next != NULL;
 }
 
+/*
+ * On shared memory table oid map implementation.  This maps (database
+ * oid, table oid) to the cache ids using the table, and replaces the
+ * memqcache_oiddir files in shmem case.  Each cache entry uses one
+ * element per table, which are chained from the bucket of the table.
+ * Elements are addressed by index so that the free list can live on
+ * shared memory as well.  Elements are never touched when a cache
+ * entry is removed by other means (expiration, block reuse), rather
+ * they are removed lazily once they are found to be pointing to a cache
+ * entry which no longer exists.  Caller must hold shmem lock in
+ * exclusive mode except for pool_oidmap_init.
+ */
+static volatile POOL_OIDMAP_HEADER *oidmap_header;
+static volatile POOL_OIDMAP_ELEMENT *oidmap_elements;
+
+static uint32 oidmap_hash(int dboid, int tableoid);
+static uint32 oidmap_query_key(POOL_QUERY_HASH *query_hash);
+static bool oidmap_element_is_alive(volatile POOL_OIDMAP_ELEMENT *element);
+static void oidmap_put_back_element(int index);
+static int oidmap_reclaim_elements(void);
+
+/*
+ * Initialize table oid map on shared memory. "nelements" is max number
+ * of cache entries. The number of buckets is rounded up to power of 2.
+ */
+int pool_oidmap_init(int nelements)
+{
+	size_t size;
+	int nbuckets;
+	POOL_OIDMAP_HEADER oh;
+
+	if (nelements <= 0)
+		ereport(ERROR,
+			(errmsg("initializing oid map on shared memory, invalid number of elements: %d",nelements)));
+
+	nbuckets = 1;
+	while (nbuckets < nelements)
+		nbuckets <<= 1;
+
+	size = (char *)&oh.buckets - (char *)&oh + sizeof(int)*nbuckets;
+	oidmap_header = pool_shared_memory_create(size);
+	oidmap_header->nbuckets = nbuckets;
+	oidmap_header->mask = nbuckets - 1;
+	oidmap_header->nelements = nelements * POOL_OIDMAP_ELEMENTS_PER_CACHE;
+
+	size = sizeof(POOL_OIDMAP_ELEMENT)*oidmap_header->nelements;
+	oidmap_elements = pool_shared_memory_create(size);
+
+	ereport(DEBUG1,
+		(errmsg("initializing oid map on shared memory"),
+			 errdetail("buckets:%d elements:%d", nbuckets, oidmap_header->nelements)));
+
+	pool_oidmap_reset();
+
+	return 0;
+}
+
+/*
+ * Remove all elements from the oid map.
+ */
+static void pool_oidmap_reset(void)
+{
+	int i;
+
+	for (i=0;i<oidmap_header->nbuckets;i++)
+		oidmap_header->buckets[i] = -1;
+
+	for (i=0;i<oidmap_header->nelements-1;i++)
+		oidmap_elements[i].next = i+1;
+	oidmap_elements[oidmap_header->nelements-1].next = -1;
+	oidmap_header->free = 0;
+}
+
+/*
+ * Register the cache entry specified by cacheid as a user of the
+ * table. Returns 0 on success, -1 if there's no room in the oid map.
+ */
+static int pool_oidmap_add(int dboid, int tableoid, POOL_CACHEID *cacheid)
+{
+	volatile POOL_OIDMAP_ELEMENT *element;
+	POOL_CACHE_ITEM_POINTER *cip;
+	uint32 bucket = oidmap_hash(dboid, tableoid);
+	int *prev;
+	int index;
+
+	/*
+	 * Remove dead elements in the bucket while we are here so that they
+	 * do not pile up.
+	 */
+	prev = (int *)&oidmap_header->buckets[bucket];
+	while ((index = *prev) >= 0)
+	{
+		element = &oidmap_elements[index];
+		if (!oidmap_element_is_alive(element))
+		{
+			*prev = element->next;
+			oidmap_put_back_element(index);
+			continue;
+		}
+		prev = (int *)&element->next;
+	}
+
+	if (oidmap_header->free < 0 && oidmap_reclaim_elements() == 0)
+	{
+		ereport(LOG,
+				(errmsg("memcache: adding table oid map. no free element"),
+				 errdetail("consider increasing memqcache_max_num_cache")));
+		return -1;
+	}
+
+	index = oidmap_header->free;
+	element = &oidmap_elements[index];
+	oidmap_header->free = element->next;
+
+	cip = item_pointer(block_address(cacheid->blockid), cacheid->itemid);
+
+	element->dboid = dboid;
+	element->tableoid = tableoid;
+	element->query_key = oidmap_query_key(&cip->query_hash);
+	memcpy((void *)&element->cacheid, cacheid, sizeof(POOL_CACHEID));
+	element->next = oidmap_header->buckets[bucket];
+	oidmap_header->buckets[bucket] = index;
+
+	return 0;
+}
+
+/*
+ * Delete all cache entries using the table, and remove the table from
+ * the oid map.
+ */
+static void pool_oidmap_invalidate(int dboid, int tableoid)
+{
+	volatile POOL_OIDMAP_ELEMENT *element;
+	uint32 bucket = oidmap_hash(dboid, tableoid);
+	int *prev;
+	int index;
+
+	prev = (int *)&oidmap_header->buckets[bucket];
+	while ((index = *prev) >= 0)
+	{
+		element = &oidmap_elements[index];
+		if (element->dboid == dboid && element->tableoid == tableoid)
+		{
+			if (oidmap_element_is_alive(element))
+			{
+				ereport(DEBUG1,
+					(errmsg("memcache invalidating query cache"),
+						errdetail("deleting cacheid:%d itemid:%d",
+							   element->cacheid.blockid, element->cacheid.itemid)));
+				pool_delete_item_shmem_cache((POOL_CACHEID *)&element->cacheid);
+			}
+			*prev = element->next;
+			oidmap_put_back_element(index);
+			continue;
+		}
+		prev = (int *)&element->next;
+	}
+}
+
+/*
+ * Collect table oids in the database registered to the oid map. Returns
+ * the number of table oids.
+ */
+static int pool_oidmap_get_db_table_oids(int **oids, int dboid)
+{
+	int *rtn = NULL;
+	int oids_size = 0;
+	int num_oids = 0;
+	int i, j;
+	int index;
+
+	for (i=0;i<oidmap_header->nbuckets;i++)
+	{
+		for (index = oidmap_header->buckets[i]; index >= 0; index = oidmap_elements[index].next)
+		{
+			int oid;
+
+			if (oidmap_elements[index].dboid != dboid)
+				continue;
+
+			oid = oidmap_elements[index].tableoid;
+			for (j=0;j<num_oids;j++)
+			{
+				if (rtn[j] == oid)
+					break;
+			}
+			if (j < num_oids)
+				continue;
+
+			if (num_oids >= oids_size)
+			{
+				oids_size += POOL_OIDBUF_SIZE;
+				if (rtn)
+					rtn = repalloc(rtn, sizeof(int) * oids_size);
+				else
+					rtn = palloc(sizeof(int) * oids_size);
+			}
+			rtn[num_oids++] = oid;
+		}
+	}
+
+	*oids = rtn;
+	return num_oids;
+}
+
+/*
+ * Remove all elements belonging to the database from the oid map.
+ */
+static void pool_oidmap_discard_db(int dboid)
+{
+	int i;
+	int *prev;
+	int index;
+
+	for (i=0;i<oidmap_header->nbuckets;i++)
+	{
+		prev = (int *)&oidmap_header->buckets[i];
+		while ((index = *prev) >= 0)
+		{
+			if (oidmap_elements[index].dboid == dboid)
+			{
+				*prev = oidmap_elements[index].next;
+				oidmap_put_back_element(index);
+				continue;
+			}
+			prev = (int *)&oidmap_elements[index].next;
+		}
+	}
+}
+
+/*
+ * Calculate bucket of the oid map from database oid and table oid.
+ */
+static uint32 oidmap_hash(int dboid, int tableoid)
+{
+	uint32 h;
+
+	h = (uint32)dboid * 2654435761U;
+	h ^= (uint32)tableoid * 2246822519U;
+	h ^= h >> 15;
+	return h & oidmap_header->mask;
+}
+
+/*
+ * Calculate 32bit key of the cache entry from its MD5 hash key. This is
+ * used to tell whether the cache entry pointed to by the cache id is
+ * still the one we registered.
+ */
+static uint32 oidmap_query_key(POOL_QUERY_HASH *query_hash)
+{
+	char md5[POOL_HASH_NCHARS+1];
+
+	memcpy(md5, query_hash->query_hash, POOL_HASH_NCHARS);
+	md5[POOL_HASH_NCHARS] = '\0';
+	return strtoul(md5, NULL, 16);
+}
+
+/*
+ * Returns true if the cache entry pointed to by the element still
+ * exists.
+ */
+static bool oidmap_element_is_alive(volatile POOL_OIDMAP_ELEMENT *element)
+{
+	POOL_CACHE_BLOCK_HEADER *bh;
+	POOL_CACHE_ITEM_POINTER *cip;
+	char *block;
+
+	if (element->cacheid.blockid >= pool_get_memqcache_blocks())
+		return false;
+
+	block = block_address(element->cacheid.blockid);
+	bh = (POOL_CACHE_BLOCK_HEADER *)block;
+	if (!(bh->flags & POOL_BLOCK_USED) || element->cacheid.itemid >= bh->num_items)
+		return false;
+
+	cip = item_pointer(block, element->cacheid.itemid);
+	if (!(cip->flags & POOL_ITEM_USED) || (cip->flags & POOL_ITEM_DELETED))
+		return false;
+
+	return oidmap_query_key(&cip->query_hash) == element->query_key;
+}
+
+/*
+ * Put back the element to free list.
+ */
+static void oidmap_put_back_element(int index)
+{
+	oidmap_elements[index].next = oidmap_header->free;
+	oidmap_header->free = index;
+}
+
+/*
+ * Scan whole oid map and remove dead elements. Called when there's no
+ * free element. Returns the number of reclaimed elements.
+ */
+static int oidmap_reclaim_elements(void)
+{
+	int i;
+	int *prev;
+	int index;
+	int reclaimed = 0;
+
+	for (i=0;i<oidmap_header->nbuckets;i++)
+	{
+		prev = (int *)&oidmap_header->buckets[i];
+		while ((index = *prev) >= 0)
+		{
+			if (!oidmap_element_is_alive(&oidmap_elements[index]))
+			{
+				*prev = oidmap_elements[index].next;
+				oidmap_put_back_element(index);
+				reclaimed++;
+				continue;
+			}
+			prev = (int *)&oidmap_elements[index].next;
+		}
+	}
+
+	ereport(DEBUG1,
+		(errmsg("memcache: reclaimed %d oid map elements", reclaimed)));
+
+	return reclaimed;
+}
+
+/*
+ * In-flight query registry on shared memory. When a cache safe SELECT
+ * misses the cache, or hits a stale cache entry to be refreshed, the
+ * child registers the cache key of the query here before sending it to
+ * backends.  Other children receiving the same query wait for the
+ * result to be registered to the cache, or keep on using the stale
+ * entry, rather than sending the same query to backends at the same
+ * time. Each child owns the slot indexed by its my_proc_id.
+ *
+ * The registry is protected by INFLIGHT_QUERY_SEM, not by the cache
+ * lock, so that waiting children do not block cache lookups of others.
+ * Whether the owner of a slot is still alive is checked outside of the
+ * lock.
+ *
+ * Since a child has only one slot, coalescing is not done when the child
+ * multiplexes client sessions (max_sessions_per_child > 1): a waiting
+ * session would stall the other sessions of the child, and the sessions
+ * would overwrite each other's slot.
+ */
+static volatile POOL_INFLIGHT_QUERY *inflight_queries;
+static bool inflight_query_registered = false;	/* true if my slot is in use */
+
+static bool inflight_registry_usable(void);
+static int inflight_find_owner(POOL_QUERY_HASH *query_hash, pid_t *pid);
+static bool inflight_owner_gone(int owner, pid_t pid);
+static void inflight_register(POOL_QUERY_HASH *query_hash);
+static long inflight_elapsed_ms(struct timeval *start);
+
+/*
+ * Initialize in-flight query registry on shared memory. "nslots" is
+ * the number of child processes.
+ */
+int pool_inflight_query_init(int nslots)
+{
+	size_t size;
+	int i;
+
+	if (nslots <= 0)
+		ereport(ERROR,
+			(errmsg("initializing in-flight query registry, invalid number of slots: %d",nslots)));
+
+	size = sizeof(POOL_INFLIGHT_QUERY)*nslots;
+	inflight_queries = pool_shared_memory_create(size);
+
+	for (i=0;i<nslots;i++)
+		inflight_queries[i].pid = 0;
+
+	ereport(DEBUG1,
+		(errmsg("initializing in-flight query registry on shared memory"),
+			 errdetail("slots:%d", nslots)));
+
+	return 0;
+}
+
+/*
+ * Called when a cache safe SELECT query has not been found in the
+ * cache.  If no other child is executing the same query, register the
+ * query as being executed by us and return with *foundp set to false.
+ * The caller should go ahead and send the query to backends.  Otherwise
+ * wait at most memqcache_coalesce_timeout milliseconds for the other
+ * child to register the result to the cache, and send the cached result
+ * to frontend. *foundp is set to true in this case.
+ */
+POOL_STATUS pool_coalesce_cache_miss(POOL_CONNECTION *frontend,
+									 POOL_CONNECTION_POOL *backend,
+									 char *contents, bool *foundp)
+{
+	char tmpkey[MAX_KEY];
+	POOL_QUERY_HASH query_hash;
+	pool_sigset_t oldmask;
+	struct timeval start;
+	POOL_STATUS status;
+	int owner;
+	pid_t owner_pid;
+
+	*foundp = false;
+
+	if (pool_config->memqcache_coalesce_timeout <= 0 || !inflight_registry_usable())
+		return POOL_CONTINUE;
+
+	encode_key(contents, tmpkey, backend);
+	memcpy(query_hash.query_hash, tmpkey, sizeof(query_hash.query_hash));
+
+	gettimeofday(&start, NULL);
+
+	for (;;)
+	{
+		POOL_SETMASK2(&BlockSig, &oldmask);
+		pool_semaphore_lock(INFLIGHT_QUERY_SEM);
+
+		owner = inflight_find_owner(&query_hash, &owner_pid);
+		if (owner < 0)
+		{
+			/* Nobody is executing the query. We are the one to execute it. */
+			inflight_register(&query_hash);
+		}
+		else if (inflight_elapsed_ms(&start) >= pool_config->memqcache_coalesce_timeout)
+		{
+			/*
+			 * Give up waiting. Unregister the owner so that the following
+			 * children do not wait for it again, and execute the query by
+			 * ourselves.
+			 */
+			inflight_queries[owner].pid = 0;
+			owner = -1;
+			ereport(DEBUG1,
+				(errmsg("memcache: timed out waiting for other child executing the same query"),
+				 errdetail("query: %s", contents)));
+		}
+
+		pool_semaphore_unlock(INFLIGHT_QUERY_SEM);
+		POOL_SETMASK(&oldmask);
+
+		if (owner < 0)
+			return POOL_CONTINUE;
+
+		/* The owner exited without releasing the slot. Try again. */
+		if (inflight_owner_gone(owner, owner_pid))
+			continue;
+
+		usleep(POOL_INFLIGHT_POLL_INTERVAL * 1000);
+
+		status = pool_fetch_from_memory_cache(frontend, backend, contents, foundp);
+		if (status != POOL_CONTINUE || *foundp)
+		{
+			if (*foundp)
+				ereport(DEBUG1,
+					(errmsg("memcache: fetched the result of the query executed by other child"),
+					 errdetail("query: %s", contents)));
+			return status;
+		}
+	}
+}
+
+/*
+ * Unregister the query executed by us, if any. Called after the result
+ * of the query has been registered to the cache, or the query turned
+ * out not to be cached, failed, or the session ended.
+ */
+void pool_release_inflight_query(void)
+{
+	pool_sigset_t oldmask;
+
+	if (!inflight_query_registered)
+		return;
+
+	POOL_SETMASK2(&BlockSig, &oldmask);
+	pool_semaphore_lock(INFLIGHT_QUERY_SEM);
+
+	/* The slot may have been taken back by a waiter timed out */
+	if (inflight_queries[my_proc_id].pid == getpid())
+		inflight_queries[my_proc_id].pid = 0;
+	inflight_query_registered = false;
+
+	pool_semaphore_unlock(INFLIGHT_QUERY_SEM);
+	POOL_SETMASK(&oldmask);
+}
+
+/*
+ * Called when an expired cache entry still in memqcache_stale_grace is
+ * found.  Returns true if we should refresh the entry by executing the
+ * query, that is, nobody else is executing it.  In this case we are
+ * registered as the executor of the query until the next ReadyForQuery.
+ * The entry is not refreshed inside transaction since the result is
+ * not cached until commit.  If the registry cannot be used, every child
+ * finding the entry refreshes it, as if the entry had expired.
+ */
+static bool pool_claim_cache_revalidation(POOL_CONNECTION_POOL *backend, const char *query)
+{
+	char tmpkey[MAX_KEY];
+	POOL_QUERY_HASH query_hash;
+	pool_sigset_t oldmask;
+	int owner;
+	pid_t owner_pid;
+
+	if (TSTATE(backend, MASTER_SLAVE ? PRIMARY_NODE_ID : REAL_MASTER_NODE_ID) != 'I')
+		return false;
+
+	if (!inflight_registry_usable())
+		return true;
+
+	encode_key(query, tmpkey, backend);
+	memcpy(query_hash.query_hash, tmpkey, sizeof(query_hash.query_hash));
+
+	for (;;)
+	{
+		POOL_SETMASK2(&BlockSig, &oldmask);
+		pool_semaphore_lock(INFLIGHT_QUERY_SEM);
+
+		owner = inflight_find_owner(&query_hash, &owner_pid);
+		if (owner < 0)
+			inflight_register(&query_hash);
+
+		pool_semaphore_unlock(INFLIGHT_QUERY_SEM);
+		POOL_SETMASK(&oldmask);
+
+		if (owner < 0)
+			return true;
+
+		if (!inflight_owner_gone(owner, owner_pid))
+			return false;
+	}
+}
+
+/*
+ * Returns true if this process can use the in-flight query registry.
+ */
+static bool inflight_registry_usable(void)
+{
+	return pool_is_shmem_cache() && inflight_queries != NULL &&
+		my_proc_id >= 0 && my_proc_id < pool_config->num_init_children &&
+		pool_config->max_sessions_per_child <= 1;
+}
+
+/*
+ * Search the registry for the child executing the query other than us.
+ * Returns the slot index and sets *pid to the pid of the child, or
+ * returns -1 if not found.  Caller must hold INFLIGHT_QUERY_SEM.
+ */
+static int inflight_find_owner(POOL_QUERY_HASH *query_hash, pid_t *pid)
+{
+	int i;
+
+	for (i=0;i<pool_config->num_init_children;i++)
+	{
+		if (inflight_queries[i].pid == 0 || i == my_proc_id)
+			continue;
+
+		if (memcmp((char *)inflight_queries[i].query_hash.query_hash, query_hash->query_hash,
+				   sizeof(query_hash->query_hash)) == 0)
+		{
+			*pid = inflight_queries[i].pid;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Returns true if the child "pid" owning the slot has gone away.  The
+ * slot is cleared then, unless it has been reused meanwhile.  Must be
+ * called without holding INFLIGHT_QUERY_SEM.
+ */
+static bool inflight_owner_gone(int owner, pid_t pid)
+{
+	pool_sigset_t oldmask;
+
+	if (kill(pid, 0) == 0 || errno != ESRCH)
+		return false;
+
+	POOL_SETMASK2(&BlockSig, &oldmask);
+	pool_semaphore_lock(INFLIGHT_QUERY_SEM);
+	if (inflight_queries[owner].pid == pid)
+		inflight_queries[owner].pid = 0;
+	pool_semaphore_unlock(INFLIGHT_QUERY_SEM);
+	POOL_SETMASK(&oldmask);
+
+	return true;
+}
+
+/*
+ * Register us as the executor of the query.  Caller must hold
+ * INFLIGHT_QUERY_SEM.
+ */
+static void inflight_register(POOL_QUERY_HASH *query_hash)
+{
+	inflight_queries[my_proc_id].query_hash = *query_hash;
+	inflight_queries[my_proc_id].pid = getpid();
+	inflight_query_registered = true;
+}
+
+/*
+ * Returns elapsed time since "start" in milliseconds.
+ */
+static long inflight_elapsed_ms(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_usec - start->tv_usec) / 1000;
+}
+
+/*
+ * Query cache snapshot. At clean shutdown of pgpool main process, the
+ * cache blocks and the table oid map are written to
+ * memqcache_snapshot_file, and they are loaded at the next start up if
+ * the file was made with the same cache layout and backends. The hash
+ * table and FSMM are not saved since they can be rebuilt from the item
+ * pointers in the cache blocks. The snapshot file is removed once it
+ * has been loaded, so that the cache saved before a crash is never used
+ * again: DML executed after loading would not be reflected in it.
+ */
+static uint64 snapshot_identity(void);
+static bool snapshot_write(int fd, void *buf, size_t len);
+static bool snapshot_read(int fd, void *buf, size_t len);
+static void snapshot_rebuild_index(void);
+
+/*
+ * Save the shared memory query cache to memqcache_snapshot_file. This
+ * should be called from pgpool main process after all the child
+ * processes have exited.
+ */
+void pool_save_memory_cache(void)
+{
+	POOL_CACHE_SNAPSHOT_HEADER header;
+	char tmppath[POOLMAXPATHLEN+1];
+	char *path = pool_config->memqcache_snapshot_file;
+	int fd;
+	bool ok;
+
+	if (!pool_config->memory_cache_enabled || !pool_is_shmem_cache() ||
+		path == NULL || *path == '\0' || shmem == NULL)
+		return;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	if ((fd = open(tmppath, O_CREAT|O_TRUNC|O_WRONLY, S_IRUSR|S_IWUSR)) == -1)
+	{
+		ereport(WARNING,
+				(errmsg("memcache: saving query cache snapshot, failed to open file:\"%s\". error:\"%s\"", tmppath, strerror(errno))));
+		return;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, POOL_CACHE_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = POOL_CACHE_SNAPSHOT_VERSION;
+	header.identity = snapshot_identity();
+	header.num_blocks = pool_get_memqcache_blocks();
+	header.block_size = pool_config->memqcache_cache_block_size;
+	header.oidmap_nbuckets = oidmap_header->nbuckets;
+	header.oidmap_nelements = oidmap_header->nelements;
+	header.created = time(NULL);
+
+	ok = snapshot_write(fd, &header, sizeof(header)) &&
+		snapshot_write(fd, shmem, (size_t)header.num_blocks * header.block_size) &&
+		snapshot_write(fd, (void *)&oidmap_header->free, sizeof(int)) &&
+		snapshot_write(fd, (void *)oidmap_header->buckets, sizeof(int)*header.oidmap_nbuckets) &&
+		snapshot_write(fd, (void *)oidmap_elements, sizeof(POOL_OIDMAP_ELEMENT)*header.oidmap_nelements);
+
+	if (fsync(fd) == -1)
+		ok = false;
+	close(fd);
+
+	if (!ok || rename(tmppath, path) == -1)
+	{
+		ereport(WARNING,
+				(errmsg("memcache: saving query cache snapshot, failed to write file:\"%s\". error:\"%s\"", path, strerror(errno))));
+		unlink(tmppath);
+		return;
+	}
+
+	ereport(LOG,
+			(errmsg("memcache: saved query cache snapshot to \"%s\"", path)));
+}
+
+/*
+ * Load the shared memory query cache from memqcache_snapshot_file if it
+ * exists. This should be called only once from pgpool main process at
+ * the process staring up time, after all the shared memory cache
+ * structures are initialized.
+ */
+void pool_load_memory_cache(void)
+{
+	POOL_CACHE_SNAPSHOT_HEADER header;
+	char *path = pool_config->memqcache_snapshot_file;
+	int fd;
+	bool ok;
+
+	if (!pool_config->memory_cache_enabled || !pool_is_shmem_cache() ||
+		path == NULL || *path == '\0')
+		return;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+	{
+		if (errno != ENOENT)
+			ereport(WARNING,
+					(errmsg("memcache: loading query cache snapshot, failed to open file:\"%s\". error:\"%s\"", path, strerror(errno))));
+		return;
+	}
+
+	if (!snapshot_read(fd, &header, sizeof(header)) ||
+		memcmp(header.magic, POOL_CACHE_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != POOL_CACHE_SNAPSHOT_VERSION ||
+		header.identity != snapshot_identity() ||
+		header.num_blocks != pool_get_memqcache_blocks() ||
+		header.block_size != pool_config->memqcache_cache_block_size ||
+		header.oidmap_nbuckets != oidmap_header->nbuckets ||
+		header.oidmap_nelements != oidmap_header->nelements)
+	{
+		ereport(LOG,
+				(errmsg("memcache: query cache snapshot \"%s\" is ignored", path),
+				 errdetail("the snapshot was made with different cache configuration or backends")));
+		close(fd);
+		unlink(path);
+		return;
+	}
+
+	ok = snapshot_read(fd, shmem, (size_t)header.num_blocks * header.block_size) &&
+		snapshot_read(fd, (void *)&oidmap_header->free, sizeof(int)) &&
+		snapshot_read(fd, (void *)oidmap_header->buckets, sizeof(int)*header.oidmap_nbuckets) &&
+		snapshot_read(fd, (void *)oidmap_elements, sizeof(POOL_OIDMAP_ELEMENT)*header.oidmap_nelements);
+	close(fd);
+	unlink(path);
+
+	if (!ok)
+	{
+		ereport(WARNING,
+				(errmsg("memcache: loading query cache snapshot, failed to read file:\"%s\"", path),
+				 errdetail("starting with empty query cache")));
+		memset(shmem, 0, (size_t)header.num_blocks * header.block_size);
+		pool_oidmap_reset();
+		return;
+	}
+
+	snapshot_rebuild_index();
+
+	ereport(LOG,
+			(errmsg("memcache: loaded query cache snapshot from \"%s\"", path),
+			 errdetail("snapshot was made %ld seconds ago", (long)(time(NULL) - header.created))));
+}
+
+/*
+ * Returns a hash of the things the snapshot depends on: layout of the
+ * cache and the backends the cached results came from.
+ */
+static uint64 snapshot_identity(void)
+{
+	uint64 h1 = 0;
+	uint64 h2 = 0;
+	int layout[6];
+	int i;
+
+	layout[0] = pool_config->memqcache_max_num_cache;
+	layout[1] = pool_config->memqcache_key_verification;
+	layout[2] = sizeof(POOL_CACHE_BLOCK_HEADER);
+	layout[3] = sizeof(POOL_CACHE_ITEM_POINTER);
+	layout[4] = sizeof(POOL_CACHE_ITEM_HEADER);
+	layout[5] = sizeof(POOL_OIDMAP_ELEMENT);
+	hash_cache_key_part((char *)layout, sizeof(layout), &h1, &h2);
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		BackendInfo *bkinfo = pool_get_node_info(i);
+
+		hash_cache_key_part(bkinfo->backend_hostname, strlen(bkinfo->backend_hostname), &h1, &h2);
+		hash_cache_key_part((char *)&bkinfo->backend_port, sizeof(bkinfo->backend_port), &h1, &h2);
+	}
+
+	return h1 ^ h2;
+}
+
+static bool snapshot_write(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t sts;
+
+	while (len > 0)
+	{
+		sts = write(fd, p, len);
+		if (sts == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += sts;
+		len -= sts;
+	}
+	return true;
+}
+
+static bool snapshot_read(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t sts;
+
+	while (len > 0)
+	{
+		sts = read(fd, p, len);
+		if (sts == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		if (sts == 0)
+			return false;	/* truncated */
+		p += sts;
+		len -= sts;
+	}
+	return true;
+}
+
+/*
+ * Rebuild the hash table and FSMM from the item pointers in the loaded
+ * cache blocks.
+ */
+static void snapshot_rebuild_index(void)
+{
+	POOL_CACHE_BLOCK_HEADER *bh;
+	POOL_CACHE_ITEM_POINTER *cip;
+	POOL_CACHEID cacheid;
+	char *block;
+	int num_blocks = pool_get_memqcache_blocks();
+	int num_items = 0;
+	int i;
+
+	for (cacheid.blockid=0;cacheid.blockid<num_blocks;cacheid.blockid++)
+	{
+		block = block_address(cacheid.blockid);
+		bh = (POOL_CACHE_BLOCK_HEADER *)block;
+
+		if (!(bh->flags & POOL_BLOCK_USED))
+			continue;
+
+		for (i=0;i<bh->num_items;i++)
+		{
+			cip = item_pointer(block, i);
+			if (cip->flags & POOL_ITEM_DELETED)
+				continue;
+
+			cacheid.itemid = i;
+			if (pool_hash_insert(&cip->query_hash, &cacheid, false) != 0)
+			{
+				/* No room in the hash table. Forget the item. */
+				pool_delete_item_shmem_cache(&cacheid);
+				continue;
+			}
+			num_items++;
+		}
+
+		pool_update_fsmm(cacheid.blockid, bh->free_bytes);
+	}
+
+	ereport(DEBUG1,
+			(errmsg("memcache: rebuilt query cache index from snapshot"),
+			 errdetail("%d cache entries", num_items)));
+}
+
 /*
  * Returns shared memory cache stats.
  * Subsequent call to this function will break return value
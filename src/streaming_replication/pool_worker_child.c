@@ -72,7 +72,6 @@ static void establish_persistent_connection(void);
 static void discard_persistent_connection(void);
 static void check_replication_time_lag(void);
 static void CheckReplicationTimeLagErrorCb(void *arg);
-static unsigned long long int text_to_lsn(char *text);
 static RETSIGTYPE my_signal_handler(int sig);
 static RETSIGTYPE reload_config_handler(int sig);
 static void reload_config(void);
@@ -154,7 +153,7 @@ void do_worker_child(void)
 
 		CHECK_REQUEST;
 
-		if (pool_config->sr_check_period <= 0)
+		if (pool_config->sr_check_period <= 0 && pool_config->sr_check_lag_interval <= 0)
 		{
 			sleep(30);
 		}
@@ -163,7 +162,7 @@ void do_worker_child(void)
 		 * If streaming replication mode, do time lag checking
 		 */
 
-		if (pool_config->sr_check_period > 0 && STREAM)
+		if ((pool_config->sr_check_period > 0 || pool_config->sr_check_lag_interval > 0) && STREAM)
 		{
 			establish_persistent_connection();
             PG_TRY();
@@ -175,15 +174,23 @@ void do_worker_child(void)
             PG_CATCH();
             {
 	    		discard_persistent_connection();
-	    		sleep(pool_config->sr_check_period);
+	    		sleep(Max(pool_config->sr_check_period, 1));
 	    		PG_RE_THROW();
             }
             PG_END_TRY();
             
-			/* Discard persistent connections */
-			discard_persistent_connection();
+			/*
+			 * Discard persistent connections, unless we check at short
+			 * intervals where reconnecting every time is too costly.
+			 */
+			if (pool_config->sr_check_lag_interval <= 0)
+				discard_persistent_connection();
 		}
-		sleep(pool_config->sr_check_period);
+
+		if (pool_config->sr_check_lag_interval > 0)
+			usleep(pool_config->sr_check_lag_interval * 1000L);
+		else
+			sleep(pool_config->sr_check_period);
 	}
 	exit(0);
 }
@@ -199,7 +206,15 @@ static void establish_persistent_connection(void)
 	for (i=0;i<NUM_BACKENDS;i++)
 	{
 		if (!VALID_BACKEND(i))
+		{
+			/* Connections may be kept across checks. Drop it if the node went down */
+			if (slots[i])
+			{
+				discard_persistent_db_connection(slots[i]);
+				slots[i] = NULL;
+			}
 			continue;
+		}
 
 		if (slots[i] == NULL)
 		{
@@ -237,6 +252,8 @@ static void check_replication_time_lag(void)
 {
 	/* backend server version cache */
 	static int server_version[MAX_NUM_BACKENDS];
+	/* last time delay was logged for each node */
+	static time_t last_logged[MAX_NUM_BACKENDS];
 
 	int i;
 	int active_nodes = 0;
@@ -246,6 +263,8 @@ static void check_replication_time_lag(void)
 	BackendInfo *bkinfo;
 	unsigned long long int lag;
 	ErrorContextCallback callback;
+	struct timeval now;
+	uint64 now_msec;
 
 	if (NUM_BACKENDS <= 1)
 	{
@@ -335,6 +354,9 @@ static void check_replication_time_lag(void)
 		}
 	}
 
+	gettimeofday(&now, NULL);
+	now_msec = (uint64) now.tv_sec * 1000 + now.tv_usec / 1000;
+
 	for (i=0;i<NUM_BACKENDS;i++)
 	{
 		if (!VALID_BACKEND(i))
@@ -347,17 +369,27 @@ static void check_replication_time_lag(void)
 		if (PRIMARY_NODE_ID == i)
 		{
 			bkinfo->standby_delay = 0;
+			bkinfo->standby_delay_time = now_msec;
+			bkinfo->standby_lsn = lsn[i];
 		}
 		else
 		{
 			bkinfo->standby_delay = lag;
-
-			/* Log delay if necessary */
-			if ((pool_config->log_standby_delay == LSD_ALWAYS && lag > 0) ||
-				(pool_config->delay_threshold &&
-				 pool_config->log_standby_delay == LSD_OVER_THRESHOLD &&
-				 lag > pool_config->delay_threshold))
+			bkinfo->standby_delay_time = now_msec;
+			bkinfo->standby_lsn = lsn[i];
+
+			/*
+			 * Log delay if necessary. When checking at short intervals,
+			 * log at most once per sr_check_period (or second) per node.
+			 */
+			if (((pool_config->log_standby_delay == LSD_ALWAYS && lag > 0) ||
+				 (pool_config->delay_threshold &&
+				  pool_config->log_standby_delay == LSD_OVER_THRESHOLD &&
+				  lag > pool_config->delay_threshold)) &&
+				(pool_config->sr_check_lag_interval <= 0 ||
+				 now.tv_sec - last_logged[i] >= Max(pool_config->sr_check_period, 1)))
 			{
+				last_logged[i] = now.tv_sec;
                 ereport(LOG,
                         (errmsg("Replication of node:%d is behind %llu bytes from the primary server (node:%d)",
                                 i, lsn[PRIMARY_NODE_ID] - lsn[i], PRIMARY_NODE_ID)));
@@ -375,7 +407,7 @@ static void CheckReplicationTimeLagErrorCb(void *arg)
 /*
  * Convert logid/recoff style text to 64bit log location (LSN)
  */
-static unsigned long long int text_to_lsn(char *text)
+unsigned long long int text_to_lsn(char *text)
 {
 /*
  * WAL segment size in bytes.  XXX We should fetch this from
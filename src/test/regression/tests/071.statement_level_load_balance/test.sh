@@ -0,0 +1,83 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for statement_level_load_balance.
+# SET must reach all standbys, since each SELECT of the session may be
+# sent to a different standby.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 3 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+echo "backend_weight0 = 0" >> etc/pgpool.conf
+echo "backend_weight1 = 1" >> etc/pgpool.conf
+echo "backend_weight2 = 1" >> etc/pgpool.conf
+echo "statement_level_load_balance = on" >> etc/pgpool.conf
+
+./startall
+
+export PGPORT=$PGPOOL_PORT
+
+wait_for_pgpool_startup
+
+$PSQL -A -t test > result.txt <<EOF
+SET work_mem TO '1234kB';
+SELECT current_setting('work_mem');
+SELECT current_setting('work_mem');
+SELECT current_setting('work_mem');
+SELECT current_setting('work_mem');
+SELECT current_setting('work_mem');
+SELECT current_setting('work_mem');
+SELECT current_setting('work_mem');
+SELECT current_setting('work_mem');
+SELECT current_setting('work_mem');
+SELECT current_setting('work_mem');
+EOF
+
+# check if SET was sent to both standbys
+for node in 1 2
+do
+	fgrep "SET work_mem TO '1234kB';" log/pgpool.log | grep "DB node id: $node" > /dev/null 2>&1
+	if [ $? != 0 ];then
+		echo fail: SET is not sent to node $node.
+		./shutdownall
+		exit 1
+	fi
+done
+echo ok: SET is sent to all standbys.
+
+# check if the SELECTs were spread over the standbys
+for node in 1 2
+do
+	fgrep "SELECT current_setting('work_mem');" log/pgpool.log | grep "DB node id: $node" > /dev/null 2>&1
+	if [ $? != 0 ];then
+		echo fail: no SELECT is sent to node $node.
+		./shutdownall
+		exit 1
+	fi
+done
+echo ok: SELECTs are load balanced per statement.
+
+# check if all SELECTs saw the session's setting
+n=`grep -c "^1234kB$" result.txt`
+if [ "$n" != 10 ];then
+	echo fail: some SELECTs did not see the SET.
+	cat result.txt
+	./shutdownall
+	exit 1
+fi
+echo ok: all SELECTs saw the SET.
+
+./shutdownall
+
+exit 0
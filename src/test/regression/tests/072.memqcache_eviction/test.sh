@@ -0,0 +1,81 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for item level eviction of shmem query cache.
+# Fill a small cache with many results so that entries get evicted,
+# while one entry keeps on being used.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+# send SELECTs to the primary, which surely has the rows
+echo "backend_weight1 = 0" >> etc/pgpool.conf
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_total_size = 262144" >> etc/pgpool.conf
+echo "memqcache_cache_block_size = 65536" >> etc/pgpool.conf
+echo "memqcache_maxcache = 8192" >> etc/pgpool.conf
+
+./startall
+
+export PGPORT=$PGPOOL_PORT
+
+wait_for_pgpool_startup
+
+$PSQL test <<EOF
+CREATE TABLE t1(i INTEGER, t TEXT);
+INSERT INTO t1 SELECT i, repeat(md5(i::text), 60) FROM generate_series(0, 499) i;
+EOF
+
+# each result is about 2kB, so 500 of them do not fit in the cache
+for i in `seq 1 499`
+do
+	echo "SELECT * FROM t1 WHERE i = $i;"
+	if [ `expr $i % 10` = 0 ];then
+		echo "SELECT * FROM t1 WHERE i = 0;"
+	fi
+done > query.sql
+
+$PSQL -A -t -f query.sql test > result1.txt
+$PSQL -A -t -f query.sql test > result2.txt
+
+# check if cached results are the same as those from backend
+cmp result1.txt result2.txt
+if [ $? != 0 ];then
+	echo fail: results from cache differ from those from backend.
+	./shutdownall
+	exit 1
+fi
+echo ok: results are correct.
+
+# check if items were evicted
+evictions=`$PSQL -A -t -c "SHOW pool_cache" test | awk -F'|' '{print $10}'`
+if [ -z "$evictions" -o "$evictions" = 0 ];then
+	echo fail: no cache entry was evicted.
+	./shutdownall
+	exit 1
+fi
+echo ok: $evictions cache entries were evicted.
+
+# check if the frequently used entry stayed in the cache
+n=`grep "fetched from cache" log/pgpool.log | fgrep -c "SELECT * FROM t1 WHERE i = 0;"`
+if [ $n -lt 80 ];then
+	echo fail: frequently used entry was fetched from cache only $n times.
+	./shutdownall
+	exit 1
+fi
+echo ok: frequently used entry stayed in the cache.
+
+./shutdownall
+
+exit 0
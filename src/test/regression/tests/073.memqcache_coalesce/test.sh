@@ -0,0 +1,106 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for memqcache_coalesce_timeout.
+# When several clients issue the same slow SELECT at once, only one of
+# them should execute it and the others should get the cached result.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+# send SELECTs to the primary, which surely has the rows
+echo "backend_weight1 = 0" >> etc/pgpool.conf
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_coalesce_timeout = 60000" >> etc/pgpool.conf
+
+./startall
+
+export PGPORT=$PGPOOL_PORT
+
+wait_for_pgpool_startup
+
+$PSQL test <<EOF
+CREATE TABLE t1(i INTEGER);
+INSERT INTO t1 SELECT generate_series(1, 5000);
+EOF
+
+# takes a few seconds
+QUERY="SELECT count(*) FROM t1 a, t1 b WHERE a.i <> b.i;"
+
+for i in 1 2 3 4 5
+do
+	$PSQL -A -t -c "$QUERY" test > result$i.txt &
+done
+wait
+
+# check if all clients got the same result
+for i in 2 3 4 5
+do
+	cmp result1.txt result$i.txt
+	if [ $? != 0 ];then
+		echo fail: results differ.
+		./shutdownall
+		exit 1
+	fi
+done
+echo ok: all clients got the same result.
+
+# check if the query was executed only once
+n=`fgrep "$QUERY" log/pgpool.log | grep -c "DB node id:"`
+if [ "$n" != 1 ];then
+	echo fail: the query was sent to backend $n times.
+	./shutdownall
+	exit 1
+fi
+echo ok: the query was sent to backend only once.
+
+n=`grep "fetched from cache" log/pgpool.log | fgrep -c "$QUERY"`
+if [ "$n" != 4 ];then
+	echo fail: the result was fetched from cache $n times.
+	./shutdownall
+	exit 1
+fi
+echo ok: other clients got the result from cache.
+
+# If the client executing the query fails, the waiting client should
+# execute the query by itself without waiting for
+# memqcache_coalesce_timeout.
+QUERY2="SELECT count(*) FROM t1 a, t1 b WHERE a.i < b.i;"
+
+start=`date +%s`
+PGOPTIONS="-c statement_timeout=1000" $PSQL -A -t -c "$QUERY2" test > result_failed.txt 2>&1 &
+sleep 0.5
+$PSQL -A -t -c "$QUERY2" test > result_waiter.txt
+elapsed=`expr \`date +%s\` - $start`
+wait
+
+echo 12497500 > expected.txt
+cmp expected.txt result_waiter.txt
+if [ $? != 0 ];then
+	echo fail: waiting client got wrong result.
+	cat result_waiter.txt
+	./shutdownall
+	exit 1
+fi
+
+if [ $elapsed -ge 30 ];then
+	echo fail: waiting client waited $elapsed seconds for failed query.
+	./shutdownall
+	exit 1
+fi
+echo ok: waiting client executed the query after the other client failed.
+
+./shutdownall
+
+exit 0
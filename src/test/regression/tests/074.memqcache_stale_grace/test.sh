@@ -0,0 +1,104 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for memqcache_stale_grace.
+# An expired cache entry should be served while another client is
+# refreshing it, but never after a write to the table.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+# send SELECTs to the primary, which surely has the rows
+echo "backend_weight1 = 0" >> etc/pgpool.conf
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_expire = 3" >> etc/pgpool.conf
+echo "memqcache_stale_grace = 60" >> etc/pgpool.conf
+
+./startall
+
+export PGPORT=$PGPOOL_PORT
+
+wait_for_pgpool_startup
+
+$PSQL test <<EOF
+CREATE TABLE t1(i INTEGER);
+INSERT INTO t1 SELECT generate_series(1, 5000);
+EOF
+
+# takes a few seconds
+QUERY="SELECT count(*) FROM t1 a, t1 b WHERE a.i <> b.i;"
+
+# cache the result and let it expire
+$PSQL -A -t -c "$QUERY" test > result1.txt
+sleep 5
+
+# the first client refreshes the entry, the second one gets the
+# expired entry meanwhile
+$PSQL -A -t -c "$QUERY" test > result2.txt &
+sleep 1
+$PSQL -A -t -c "$QUERY" test > result3.txt
+wait
+
+cmp result1.txt result2.txt && cmp result1.txt result3.txt
+if [ $? != 0 ];then
+	echo fail: results differ.
+	./shutdownall
+	exit 1
+fi
+
+n=`fgrep "$QUERY" log/pgpool.log | grep -c "DB node id:"`
+if [ "$n" != 2 ];then
+	echo fail: the query was sent to backend $n times.
+	./shutdownall
+	exit 1
+fi
+
+n=`grep "fetched from cache" log/pgpool.log | fgrep -c "$QUERY"`
+if [ "$n" != 1 ];then
+	echo fail: the expired entry was fetched from cache $n times.
+	./shutdownall
+	exit 1
+fi
+echo ok: expired entry was served while being refreshed.
+
+# the refreshed entry is served from the cache
+$PSQL -A -t -c "$QUERY" test > result4.txt
+n=`grep "fetched from cache" log/pgpool.log | fgrep -c "$QUERY"`
+if [ "$n" != 2 ];then
+	echo fail: the refreshed entry was not fetched from cache.
+	./shutdownall
+	exit 1
+fi
+echo ok: refreshed entry was fetched from cache.
+
+# let the entry expire again, then write to the table. The expired
+# entry must not be served any more.
+sleep 5
+$PSQL test <<EOF
+INSERT INTO t1 VALUES(0);
+EOF
+$PSQL -A -t -c "$QUERY" test > result5.txt
+echo 25005000 > expected.txt
+cmp expected.txt result5.txt
+if [ $? != 0 ];then
+	echo fail: stale result was returned after a write.
+	cat result5.txt
+	./shutdownall
+	exit 1
+fi
+echo ok: write to the table invalidated the expired entry.
+
+./shutdownall
+
+exit 0
@@ -0,0 +1,92 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for memqcache_snapshot_file.
+# The query cache saved at shutdown should be served after restart.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+# send SELECTs to the primary, which surely has the rows
+echo "backend_weight1 = 0" >> etc/pgpool.conf
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_snapshot_file = '`pwd`/log/qcache.snapshot'" >> etc/pgpool.conf
+
+./startall
+
+export PGPORT=$PGPOOL_PORT
+
+wait_for_pgpool_startup
+
+$PSQL test <<EOF
+CREATE TABLE t1(i INTEGER, t TEXT);
+INSERT INTO t1 SELECT i, md5(i::text) FROM generate_series(1, 100) i;
+EOF
+
+$PSQL -A -t -c "SELECT * FROM t1 ORDER BY i;" test > result1.txt
+
+./shutdownall
+
+grep "saved query cache snapshot" log/pgpool.log > /dev/null 2>&1
+if [ $? != 0 ];then
+	echo fail: query cache snapshot was not saved.
+	exit 1
+fi
+echo ok: query cache snapshot was saved.
+
+./startall
+wait_for_pgpool_startup
+
+grep "loaded query cache snapshot" log/pgpool.log > /dev/null 2>&1
+if [ $? != 0 ];then
+	echo fail: query cache snapshot was not loaded.
+	./shutdownall
+	exit 1
+fi
+echo ok: query cache snapshot was loaded.
+
+$PSQL -A -t -c "SELECT * FROM t1 ORDER BY i;" test > result2.txt
+
+grep "fetched from cache" log/pgpool.log | fgrep "SELECT * FROM t1 ORDER BY i;" > /dev/null 2>&1
+if [ $? != 0 ];then
+	echo fail: result was not fetched from loaded cache.
+	./shutdownall
+	exit 1
+fi
+
+cmp result1.txt result2.txt
+if [ $? != 0 ];then
+	echo fail: result from loaded cache differs.
+	./shutdownall
+	exit 1
+fi
+echo ok: result was fetched from loaded cache.
+
+# the table oid map is restored as well: a write must invalidate the
+# loaded entry
+$PSQL test <<EOF
+INSERT INTO t1 VALUES(0, 'new');
+EOF
+$PSQL -A -t -c "SELECT * FROM t1 ORDER BY i;" test > result3.txt
+n=`grep -c "^0|new$" result3.txt`
+if [ "$n" != 1 ];then
+	echo fail: loaded cache entry was not invalidated.
+	./shutdownall
+	exit 1
+fi
+echo ok: loaded cache entry was invalidated by a write.
+
+./shutdownall
+
+exit 0
@@ -0,0 +1,78 @@
+#!/usr/bin/env bash
+#-------------------------------------------------------------------
+# test script for memqcache_compress_threshold.
+# Results served from the compressed cache should be the same as those
+# from backend, for both compressible and incompressible results.
+#
+source $TESTLIBS
+TESTDIR=testdir
+PSQL=$PGBIN/psql
+
+rm -fr $TESTDIR
+mkdir $TESTDIR
+cd $TESTDIR
+
+# create test environment
+echo -n "creating test environment..."
+$PGPOOL_SETUP -m s -n 2 || exit 1
+echo "done."
+
+source ./bashrc.ports
+
+# send SELECTs to the primary, which surely has the rows
+echo "backend_weight1 = 0" >> etc/pgpool.conf
+echo "memory_cache_enabled = on" >> etc/pgpool.conf
+echo "memqcache_compress_threshold = 1024" >> etc/pgpool.conf
+
+./startall
+
+export PGPORT=$PGPOOL_PORT
+
+wait_for_pgpool_startup
+
+$PSQL test <<EOF
+CREATE TABLE t1(i INTEGER);
+INSERT INTO t1 SELECT generate_series(1, 1000);
+EOF
+
+# compressible: about 280kB of repeated text
+Q1="SELECT i, repeat('abcdefgh' || i, 3000) FROM t1 WHERE i <= 10 ORDER BY i;"
+# incompressible: about 70kB of md5 hashes
+Q2="SELECT i, md5(i::text) || md5((i * 7)::text) FROM t1 ORDER BY i;"
+# small: below the threshold
+Q3="SELECT i FROM t1 WHERE i = 1;"
+
+for q in "$Q1" "$Q2" "$Q3"
+do
+	$PSQL -A -t -c "$q" test > result1.txt
+	$PSQL -A -t -c "$q" test > result2.txt
+
+	grep "fetched from cache" log/pgpool.log | fgrep "$q" > /dev/null 2>&1
+	if [ $? != 0 ];then
+		echo "fail: result was not fetched from cache: $q"
+		./shutdownall
+		exit 1
+	fi
+
+	cmp result1.txt result2.txt
+	if [ $? != 0 ];then
+		echo "fail: result from cache differs: $q"
+		./shutdownall
+		exit 1
+	fi
+
+	if [ "$q" = "$Q1" ];then
+		# check if the compressible result was stored compressed
+		used=`$PSQL -A -t -c "SHOW pool_cache" test | awk -F'|' '{print $7}'`
+		if [ "$used" -ge 50000 ];then
+			echo "fail: compressible result uses $used bytes of cache"
+			./shutdownall
+			exit 1
+		fi
+	fi
+	echo "ok: $q"
+done
+
+./shutdownall
+
+exit 0
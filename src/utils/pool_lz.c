@@ -0,0 +1,247 @@
+/* -*-pgsql-c-*- */
+/*
+ *
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2017	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_lz.c.: fast LZ77 compression used by the query cache.
+ *
+ * The compressed data is in the LZ4 block format: a sequence of
+ * "token, literal length, literals, match offset, match length"
+ * records.  The upper 4 bits of the token is the literal length and the
+ * lower 4 bits is the match length minus 4.  If either is 15, more
+ * length bytes follow, each adding up to 255.  The match offset is 2
+ * bytes little endian.  The last record has literals only.  Matches are
+ * found by a single hash table lookup per position, which trades the
+ * compression ratio for speed.
+ *
+ */
+
+#include "pool.h"
+#include "utils/pool_lz.h"
+#include <string.h>
+
+#define LZ_MIN_MATCH		4		/* minimum match length */
+#define LZ_LAST_LITERALS	5		/* last bytes always emitted as literals */
+#define LZ_MF_LIMIT			12		/* no match starts in last bytes */
+#define LZ_MAX_OFFSET		65535	/* maximum match distance */
+#define LZ_HASH_BITS		12		/* size of hash table */
+#define LZ_RUN_MASK			15		/* max length in a token nibble */
+
+static uint32 lz_read32(const unsigned char *p);
+static uint32 lz_hash(uint32 seq);
+static unsigned char *lz_put_length(unsigned char *op, int length);
+static int lz_get_length(const unsigned char **ipp, const unsigned char *iend, int length);
+
+/*
+ * Compress "slen" bytes of "source" into "dest" which has "dcap" bytes
+ * of room.  Returns compressed length, or -1 if the result does not fit
+ * in dcap bytes.
+ */
+int pool_lz_compress(const char *source, int slen, char *dest, int dcap)
+{
+	const unsigned char *src = (const unsigned char *)source;
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char *iend = src + slen;
+	const unsigned char *mflimit = iend - LZ_MF_LIMIT;
+	const unsigned char *matchlimit = iend - LZ_LAST_LITERALS;
+	unsigned char *op = (unsigned char *)dest;
+	unsigned char *oend = op + dcap;
+	int htab[1 << LZ_HASH_BITS];
+	int litlen;
+	int i;
+
+	if (slen > LZ_MF_LIMIT)
+	{
+		for (i=0;i<(1 << LZ_HASH_BITS);i++)
+			htab[i] = -1;
+
+		while (ip < mflimit)
+		{
+			const unsigned char *match;
+			uint32 seq = lz_read32(ip);
+			uint32 h = lz_hash(seq);
+			int ref = htab[h];
+			int matchlen;
+
+			htab[h] = ip - src;
+			if (ref < 0 || (ip - src) - ref > LZ_MAX_OFFSET || lz_read32(src + ref) != seq)
+			{
+				ip++;
+				continue;
+			}
+			match = src + ref;
+
+			/* Extend the match backwards into pending literals */
+			while (ip > anchor && match > src && ip[-1] == match[-1])
+			{
+				ip--;
+				match--;
+			}
+
+			matchlen = LZ_MIN_MATCH;
+			while (ip + matchlen < matchlimit && ip[matchlen] == match[matchlen])
+				matchlen++;
+
+			/* token + lengths + literals + offset, with margin */
+			litlen = ip - anchor;
+			if (oend - op < 1 + litlen/255 + 1 + litlen + 2 + (matchlen - LZ_MIN_MATCH)/255 + 1)
+				return -1;
+
+			*op = (litlen < LZ_RUN_MASK ? litlen : LZ_RUN_MASK) << 4;
+			*op |= (matchlen - LZ_MIN_MATCH < LZ_RUN_MASK) ? matchlen - LZ_MIN_MATCH : LZ_RUN_MASK;
+			op++;
+			if (litlen >= LZ_RUN_MASK)
+				op = lz_put_length(op, litlen - LZ_RUN_MASK);
+			memcpy(op, anchor, litlen);
+			op += litlen;
+
+			*op++ = (ip - match) & 0xff;
+			*op++ = (ip - match) >> 8;
+			if (matchlen - LZ_MIN_MATCH >= LZ_RUN_MASK)
+				op = lz_put_length(op, matchlen - LZ_MIN_MATCH - LZ_RUN_MASK);
+
+			ip += matchlen;
+			anchor = ip;
+		}
+	}
+
+	/* Last literals */
+	litlen = iend - anchor;
+	if (oend - op < 1 + litlen/255 + 1 + litlen)
+		return -1;
+	*op++ = (litlen < LZ_RUN_MASK ? litlen : LZ_RUN_MASK) << 4;
+	if (litlen >= LZ_RUN_MASK)
+		op = lz_put_length(op, litlen - LZ_RUN_MASK);
+	memcpy(op, anchor, litlen);
+	op += litlen;
+
+	return op - (unsigned char *)dest;
+}
+
+/*
+ * Decompress "slen" bytes of "source" into "dest" which has "dcap"
+ * bytes of room.  Returns decompressed length, or -1 if the source is
+ * corrupted or the result does not fit in dcap bytes.
+ */
+int pool_lz_decompress(const char *source, int slen, char *dest, int dcap)
+{
+	const unsigned char *ip = (const unsigned char *)source;
+	const unsigned char *iend = ip + slen;
+	unsigned char *op = (unsigned char *)dest;
+	unsigned char *oend = op + dcap;
+
+	while (ip < iend)
+	{
+		int token = *ip++;
+		int length;
+		int offset;
+		unsigned char *match;
+
+		/* Literals */
+		length = lz_get_length(&ip, iend, token >> 4);
+		if (length < 0 || length > iend - ip || length > oend - op)
+			return -1;
+		memcpy(op, ip, length);
+		op += length;
+		ip += length;
+
+		if (ip >= iend)
+			break;		/* last literals */
+
+		/* Match */
+		if (iend - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op - (unsigned char *)dest)
+			return -1;
+
+		length = lz_get_length(&ip, iend, token & LZ_RUN_MASK);
+		if (length < 0 || length > oend - op - LZ_MIN_MATCH)
+			return -1;
+		length += LZ_MIN_MATCH;
+
+		match = op - offset;
+		if (offset >= length)
+		{
+			memcpy(op, match, length);
+			op += length;
+		}
+		else
+		{
+			/* Overlapping copy repeats the last "offset" bytes */
+			while (length-- > 0)
+				*op++ = *match++;
+		}
+	}
+
+	return op - (unsigned char *)dest;
+}
+
+static uint32 lz_read32(const unsigned char *p)
+{
+	uint32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32 lz_hash(uint32 seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * Write the rest of length exceeding the token nibble.
+ */
+static unsigned char *lz_put_length(unsigned char *op, int length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = length;
+	return op;
+}
+
+/*
+ * Read the rest of length if the token nibble is LZ_RUN_MASK.
+ * Returns -1 on corrupted input.
+ */
+static int lz_get_length(const unsigned char **ipp, const unsigned char *iend, int length)
+{
+	const unsigned char *ip = *ipp;
+	int s;
+
+	if (length != LZ_RUN_MASK)
+		return length;
+
+	do
+	{
+		if (ip >= iend || length > INT_MAX - 255)
+			return -1;
+		s = *ip++;
+		length += s;
+	} while (s == 255);
+
+	*ipp = ip;
+	return length;
+}
@@ -262,6 +262,33 @@ POOL_REPORT_CONFIG* get_config(int *nrows)
 	StrNCpy(status[i].desc, "max # of connection pool per child", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	StrNCpy(status[i].name, "max_sessions_per_child", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->max_sessions_per_child);
+	StrNCpy(status[i].desc, "max # of client sessions per child", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	StrNCpy(status[i].name, "pooling_mode", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s",
+			 pool_config->pooling_mode == POOLING_TRANSACTION ? "transaction" : "session");
+	StrNCpy(status[i].desc, "backend connection is bound to session or transaction", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	StrNCpy(status[i].name, "process_management_mode", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s",
+			 pool_config->process_management_mode == PM_DYNAMIC ? "dynamic" : "static");
+	StrNCpy(status[i].desc, "static or dynamic number of children", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	StrNCpy(status[i].name, "min_spare_children", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->min_spare_children);
+	StrNCpy(status[i].desc, "min # of idle children in dynamic mode", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	StrNCpy(status[i].name, "max_spare_children", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->max_spare_children);
+	StrNCpy(status[i].desc, "max # of idle children in dynamic mode", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	/* - Life time - */
 	StrNCpy(status[i].name, "child_life_time", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->child_life_time);
@@ -367,6 +394,16 @@ POOL_REPORT_CONFIG* get_config(int *nrows)
 	StrNCpy(status[i].desc, "if true, cache connection pool", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	StrNCpy(status[i].name, "global_connection_pool", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->global_connection_pool);
+	StrNCpy(status[i].desc, "if true, share idle connections among children", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	StrNCpy(status[i].name, "global_pool_size", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->global_pool_size);
+	StrNCpy(status[i].desc, "max # of idle connections in the global pool", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	StrNCpy(status[i].name, "reset_query_list", POOLCONFIG_MAXNAMELEN);
 	*(status[i].value) = '\0';
 	for (j=0;j<pool_config->num_reset_queries;j++)
@@ -420,6 +457,23 @@ POOL_REPORT_CONFIG* get_config(int *nrows)
 	StrNCpy(status[i].desc, "non 0 if operating in load balancing mode", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	StrNCpy(status[i].name, "load_balance_algorithm", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s",
+			 pool_config->load_balance_algorithm == LB_LEAST_OUTSTANDING ? "least_outstanding" :
+			 pool_config->load_balance_algorithm == LB_LATENCY ? "latency" : "random");
+	StrNCpy(status[i].desc, "how to choose load balance node", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	StrNCpy(status[i].name, "statement_level_load_balance", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->statement_level_load_balance);
+	StrNCpy(status[i].desc, "choose load balance node per statement", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	StrNCpy(status[i].name, "cache_affinity_routing", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->cache_affinity_routing);
+	StrNCpy(status[i].desc, "send SELECTs on a table to the node it hashes to", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	StrNCpy(status[i].name, "ignore_leading_white_space", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->ignore_leading_white_space);
 	StrNCpy(status[i].desc, "ignore leading white spaces", POOLCONFIG_MAXDESCLEN);
@@ -469,6 +523,11 @@ POOL_REPORT_CONFIG* get_config(int *nrows)
 	StrNCpy(status[i].desc, "sr check period", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	StrNCpy(status[i].name, "sr_check_lag_interval", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->sr_check_lag_interval);
+	StrNCpy(status[i].desc, "sr check interval in msec", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	StrNCpy(status[i].name, "sr_check_user", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->sr_check_user);
 	StrNCpy(status[i].desc, "sr check user", POOLCONFIG_MAXDESCLEN);
@@ -489,6 +548,16 @@ POOL_REPORT_CONFIG* get_config(int *nrows)
 	StrNCpy(status[i].desc, "standby delay threshold", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	StrNCpy(status[i].name, "lag_aware_routing", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->lag_aware_routing);
+	StrNCpy(status[i].desc, "use other standbys within delay threshold", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	StrNCpy(status[i].name, "read_your_writes", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->read_your_writes);
+	StrNCpy(status[i].desc, "load balance reads only to standbys which replayed session's writes", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	/* - Special commands - */
 	StrNCpy(status[i].name, "follow_master_command", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->follow_master_command);
@@ -808,16 +877,36 @@ POOL_REPORT_CONFIG* get_config(int *nrows)
 	StrNCpy(status[i].desc, "Memory cache entry life time specified in seconds. 60 by default", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	StrNCpy(status[i].name, "memqcache_stale_grace", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_stale_grace);
+	StrNCpy(status[i].desc, "Seconds to keep on returning expired cache entry while it is refreshed", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	StrNCpy(status[i].name, "memqcache_auto_cache_invalidation", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_auto_cache_invalidation);
 	StrNCpy(status[i].desc, "If true, invalidation of query cache is triggered by corresponding DDL/DML/DCL(and memqcache_expire).  If false, it is only triggered  by memqcache_expire.  True by default.", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	StrNCpy(status[i].name, "memqcache_key_verification", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_key_verification);
+	StrNCpy(status[i].desc, "If true, compare the whole cache key on cache hit", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	StrNCpy(status[i].name, "memqcache_coalesce_timeout", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_coalesce_timeout);
+	StrNCpy(status[i].desc, "Max milliseconds to wait for other child caching the same query", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	StrNCpy(status[i].name, "memqcache_maxcache", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_maxcache);
 	StrNCpy(status[i].desc, "Maximum SELECT result size in bytes", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	StrNCpy(status[i].name, "memqcache_compress_threshold", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_compress_threshold);
+	StrNCpy(status[i].desc, "Compress query cache entries of at least this size in bytes", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	StrNCpy(status[i].name, "memqcache_cache_block_size", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->memqcache_cache_block_size);
 	StrNCpy(status[i].desc, "Cache block size in bytes. 8192 by default", POOLCONFIG_MAXDESCLEN);
@@ -828,6 +917,11 @@ POOL_REPORT_CONFIG* get_config(int *nrows)
 	StrNCpy(status[i].desc, "Tempory work directory to record table oids", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	StrNCpy(status[i].name, "memqcache_snapshot_file", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->memqcache_snapshot_file);
+	StrNCpy(status[i].desc, "File to save query cache at shutdown and load at start up", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	StrNCpy(status[i].name, "memqcache_stats_start_time", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", ctime(&pool_get_memqcache_stats()->start_time));
 	StrNCpy(status[i].desc, "Start time of query cache stats", POOLCONFIG_MAXDESCLEN);
@@ -1334,6 +1428,11 @@ POOL_REPORT_POOLS* get_pools(int *nrows)
 	for (child = 0; child < pool_config->num_init_children; child++)
 	{
 		proc_id = process_info[child].pid;
+
+		/* skip unused slots in dynamic process management mode */
+		if (proc_id == 0)
+			continue;
+
 		pi = pool_get_process_info(proc_id);
 
 		for (pool = 0; pool < pool_config->max_pool; pool++)
@@ -1525,35 +1624,42 @@ POOL_REPORT_PROCESSES* get_processes(int *nrows)
     int poolBE;
     ProcessInfo *pi = NULL;
     int proc_id;
+	int lines = 0;
 
     POOL_REPORT_PROCESSES* processes = palloc(pool_config->num_init_children * sizeof(POOL_REPORT_PROCESSES));
 
 	for (child = 0; child < pool_config->num_init_children; child++)
     {
 		proc_id = process_info[child].pid;
+
+		/* skip unused slots in dynamic process management mode */
+		if (proc_id == 0)
+			continue;
+
 	    pi = pool_get_process_info(proc_id);
 
-        snprintf(processes[child].pool_pid, POOLCONFIG_MAXCOUNTLEN, "%d", proc_id);
-	    strftime(processes[child].start_time, POOLCONFIG_MAXDATELEN, "%Y-%m-%d %H:%M:%S", localtime(&pi->start_time));
-	    StrNCpy(processes[child].database, "", POOLCONFIG_MAXIDENTLEN);
-	    StrNCpy(processes[child].username, "", POOLCONFIG_MAXIDENTLEN);
-        StrNCpy(processes[child].create_time, "", POOLCONFIG_MAXDATELEN);
-        StrNCpy(processes[child].pool_counter, "", POOLCONFIG_MAXCOUNTLEN);
+        snprintf(processes[lines].pool_pid, POOLCONFIG_MAXCOUNTLEN, "%d", proc_id);
+	    strftime(processes[lines].start_time, POOLCONFIG_MAXDATELEN, "%Y-%m-%d %H:%M:%S", localtime(&pi->start_time));
+	    StrNCpy(processes[lines].database, "", POOLCONFIG_MAXIDENTLEN);
+	    StrNCpy(processes[lines].username, "", POOLCONFIG_MAXIDENTLEN);
+        StrNCpy(processes[lines].create_time, "", POOLCONFIG_MAXDATELEN);
+        StrNCpy(processes[lines].pool_counter, "", POOLCONFIG_MAXCOUNTLEN);
 
         for (pool = 0; pool < pool_config->max_pool; pool++)
         {
             poolBE = pool*MAX_NUM_BACKENDS;
             if (pi->connection_info[poolBE].connected && strlen(pi->connection_info[poolBE].database) > 0 && strlen(pi->connection_info[poolBE].user) > 0)
             {
-	            StrNCpy(processes[child].database, pi->connection_info[poolBE].database, POOLCONFIG_MAXIDENTLEN);
-	            StrNCpy(processes[child].username, pi->connection_info[poolBE].user, POOLCONFIG_MAXIDENTLEN);
-	            strftime(processes[child].create_time, POOLCONFIG_MAXDATELEN, "%Y-%m-%d %H:%M:%S", localtime(&pi->connection_info[poolBE].create_time));
-                snprintf(processes[child].pool_counter, POOLCONFIG_MAXCOUNTLEN, "%d", pi->connection_info[poolBE].counter);
+	            StrNCpy(processes[lines].database, pi->connection_info[poolBE].database, POOLCONFIG_MAXIDENTLEN);
+	            StrNCpy(processes[lines].username, pi->connection_info[poolBE].user, POOLCONFIG_MAXIDENTLEN);
+	            strftime(processes[lines].create_time, POOLCONFIG_MAXDATELEN, "%Y-%m-%d %H:%M:%S", localtime(&pi->connection_info[poolBE].create_time));
+                snprintf(processes[lines].pool_counter, POOLCONFIG_MAXCOUNTLEN, "%d", pi->connection_info[poolBE].counter);
             }
         }
+		lines++;
     }
 
-	*nrows = child;
+	*nrows = lines;
 
 	return processes;
 }
@@ -1725,7 +1831,7 @@ void version_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
  */
 void cache_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 {
-	static char *field_names[] = {"num_cache_hits", "num_selects", "cache_hit_ratio", "num_hash_entries", "used_hash_entries", "num_cache_entries", "used_cache_entries_size", "free_cache_entries_size", "fragment_cache_entries_size"};
+	static char *field_names[] = {"num_cache_hits", "num_selects", "cache_hit_ratio", "num_hash_entries", "used_hash_entries", "num_cache_entries", "used_cache_entries_size", "free_cache_entries_size", "fragment_cache_entries_size", "num_evictions"};
 	short num_fields = sizeof(field_names)/sizeof(char *);
 	int i;
 	short s;
@@ -1752,7 +1858,7 @@ void cache_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 	 * Get raw cache stat data
 	 */
     POOL_SETMASK2(&BlockSig, &oldmask);
-    pool_shmem_lock();
+    pool_shmem_lock_shared();
 
     PG_TRY();
     {
@@ -1789,6 +1895,7 @@ void cache_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%ld", mystats->used_cache_entries_size);
 	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%ld", mystats->free_cache_entries_size);
 	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%ld", mystats->fragment_cache_entries_size);
+	snprintf(strp[i++].string, POOL_CACHE_STATS_MAX_STRING_LEN+1, "%lld", mystats->cache_stats.num_evictions);
 
 	/*
 	 * Calculate total data length
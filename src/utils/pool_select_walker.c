@@ -29,6 +29,7 @@
 #include "utils/pool_select_walker.h"
 #include "utils/pool_relcache.h"
 #include "parser/parsenodes.h"
+#include "parser/pg_class.h"
 #include "context/pool_session_context.h"
 #include "rewrite/pool_timestamp.h"
 
@@ -43,6 +44,8 @@ static bool	insertinto_or_locking_clause_walker(Node *node, void *context);
 static bool is_immutable_function(char *fname);
 static bool select_table_walker(Node *node, void *context);
 static bool non_immutable_function_call_walker(Node *node, void *context);
+static bool session_function_call_walker(Node *node, void *context);
+static bool is_temp_relation(RangeVar *rel);
 static char *strip_quote(char *str);
 
 /*
@@ -1006,6 +1009,119 @@ static bool non_immutable_function_call_walker(Node *node, void *context)
 	return raw_expression_tree_walker(node, non_immutable_function_call_walker, context);
 }
 
+/*
+ * Return true if the statement leaves state in the backend which
+ * survives the transaction: session level SET, temporary objects,
+ * LISTEN, LOAD, cursors WITH HOLD and session level advisory locks.
+ * Used to decide whether the backend connection can be shared among
+ * sessions in transaction pooling mode.
+ */
+bool pool_has_session_state(Node *node)
+{
+	SelectContext	ctx;
+
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, VariableSetStmt))
+	{
+		VariableSetStmt *vnode = (VariableSetStmt *)node;
+
+		/* SET LOCAL and SET TRANSACTION only last until the transaction ends */
+		if (vnode->is_local)
+			return false;
+		if (vnode->kind == VAR_SET_MULTI && !strcmp(vnode->name, "TRANSACTION"))
+			return false;
+		if (vnode->kind == VAR_RESET || vnode->kind == VAR_RESET_ALL)
+			return false;
+		return true;
+	}
+
+	if (IsA(node, CreateStmt))
+		return is_temp_relation(((CreateStmt *)node)->relation);
+
+	if (IsA(node, CreateTableAsStmt))
+		return is_temp_relation(((CreateTableAsStmt *)node)->into->rel);
+
+	if (IsA(node, ViewStmt))
+		return is_temp_relation(((ViewStmt *)node)->view);
+
+	if (IsA(node, CreateSeqStmt))
+		return is_temp_relation(((CreateSeqStmt *)node)->sequence);
+
+	if (IsA(node, ListenStmt) || IsA(node, LoadStmt))
+		return true;
+
+	if (IsA(node, DeclareCursorStmt))
+		return (((DeclareCursorStmt *)node)->options & CURSOR_OPT_HOLD) != 0;
+
+	if (!IsA(node, SelectStmt))
+		return false;
+
+	if (((SelectStmt *)node)->intoClause &&
+		is_temp_relation(((SelectStmt *)node)->intoClause->rel))
+		return true;
+
+	ctx.has_session_function_call = false;
+
+	raw_expression_tree_walker(node, session_function_call_walker, &ctx);
+
+	return ctx.has_session_function_call;
+}
+
+static bool is_temp_relation(RangeVar *rel)
+{
+	return rel && rel->relpersistence == RELPERSISTENCE_TEMP;
+}
+
+/*
+ * Walker function to find a call of the functions which leave state in
+ * the session: session level advisory locks and set_config().
+ */
+static bool session_function_call_walker(Node *node, void *context)
+{
+	SelectContext	*ctx = (SelectContext *) context;
+	static char *session_functions[] = {
+		"pg_advisory_lock", "pg_advisory_lock_shared",
+		"pg_try_advisory_lock", "pg_try_advisory_lock_shared",
+		"set_config"
+	};
+
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, FuncCall))
+	{
+		FuncCall *fcall = (FuncCall *)node;
+		char *fname;
+		int length = list_length(fcall->funcname);
+		int i;
+
+		if (length > 0)
+		{
+			if (length == 1)	/* no schema qualification? */
+			{
+				fname = strVal(linitial(fcall->funcname));
+			}
+			else
+			{
+				fname = strVal(lsecond(fcall->funcname));		/* with schema qualification */
+			}
+
+			for (i = 0; i < sizeof(session_functions) / sizeof(session_functions[0]); i++)
+			{
+				if (!strcmp(fname, session_functions[i]))
+				{
+					ctx->has_session_function_call = true;
+					return false;
+				}
+			}
+		}
+	}
+
+	return raw_expression_tree_walker(node, session_function_call_walker, context);
+}
+
 /*
  * Check if the function is stable.
  */
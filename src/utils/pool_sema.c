@@ -157,3 +157,107 @@ pool_semaphore_unlock(int semNum)
 		ereport(WARNING,
 				(errmsg("failed to unlock semaphore error:\"%s\"",strerror(errno))));
 }
+
+/*
+ * Set the count of a semaphore
+ */
+void
+pool_semaphore_setval(int semNum, int val)
+{
+	union semun semun;
+
+	semun.val = val;
+	if (semctl(semId, semNum, SETVAL, semun) < 0)
+		ereport(FATAL,
+			(errmsg("Unable to set semaphore value error:\"%s\"",strerror(errno)),
+					errdetail("semctl(%d, %d, SETVAL, %d) failed",semId,semNum,val)));
+}
+
+/*
+ * Run semop on the semaphore set, retrying on EINTR
+ */
+static void
+semaphore_op(struct sembuf *sops, int nsops, const char *what)
+{
+	int			errStatus;
+
+	do
+	{
+		errStatus = semop(semId, sops, nsops);
+	} while (errStatus < 0 && errno == EINTR);
+
+	if (errStatus < 0)
+		ereport(WARNING,
+			(errmsg("failed to %s semaphore error:\"%s\"",what,strerror(errno))));
+}
+
+/*
+ * Shared/exclusive lock built on two semaphores.  "semNum" must be
+ * initialized to POOL_SEM_SHARED_MAX and "writerSemNum" to 0.
+ *
+ * A shared locker takes one count of semNum, an exclusive locker takes
+ * all of them, so any number of shared lockers may hold the lock at the
+ * same time while an exclusive locker is alone.  writerSemNum counts
+ * exclusive lockers waiting or holding the lock.  Shared lockers wait
+ * for it to be zero, atomically with taking their count, so that a
+ * stream of shared lockers cannot starve exclusive ones.
+ */
+void
+pool_semaphore_lock_shared(int semNum, int writerSemNum)
+{
+	struct sembuf sops[2];
+
+	sops[0].sem_op = 0;			/* wait for no exclusive locker */
+	sops[0].sem_flg = 0;
+	sops[0].sem_num = writerSemNum;
+	sops[1].sem_op = -1;
+	sops[1].sem_flg = SEM_UNDO;
+	sops[1].sem_num = semNum;
+
+	semaphore_op(sops, 2, "lock");
+}
+
+void
+pool_semaphore_unlock_shared(int semNum)
+{
+	struct sembuf sops;
+
+	sops.sem_op = 1;
+	sops.sem_flg = SEM_UNDO;
+	sops.sem_num = semNum;
+
+	semaphore_op(&sops, 1, "unlock");
+}
+
+void
+pool_semaphore_lock_exclusive(int semNum, int writerSemNum)
+{
+	struct sembuf sops;
+
+	/* Announce ourselves so that no new shared locker gets in */
+	sops.sem_op = 1;
+	sops.sem_flg = SEM_UNDO;
+	sops.sem_num = writerSemNum;
+	semaphore_op(&sops, 1, "lock");
+
+	/* Wait for the holders to go away */
+	sops.sem_op = -POOL_SEM_SHARED_MAX;
+	sops.sem_flg = SEM_UNDO;
+	sops.sem_num = semNum;
+	semaphore_op(&sops, 1, "lock");
+}
+
+void
+pool_semaphore_unlock_exclusive(int semNum, int writerSemNum)
+{
+	struct sembuf sops[2];
+
+	sops[0].sem_op = POOL_SEM_SHARED_MAX;
+	sops[0].sem_flg = SEM_UNDO;
+	sops[0].sem_num = semNum;
+	sops[1].sem_op = -1;
+	sops[1].sem_flg = SEM_UNDO;
+	sops[1].sem_num = writerSemNum;
+
+	semaphore_op(sops, 2, "unlock");
+}
@@ -33,6 +33,9 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #ifdef HAVE_FCNTL_H
 #include <fcntl.h>
@@ -49,11 +52,16 @@ static int mystrlen(char *str, int upper, int *flag);
 static int mystrlinelen(char *str, int upper, int *flag);
 static int save_pending_data(POOL_CONNECTION *cp, void *data, int len);
 static int consume_pending_data(POOL_CONNECTION *cp, void *data, int len);
+static void reserve_read_buffer(POOL_CONNECTION *cp, int need);
+static void pool_fill_read_buffer(POOL_CONNECTION *cp, int need, bool read2);
+static void pool_wait_read_ready(POOL_CONNECTION *cp, bool read2);
 static MemoryContext SwitchToConnectionContext(bool backend_connection);
 #ifdef DEBUG
 static void dump_buffer(char *buf, int len);
 #endif
 static int pool_write_flush(POOL_CONNECTION *cp, void *buf, int len);
+static void queue_fragment(POOL_CONNECTION *cp, char *buf, int len);
+static int pool_writev_queue(POOL_CONNECTION *cp);
 
 static MemoryContext
     SwitchToConnectionContext(bool backend_connection)
@@ -86,9 +94,17 @@ POOL_CONNECTION *pool_open(int fd, bool backend_connection)
 	cp->wbufsz = WRITEBUFSZ;
 	cp->wbufpo = 0;
 
-	/* initialize pending data buffer */
-	cp->hp = palloc(READBUFSZ);
-	cp->bufsz = READBUFSZ;
+	/*
+	 * initialize output queue. one extra entry is for the direct write in
+	 * pool_write_flush().
+	 */
+	cp->wiov = palloc(sizeof(struct iovec) * (WRITEV_MAX_FRAGMENTS + 1));
+	cp->wiovcnt = 0;
+	cp->wqlen = 0;
+
+	/* initialize receive (pending data) buffer */
+	cp->hp = palloc(RECVBUFSZ);
+	cp->bufsz = RECVBUFSZ;
 	cp->po = 0;
 	cp->len = 0;
 	cp->sbuf = NULL;
@@ -119,6 +135,7 @@ void pool_close(POOL_CONNECTION *cp)
 	close(cp->fd);
 	cp->socket_state = POOL_SOCKET_CLOSED;
 	pfree(cp->wbuf);
+	pfree(cp->wiov);
 	pfree(cp->hp);
 	if (cp->sbuf)
 		pfree(cp->sbuf);
@@ -143,56 +160,130 @@ void pool_read_with_error(POOL_CONNECTION *cp, void *buf, int len,
                  errdetail("error occurred when reading: %s",err_context?err_context:"")));
 	}
 }
+
 /*
-* read len bytes from cp
-* returns 0 on success otherwise throws an ereport.
-*/
-int pool_read(POOL_CONNECTION *cp, void *buf, int len)
+ * Make sure that the receive buffer has room for at least "need" bytes
+ * of valid data starting at cp->po.  Data already in the buffer is
+ * moved to the head of the buffer if that gives enough room, otherwise
+ * the buffer is enlarged.
+ */
+static void reserve_read_buffer(POOL_CONNECTION *cp, int need)
 {
-	static char readbuf[READBUFSZ];
+	int alloc_size;
 
-	int consume_size;
-	int readlen;
+	/* to be safe */
+	if (cp->len <= 0)
+	{
+		cp->len = 0;
+		cp->po = 0;
+	}
 
-	consume_size = consume_pending_data(cp, buf, len);
-	len -= consume_size;
-	buf += consume_size;
+	if (cp->po + need <= cp->bufsz)
+		return;
 
-	while (len > 0)
+	if (need <= cp->bufsz)
 	{
-		if (pool_check_fd(cp))
-		{
-			if (!IS_MASTER_NODE_ID(cp->db_node_id) && (getpid() != mypid))
-			{
-                ereport(FATAL,
-                    (errmsg("unable to read data from DB node %d",cp->db_node_id),
-                         errdetail("data is not ready in DB node")));
+		/* there's enough room in front of the data. compact it. */
+		if (cp->len > 0)
+			memmove(cp->hp, cp->hp + cp->po, cp->len);
+		cp->po = 0;
+		return;
+	}
 
-			}
-			else
-			{
-                ereport(ERROR,
-                    (errmsg("unable to read data from DB node %d",cp->db_node_id),
-                         errdetail("pool_check_fd call failed with an error \"%s\"", strerror(errno))));
-			}
+	/* too small, enlarge it */
+	alloc_size = Max(need, cp->bufsz * 2);
+	alloc_size = (alloc_size/READBUFSZ+1)*READBUFSZ;
+
+	if (cp->po > 0)
+	{
+		if (cp->len > 0)
+			memmove(cp->hp, cp->hp + cp->po, cp->len);
+		cp->po = 0;
+	}
+
+	MemoryContext oldContext = SwitchToConnectionContext(cp->isbackend);
+	cp->hp = repalloc(cp->hp, alloc_size);
+	MemoryContextSwitchTo(oldContext);
+	cp->bufsz = alloc_size;
+}
+
+/*
+ * Wait until the socket of cp becomes readable, honoring the timeout set
+ * by pool_set_timeout().  Throws an ereport if it is not.
+ */
+static void pool_wait_read_ready(POOL_CONNECTION *cp, bool read2)
+{
+	if (pool_check_fd(cp))
+	{
+		if (!IS_MASTER_NODE_ID(cp->db_node_id) && (read2 || getpid() != mypid))
+		{
+			ereport(FATAL,
+				(errmsg("unable to read data from DB node %d",cp->db_node_id),
+					 errdetail("data is not ready in DB node")));
 		}
+		else
+		{
+			ereport(ERROR,
+				(errmsg("unable to read data from DB node %d",cp->db_node_id),
+					 errdetail("pool_check_fd call failed with an error \"%s\"", strerror(errno))));
+		}
+	}
+}
+
+/*
+ * Fill the receive buffer until at least "need" bytes are available.
+ * Each read(2) asks for as many bytes as the buffer can hold, so a burst
+ * of small messages (e.g. DataRows) is received by a few system calls.
+ * If a read fills up the whole free space, the buffer is enlarged (up to
+ * RECVBUFMAXSZ) since it is likely that more data is waiting in the
+ * socket.
+ *
+ * "read2" selects the error reporting of pool_read2() rather than
+ * pool_read().
+ */
+static void pool_fill_read_buffer(POOL_CONNECTION *cp, int need, bool read2)
+{
+	int readlen;
+	int freesz;
+
+	while (cp->len < need)
+	{
+		reserve_read_buffer(cp, need);
+
+		freesz = cp->bufsz - cp->po - cp->len;
 
 		if (cp->ssl_active > 0)
 		{
-		  readlen = pool_ssl_read(cp, readbuf, READBUFSZ);
+			/*
+			 * SSL_read() may need to read more than one record from the
+			 * socket, so we wait for the data before reading.
+			 */
+			pool_wait_read_ready(cp, read2);
+			readlen = pool_ssl_read(cp, cp->hp + cp->po + cp->len, freesz);
 		}
 		else
 		{
-		  readlen = read(cp->fd, readbuf, READBUFSZ);
-		  if (cp->isbackend)
-		  {
-			  ereport(DEBUG1,
-				  (errmsg("pool_read: read %d bytes from backend %d",
-						  readlen, cp->db_node_id)));
+			/*
+			 * Try to read optimistically without waiting. Most of the time
+			 * the data is already in the socket buffer and we can save a
+			 * poll(2) call. Only if there's nothing to read, wait for it.
+			 */
+			readlen = recv(cp->fd, cp->hp + cp->po + cp->len, freesz, MSG_DONTWAIT);
+			if (readlen == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				pool_wait_read_ready(cp, read2);
+				continue;
+			}
+
+			if (cp->isbackend)
+			{
+				ereport(DEBUG1,
+					(errmsg("%s: read %d bytes from backend %d",
+							read2?"pool_read2":"pool_read", readlen, cp->db_node_id)));
 #ifdef DEBUG
-			  dump_buffer(readbuf, readlen);
+				dump_buffer(cp->hp + cp->po + cp->len, readlen);
 #endif
-		  }
+			}
 		}
 
 		if (readlen == -1)
@@ -229,6 +320,10 @@ int pool_read(POOL_CONNECTION *cp, void *buf, int len)
 				}
 				else
 				{
+					if (read2)
+						ereport(ERROR,
+								(errmsg("unable to read data from DB node %d",cp->db_node_id),
+								 errdetail("do not failover because fail_over_on_backend_error is off")));
 					ereport(ERROR,
 							(errmsg("unable to read data from DB node %d",cp->db_node_id),
 							 errdetail("socket read failed with an error \"%s\"", strerror(errno))));
@@ -236,6 +331,10 @@ int pool_read(POOL_CONNECTION *cp, void *buf, int len)
 			}
 			else
 			{
+				if (read2)
+					ereport(ERROR,
+						(errmsg("unable to read data from frontend"),
+							 errdetail("socket read function returned -1")));
                 ereport(FRONTEND_ERROR,
 					(errmsg("unable to read data from frontend"),
                          errdetail("socket read failed with an error \"%s\"", strerror(errno))));
@@ -246,7 +345,7 @@ int pool_read(POOL_CONNECTION *cp, void *buf, int len)
 			cp->socket_state = POOL_SOCKET_EOF;
 			if (cp->isbackend)
 			{
-				if (processType == PT_MAIN || processType == PT_HEALTH_CHECK)
+				if (read2 || processType == PT_MAIN || processType == PT_HEALTH_CHECK)
 					ereport(ERROR,
 						(errmsg("unable to read data from DB node %d",cp->db_node_id),
 							 errdetail("EOF encountered with backend")));
@@ -260,159 +359,137 @@ int pool_read(POOL_CONNECTION *cp, void *buf, int len)
 				/*
 				 * if backend offers authentication method, frontend could close connection
 				 */
+				if (read2)
+					ereport(ERROR,
+						(errmsg("unable to read data from frontend"),
+							 errdetail("EOF read on socket")));
                 ereport(FRONTEND_ERROR,
 					(errmsg("unable to read data from frontend"),
                          errdetail("EOF encountered with frontend")));
 			}
 		}
 
-		if (len < readlen)
-		{
-			/* overrun. we need to save remaining data to pending buffer */
-			save_pending_data(cp, readbuf+len, readlen-len);
-			memmove(buf, readbuf, len);
-			break;
-		}
+		cp->len += readlen;
 
-		memmove(buf, readbuf, readlen);
-		buf += readlen;
-		len -= readlen;
+		/*
+		 * We filled up the whole buffer. More data is likely to be
+		 * waiting in the socket, so give us more room next time.
+		 */
+		if (readlen == freesz && cp->bufsz < RECVBUFMAXSZ)
+			reserve_read_buffer(cp, Min(cp->bufsz * 2, RECVBUFMAXSZ));
 	}
+}
+
+/*
+* read len bytes from cp
+* returns 0 on success otherwise throws an ereport.
+*/
+int pool_read(POOL_CONNECTION *cp, void *buf, int len)
+{
+	if (cp->len < len)
+		pool_fill_read_buffer(cp, len, false);
 
+	consume_pending_data(cp, buf, len);
 	return 0;
 }
 
 /*
 * read exactly len bytes from cp
 * returns buffer address on success otherwise NULL.
+*
+* The returned buffer is owned by cp and stays valid until next
+* pool_read2() call on cp.
 */
 char *pool_read2(POOL_CONNECTION *cp, int len)
 {
-	char *buf;
-	int req_size;
 	int alloc_size;
-	int consume_size;
-	int readlen;
-    MemoryContext oldContext = SwitchToConnectionContext(cp->isbackend);
 
-	req_size = cp->len + len;
-
-	if (req_size > cp->bufsz2)
+	if (len > cp->bufsz2)
 	{
-		alloc_size = ((req_size+1)/READBUFSZ+1)*READBUFSZ;
+	    MemoryContext oldContext = SwitchToConnectionContext(cp->isbackend);
+		alloc_size = ((len+1)/READBUFSZ+1)*READBUFSZ;
 		cp->buf2 = repalloc(cp->buf2, alloc_size);
 		cp->bufsz2 = alloc_size;
+	    MemoryContextSwitchTo(oldContext);
 	}
 
-	buf = cp->buf2;
+	if (cp->len < len)
+		pool_fill_read_buffer(cp, len, true);
 
-	consume_size = consume_pending_data(cp, buf, len);
-	len -= consume_size;
-	buf += consume_size;
+	consume_pending_data(cp, cp->buf2, len);
+	return cp->buf2;
+}
 
-	while (len > 0)
-	{
-		if (pool_check_fd(cp))
-		{
-			if (!IS_MASTER_NODE_ID(cp->db_node_id))
-			{
-                ereport(FATAL,
-                    (errmsg("unable to read data from DB node %d",cp->db_node_id),
-                         errdetail("data is not ready in DB node")));
-                
-			}
-			else
-			{
-                ereport(ERROR,
-                    (errmsg("unable to read data from DB node %d",cp->db_node_id),
-                         errdetail("pool_check_fd call failed with an error \"%s\"", strerror(errno))));
-            }
-		}
+/*
+* make sure that at least len bytes are in the receive buffer of cp and
+* return the address of them without consuming.
+*
+* The returned pointer is valid until the next read, unread or push/pop
+* operation on cp. More than len bytes may be available; see
+* pool_read_buffer_length().
+*/
+char *pool_peek(POOL_CONNECTION *cp, int len)
+{
+	if (cp->len < len)
+		pool_fill_read_buffer(cp, len, false);
 
-		if (cp->ssl_active > 0)
-		{
-		  readlen = pool_ssl_read(cp, buf, len);
-		}
-		else
-		{
-		  readlen = read(cp->fd, buf, len);
-		  if (cp->isbackend)
-			  ereport(DEBUG1,
-				  (errmsg("pool_read2: read %d bytes from backend %d",
-						  readlen, cp->db_node_id)));
-		}
+	return cp->hp + cp->po;
+}
 
-		if (readlen == -1)
-		{
-			if (errno == EINTR || errno == EAGAIN)
-			{
-				ereport(DEBUG1,
-					(errmsg("read on socket failed with error :\"%s\"",strerror(errno)),
-						 errdetail("retrying...")));
-				continue;
-			}
+/*
+* read exactly len bytes from cp without copying.
+* returns the address of the data in the receive buffer of cp.
+*
+* Unlike pool_read2(), the returned pointer points directly into the
+* receive buffer, and it is only valid until the next read, unread or
+* push/pop operation on cp. Use this for whole protocol messages which
+* are consumed (forwarded, parsed or copied) right away.
+*/
+char *pool_read_direct(POOL_CONNECTION *cp, int len)
+{
+	char *p;
 
-			cp->socket_state = POOL_SOCKET_ERROR;
-			if (cp->isbackend)
-			{
-				if (cp->con_info && cp->con_info->swallow_termination == 1)
-				{
-					cp->con_info->swallow_termination = 0;
-					ereport(FATAL,
-						(errmsg("unable to read data from DB node %d",cp->db_node_id),
-							 errdetail("pg_terminate_backend was called on the backend")));
-				}
+	if (cp->len < len)
+		pool_fill_read_buffer(cp, len, true);
 
-				/* if fail_over_on_backend_error is true, then trigger failover */
-				if (pool_config->fail_over_on_backend_error)
-				{
-					notice_backend_error(cp->db_node_id, REQ_DETAIL_SWITCHOVER);
-					child_exit(POOL_EXIT_AND_RESTART);
-                    /* we are in main process */
-                    ereport(ERROR,
-                            (errmsg("unable to read data from DB node %d",cp->db_node_id),
-                             errdetail("socket read failed with an error \"%s\"", strerror(errno))));
-				}
-				else
-				{
-                    ereport(ERROR,
-                        (errmsg("unable to read data from DB node %d",cp->db_node_id),
-                             errdetail("do not failover because fail_over_on_backend_error is off")));
-				}
-			}
-			else
-			{
-                ereport(ERROR,
-                    (errmsg("unable to read data from frontend"),
-                         errdetail("socket read function returned -1")));
-			}
-		}
-		else if (readlen == 0)
-		{
-			cp->socket_state = POOL_SOCKET_EOF;
-			if (cp->isbackend)
-			{
-                ereport(ERROR,
-                    (errmsg("unable to read data from backend"),
-                         errdetail("EOF read on socket")));
-			}
-			else
-			{
-				/*
-				 * if backend offers authentication method, frontend could close connection
-				 */
-                ereport(ERROR,
-                    (errmsg("unable to read data from frontend"),
-                         errdetail("EOF read on socket")));
+	p = cp->hp + cp->po;
+	cp->len -= len;
 
-			}
-		}
+	if (cp->len <= 0)
+	{
+		cp->len = 0;
+		cp->po = 0;
+	}
+	else
+		cp->po += len;
 
-		buf += readlen;
-		len -= readlen;
+	return p;
+}
+
+/*
+ * Append a fragment to the output queue of cp.  If the fragment directly
+ * follows the last one in memory (which is usually the case for data
+ * copied into the write buffer), the last fragment is extended instead.
+ */
+static void queue_fragment(POOL_CONNECTION *cp, char *buf, int len)
+{
+	struct iovec *last;
+
+	if (cp->wiovcnt > 0)
+	{
+		last = &cp->wiov[cp->wiovcnt - 1];
+		if ((char *)last->iov_base + last->iov_len == buf)
+		{
+			last->iov_len += len;
+			cp->wqlen += len;
+			return;
+		}
 	}
-    MemoryContextSwitchTo(oldContext);
-	return cp->buf2;
+
+	cp->wiov[cp->wiovcnt].iov_base = buf;
+	cp->wiov[cp->wiovcnt].iov_len = len;
+	cp->wiovcnt++;
+	cp->wqlen += len;
 }
 
 /*
@@ -450,45 +527,30 @@ int pool_write_noerror(POOL_CONNECTION *cp, void *buf, int len)
 			ereport(DEBUG1,
 					(errmsg("pool_write: to frontend: length:%d po:%d", len, cp->wbufpo)));
 	}
-	
-	while (len > 0)
-	{
-		int remainder = WRITEBUFSZ - cp->wbufpo;
 
-		/*
-		 * If requested data cannot be added to the write buffer, flush the
-		 * buffer and directly write the requested data.  This could avoid
-		 * unwanted write in the middle of message boundary.
-		 */
-		if (remainder < len)
-		{
-			if (pool_flush_it(cp) == -1)
-				return -1;
+	if (len == 0)
+		return 0;
 
-			if (pool_write_flush(cp, buf, len) < 0)
-				return -1;
-			return 0;
-		}
+	/*
+	 * If requested data cannot be added to the write buffer, write out
+	 * the queued data and the requested data at once, without copying the
+	 * requested data.  This could also avoid unwanted write in the middle
+	 * of message boundary.
+	 */
+	if (WRITEBUFSZ - cp->wbufpo < len)
+		return pool_write_flush(cp, buf, len);
 
-		if (cp->wbufpo >= WRITEBUFSZ)
-		{
-			/*
-			 * Write buffer is full. so flush buffer.
-			 * wbufpo is reset in pool_flush_it().
-			 */
-			if (pool_flush_it(cp) == -1)
-				return -1;
-            remainder = WRITEBUFSZ;
-		}
-        
-		/* check buffer size */
-		remainder = Min(remainder, len);
-
-		memcpy(cp->wbuf+cp->wbufpo, buf, remainder);
-		cp->wbufpo += remainder;
-		buf += remainder;
-		len -= remainder;
+	/* Output queue is full. so flush it. */
+	if (cp->wiovcnt >= WRITEV_MAX_FRAGMENTS)
+	{
+		if (pool_flush_it(cp) == -1)
+			return -1;
 	}
+
+	memcpy(cp->wbuf+cp->wbufpo, buf, len);
+	queue_fragment(cp, cp->wbuf+cp->wbufpo, len);
+	cp->wbufpo += len;
+
 	return 0;
 }
 
@@ -511,155 +573,84 @@ int pool_write(POOL_CONNECTION *cp, void *buf, int len)
     return 0;
 }
 
-
 /*
- * Direct write.
- * This function does not throws an ereport in case of an error
+ * Queue len bytes to cp without copying them into the write buffer.
+ *
+ * The caller must keep buf intact until the data is flushed by
+ * pool_flush() and friends.  Small data are copied anyway since it is
+ * cheaper than an extra fragment in writev(2).
+ * returns 0 on success otherwise ereport.
  */
-static int pool_write_flush(POOL_CONNECTION *cp, void *buf, int len)
+int pool_write_ref(POOL_CONNECTION *cp, void *buf, int len)
 {
-	int sts;
-	int wlen;
-	int offset;
-	wlen = len;
+	if (len < WRITEV_COPY_THRESHOLD || cp->no_forward)
+		return pool_write(cp, buf, len);
 
 	ereport(DEBUG1,
-			(errmsg("pool_write_flush: write size: %d", wlen)));
-
-	if (wlen == 0)
-	{
-		return 0;
-	}
+			(errmsg("pool_write_ref: to %s: length:%d queued:%d",
+					cp->isbackend?"backend":"frontend", len, cp->wqlen)));
 
-	offset = 0;
-
-	for (;;)
+	if (cp->wiovcnt >= WRITEV_MAX_FRAGMENTS)
 	{
-		errno = 0;
-
-		if (cp->ssl_active > 0)
-		{
-			sts = pool_ssl_write(cp, buf+offset, wlen);
-		}
-		else
-		{
-			sts = write(cp->fd, buf+offset, wlen);
-		}
-
-		if (sts > 0)
-		{
-			wlen -= sts;
-
-			if (wlen == 0)
-			{
-				/* write completed */
-				break;
-			}
-
-			else if (wlen < 0)
-			{
-				ereport(WARNING,
-						(errmsg("pool_write_flush: invalid write size %d", sts)));
-				return -1;
-			}
-
-			else
-			{
-				/* need to write remaining data */
-				ereport(DEBUG1,
-						(errmsg("pool_write_flush: write retry: %d", wlen)));
-
-				offset += sts;
-				continue;
-			}
-		}
-
-		else if (errno == EAGAIN || errno == EINTR)
-		{
-			continue;
-		}
-
-		else
-		{
-			/* If this is the backend stream, report error. Otherwise
-			 * just report debug message.
-			 */
-			if (cp->isbackend)
-				ereport(WARNING,
-					(errmsg("write on backend %d failed with error :\"%s\"",cp->db_node_id,strerror(errno)),
-						 errdetail("while trying to write data from offset: %d wlen: %d",offset, wlen)));
-			else
-				ereport(DEBUG1,
-					(errmsg("write on frontend failed with error :\"%s\"",strerror(errno)),
-						 errdetail("while trying to write data from offset: %d wlen: %d",offset, wlen)));
-			return -1;
-		}
+		if (pool_flush_it(cp) == -1)
+	        ereport(ERROR,
+	            (errmsg("unable to write data to %s",cp->isbackend?"backend":"frontend"),
+	                 errdetail("pool_flush failed")));
 	}
 
+	queue_fragment(cp, buf, len);
 	return 0;
 }
 
 /*
- * flush write buffer
+ * Write out all fragments in the output queue using writev(2) and reset
+ * the queue.
  * This function does not throws an ereport in case of an error
  */
-int pool_flush_it(POOL_CONNECTION *cp)
+static int pool_writev_queue(POOL_CONNECTION *cp)
 {
 	int sts;
+	int idx;
 	int wlen;
-	int offset;
-	wlen = cp->wbufpo;
-
-	ereport(DEBUG1,
-			(errmsg("pool_flush_it: flush size: %d", wlen)));
-
-	if (wlen == 0)
-	{
-		return 0;
-	}
 
-	offset = 0;
+	idx = 0;
+	wlen = cp->wqlen;
 
-	for (;;)
+	while (idx < cp->wiovcnt)
 	{
 		errno = 0;
 
 		if (cp->ssl_active > 0)
 		{
-		  sts = pool_ssl_write(cp, cp->wbuf + offset, wlen);
+			sts = pool_ssl_write(cp, cp->wiov[idx].iov_base, cp->wiov[idx].iov_len);
 		}
 		else
 		{
-		  sts = write(cp->fd, cp->wbuf + offset, wlen);
+			sts = writev(cp->fd, &cp->wiov[idx], cp->wiovcnt - idx);
 		}
 
 		if (sts > 0)
 		{
 			wlen -= sts;
 
-			if (wlen == 0)
+			/* skip fragments written completely */
+			while (idx < cp->wiovcnt && sts >= cp->wiov[idx].iov_len)
 			{
-				/* write completed */
-				break;
+				sts -= cp->wiov[idx].iov_len;
+				idx++;
 			}
 
-			else if (wlen < 0)
+			if (idx < cp->wiovcnt && sts > 0)
 			{
-				ereport(WARNING,
-						(errmsg("pool_flush_it: invalid write size %d", sts)));
-				cp->wbufpo = 0;
-				return -1;
+				/* need to write remaining data */
+				cp->wiov[idx].iov_base = (char *)cp->wiov[idx].iov_base + sts;
+				cp->wiov[idx].iov_len -= sts;
 			}
 
-			else
-			{
-				/* need to write remaining data */
+			if (wlen > 0)
 				ereport(DEBUG1,
 						(errmsg("pool_flush_it: write retry: %d", wlen)));
-
-				offset += sts;
-				continue;
-			}
+			continue;
 		}
 
 		else if (errno == EAGAIN || errno == EINTR)
@@ -675,21 +666,60 @@ int pool_flush_it(POOL_CONNECTION *cp)
 			if (cp->isbackend)
 				ereport(WARNING,
 					(errmsg("write on backend %d failed with error :\"%s\"",cp->db_node_id,strerror(errno)),
-						 errdetail("while trying to write data from offset: %d wlen: %d",offset, wlen)));
+						 errdetail("while trying to write data from offset: %d wlen: %d",cp->wqlen - wlen, wlen)));
 			else
 				ereport(DEBUG1,
 					(errmsg("write on frontend failed with error :\"%s\"",strerror(errno)),
-						 errdetail("while trying to write data from offset: %d wlen: %d",offset, wlen)));
+						 errdetail("while trying to write data from offset: %d wlen: %d",cp->wqlen - wlen, wlen)));
+			cp->wiovcnt = 0;
+			cp->wqlen = 0;
 			cp->wbufpo = 0;
 			return -1;
 		}
 	}
 
+	cp->wiovcnt = 0;
+	cp->wqlen = 0;
 	cp->wbufpo = 0;
 
 	return 0;
 }
 
+/*
+ * Direct write.
+ * Write out the output queue followed by buf in one writev(2) call.
+ * This function does not throws an ereport in case of an error
+ */
+static int pool_write_flush(POOL_CONNECTION *cp, void *buf, int len)
+{
+	ereport(DEBUG1,
+			(errmsg("pool_write_flush: write size: %d queued: %d", len, cp->wqlen)));
+
+	/* there's always a room for one more fragment. see pool_open() */
+	queue_fragment(cp, buf, len);
+
+	return pool_writev_queue(cp);
+}
+
+/*
+ * flush write buffer
+ * This function does not throws an ereport in case of an error
+ */
+int pool_flush_it(POOL_CONNECTION *cp)
+{
+	ereport(DEBUG1,
+			(errmsg("pool_flush_it: flush size: %d", cp->wqlen)));
+
+	if (cp->wqlen == 0)
+	{
+		cp->wiovcnt = 0;
+		cp->wbufpo = 0;
+		return 0;
+	}
+
+	return pool_writev_queue(cp);
+}
+
 /*
  * flush write buffer and degenerate/failover if error occurs
  */
@@ -894,32 +924,29 @@ char *pool_read_string(POOL_CONNECTION *cp, int *len, int line)
 
 	for (;;)
 	{
-		if (pool_check_fd(cp))
-		{
-			if (!IS_MASTER_NODE_ID(cp->db_node_id))
-			{
-                ereport(FATAL,
-                    (errmsg("unable to read data from DB node %d",cp->db_node_id),
-                         errdetail("data is not ready in DB node")));
-                
-			}
-			else
-			{
-                ereport(ERROR,
-                    (errmsg("unable to read data from DB node %d",cp->db_node_id),
-                         errdetail("pool_check_fd call failed with an error \"%s\"", strerror(errno))));
-            }
-		}
-
 		if (cp->ssl_active > 0)
 		{
-		  readlen = pool_ssl_read(cp, cp->sbuf+readp, readsize);
+			/* See comments in pool_fill_read_buffer() */
+			pool_wait_read_ready(cp, true);
+			readlen = pool_ssl_read(cp, cp->sbuf+readp, readsize);
 		}
 		else
 		{
-		  readlen = read(cp->fd, cp->sbuf+readp, readsize);
+			/*
+			 * Try to read without waiting first, as pool_fill_read_buffer()
+			 * does.
+			 */
+			readlen = recv(cp->fd, cp->sbuf+readp, readsize, MSG_DONTWAIT);
+			if (readlen == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				pool_wait_read_ready(cp, true);
+				continue;
+			}
 		}
 
+		if (readlen == -1 && errno == EINTR)
+			continue;
+
 		if (readlen == -1)
 		{
 			cp->socket_state = POOL_SOCKET_ERROR;
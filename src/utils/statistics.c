@@ -20,6 +20,7 @@
 #include <string.h>
 
 #include "pool.h"
+#include "pool_config.h"
 #include "parser/nodes.h"
 
 /*
@@ -32,10 +33,35 @@ typedef struct {
 	uint64		delete_cnt;	/* number of DELETE queries issued */
 	uint64		ddl_cnt;	/* number of DDL queries issued */
 	uint64		other_cnt;	/* number of any other queries issued */
+	double		latency;	/* moving average of SELECT response time in usec */
+	uint64		latency_samples;	/* number of response times measured */
 } PER_NODE_STAT;
 
+/*
+ * Smoothing factor of the response time moving average, and number of
+ * samples needed before it is trusted.
+ */
+#define LATENCY_EWMA_ALPHA		0.2
+#define LATENCY_MIN_SAMPLES		10
+
 static volatile PER_NODE_STAT *per_node_stat;
 
+/*
+ * Per child process, per backend node load counters in shared memory.
+ * Used by load_balance_algorithm = least_outstanding.  Each child only
+ * writes its own row, so no locking is needed; readers sum up all rows.
+ * The row of a child is cleared by pgpool main when the child exits so
+ * that counts of a crashed child do not linger.
+ */
+typedef struct {
+	int		active_sessions;	/* sessions using the node as load balance node */
+	int		in_flight_queries;	/* queries sent and not yet completed */
+} PER_CHILD_NODE_LOAD;
+
+static volatile PER_CHILD_NODE_LOAD *per_child_load;
+
+static volatile PER_CHILD_NODE_LOAD *my_node_load(int backend_node_id);
+
 /*
  * Return shared memory size necessary for this module
  */
@@ -46,6 +72,10 @@ size_t stat_shared_memory_size(void)
 	/* query counter area */
 	size = MAXALIGN(MAX_NUM_BACKENDS * sizeof(PER_NODE_STAT));
 
+	/* load counter area */
+	size += MAXALIGN(pool_config->num_init_children * MAX_NUM_BACKENDS *
+					 sizeof(PER_CHILD_NODE_LOAD));
+
 	return size;
 }
 
@@ -56,6 +86,8 @@ size_t stat_shared_memory_size(void)
 void stat_set_stat_area(void *address)
 {
 	per_node_stat = (PER_NODE_STAT *)address;
+	per_child_load = (PER_CHILD_NODE_LOAD *)((char *)address +
+					MAXALIGN(MAX_NUM_BACKENDS * sizeof(PER_NODE_STAT)));
 }
 
 /*
@@ -95,3 +127,108 @@ uint64 stat_get_select_count(int backend_node_id)
 {
 	return per_node_stat[backend_node_id].select_cnt;
 }
+
+/*
+ * Clear load counters of a child process.  Called by pgpool main when
+ * the child exits.
+ */
+void stat_clear_child_load(int child_id)
+{
+	memset((void *)&per_child_load[child_id * MAX_NUM_BACKENDS], 0,
+		   MAX_NUM_BACKENDS * sizeof(PER_CHILD_NODE_LOAD));
+}
+
+/*
+ * Return this child's load counters of the node, or NULL if we are not
+ * a child process.
+ */
+static volatile PER_CHILD_NODE_LOAD *my_node_load(int backend_node_id)
+{
+	if (processType != PT_CHILD ||
+		my_proc_id < 0 || my_proc_id >= pool_config->num_init_children)
+		return NULL;
+
+	return &per_child_load[my_proc_id * MAX_NUM_BACKENDS + backend_node_id];
+}
+
+/*
+ * Load counter update functions
+ */
+void stat_session_start(int backend_node_id)
+{
+	volatile PER_CHILD_NODE_LOAD *l = my_node_load(backend_node_id);
+
+	if (l)
+		l->active_sessions++;
+}
+
+void stat_session_end(int backend_node_id)
+{
+	volatile PER_CHILD_NODE_LOAD *l = my_node_load(backend_node_id);
+
+	if (l && l->active_sessions > 0)
+		l->active_sessions--;
+}
+
+void stat_query_start(int backend_node_id)
+{
+	volatile PER_CHILD_NODE_LOAD *l = my_node_load(backend_node_id);
+
+	if (l)
+		l->in_flight_queries++;
+}
+
+void stat_query_end(int backend_node_id)
+{
+	volatile PER_CHILD_NODE_LOAD *l = my_node_load(backend_node_id);
+
+	if (l && l->in_flight_queries > 0)
+		l->in_flight_queries--;
+}
+
+/*
+ * Return the number of active sessions plus in-flight queries of the
+ * node summed up over all child processes.
+ */
+int stat_get_node_load(int backend_node_id)
+{
+	int i;
+	int load = 0;
+
+	for (i=0;i<pool_config->num_init_children;i++)
+	{
+		volatile PER_CHILD_NODE_LOAD *l = &per_child_load[i * MAX_NUM_BACKENDS + backend_node_id];
+
+		load += l->active_sessions + l->in_flight_queries;
+	}
+	return load;
+}
+
+/*
+ * Feed a response time measured in usec into the node's moving average.
+ * The update is not locked: a concurrent update of another child may
+ * get lost, which only costs one sample.
+ */
+void stat_update_latency(int backend_node_id, double usec)
+{
+	volatile PER_NODE_STAT *stat = &per_node_stat[backend_node_id];
+
+	if (stat->latency_samples == 0)
+		stat->latency = usec;
+	else
+		stat->latency += LATENCY_EWMA_ALPHA * (usec - stat->latency);
+	stat->latency_samples++;
+}
+
+/*
+ * Return the moving average of the node's response time in usec, or 0
+ * if there are not enough samples yet.
+ */
+double stat_get_latency(int backend_node_id)
+{
+	volatile PER_NODE_STAT *stat = &per_node_stat[backend_node_id];
+
+	if (stat->latency_samples < LATENCY_MIN_SAMPLES)
+		return 0.0;
+	return stat->latency;
+}